@@ -0,0 +1,270 @@
+#include "koopa.h"
+#include "raw.hpp"
+#include "opt.hpp"
+#include <cassert>
+#include <unordered_map>
+#include <unordered_set>
+
+/** 地址分解为 来源指针 + sum(非常量下标 * 元素大小) + 常量字节偏移 */
+struct addr_t {
+  koopa_raw_value_t source;
+  std::vector<std::pair<koopa_raw_value_t, size_t> > terms;
+  long long offset;
+};
+
+/** 指针类型的局部变量 (如数组参数) 所指向的基对象, nullptr 表示无法确定 */
+static std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> ptr_base;
+/** 尚未确定基对象的指针变量 */
+static std::unordered_set<koopa_raw_value_t> ptr_pending;
+/** 只被写入一次的指针变量, 每次读取得到同一指针 */
+static std::unordered_set<koopa_raw_value_t> ptr_single;
+/** 地址分解结果的缓存 */
+static std::unordered_map<koopa_raw_value_t, addr_t> addr_cache;
+/** 所有调用点都只传入局部数组的数组参数, 在调用期间不会与全局变量重叠 */
+static std::unordered_set<koopa_raw_value_t> local_params;
+
+// 沿 getelemptr / getptr 找到地址的来源: 对象本身, 或读取指针变量得到的指针
+static koopa_raw_value_t ptr_source(koopa_raw_value_t ptr) {
+  while(true) {
+    if(ptr->kind.tag == KOOPA_RVT_GET_ELEM_PTR)
+      ptr = ptr->kind.data.get_elem_ptr.src;
+    else if(ptr->kind.tag == KOOPA_RVT_GET_PTR)
+      ptr = ptr->kind.data.get_ptr.src;
+    else
+      return ptr;
+  }
+}
+
+// 求地址所基于的对象: 局部数组 (alloc), 全局变量 (global alloc) 或数组参数 (func arg ref)
+// 无法确定时返回 nullptr
+koopa_raw_value_t mem_base(koopa_raw_value_t ptr) {
+  ptr = ptr_source(ptr);
+  switch(ptr->kind.tag) {
+    case KOOPA_RVT_ALLOC:
+    case KOOPA_RVT_GLOBAL_ALLOC:
+    case KOOPA_RVT_FUNC_ARG_REF:
+      return ptr;
+    case KOOPA_RVT_LOAD: {
+      auto it = ptr_base.find(ptr->kind.data.load.src);
+      return it == ptr_base.end() ? nullptr : it->second;
+    }
+    default:
+      return nullptr;
+  }
+}
+
+// 分析函数中指针变量可能指向的基对象, 供 mem_base 与 may_alias 使用
+void init_alias(koopa_raw_function_t func) {
+  ptr_base.clear();
+  ptr_pending.clear();
+  ptr_single.clear();
+  addr_cache.clear();
+  std::unordered_map<koopa_raw_value_t, std::vector<koopa_raw_value_t> > stored;
+  for(koopa_raw_basic_block_t bb : get_bbs(func)) {
+    for(koopa_raw_value_t inst : get_insts(bb)) {
+      if(inst->kind.tag != KOOPA_RVT_STORE)
+        continue;
+      koopa_raw_value_t dest = inst->kind.data.store.dest;
+      if(dest->kind.tag == KOOPA_RVT_ALLOC && dest->ty->data.pointer.base->tag == KOOPA_RTT_POINTER) {
+        stored[dest].push_back(inst->kind.data.store.value);
+        ptr_pending.insert(dest);
+      }
+    }
+  }
+  for(auto &entry : stored)
+    if(entry.second.size() == 1)
+      ptr_single.insert(entry.first);
+  // 指针变量的基对象由所有写入的值决定, 基于自身递增的值不影响结果
+  bool changed = true;
+  while(changed) {
+    changed = false;
+    for(auto &entry : stored) {
+      if(!ptr_pending.count(entry.first))
+        continue;
+      koopa_raw_value_t base = nullptr;
+      bool ready = true, first = true;
+      for(koopa_raw_value_t value : entry.second) {
+        koopa_raw_value_t src = ptr_source(value);
+        if(src->kind.tag == KOOPA_RVT_LOAD) {
+          koopa_raw_value_t var = src->kind.data.load.src;
+          if(var == entry.first)
+            continue;
+          if(ptr_pending.count(var)) {
+            ready = false;
+            break;
+          }
+        }
+        koopa_raw_value_t b = mem_base(value);
+        if(first)
+          base = b;
+        else if(base != b)
+          base = nullptr;
+        first = false;
+      }
+      if(!ready)
+        continue;
+      ptr_pending.erase(entry.first);
+      ptr_base[entry.first] = base;
+      changed = true;
+    }
+  }
+  // 互相依赖的指针变量无法确定
+  for(koopa_raw_value_t alloc : ptr_pending)
+    ptr_base[alloc] = nullptr;
+  ptr_pending.clear();
+}
+
+// 在所有函数中检查数组参数的实参, 求出不会指向全局变量的数组参数
+// 之后需要重新对具体函数调用 init_alias
+void init_alias(const koopa_raw_program_t &program) {
+  local_params.clear();
+  std::vector<std::pair<koopa_raw_value_t, koopa_raw_value_t> > args;
+  for(size_t i = 0; i < program.funcs.len; ++i) {
+    koopa_raw_function_t func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    if(func->bbs.len == 0)
+      continue;
+    for(size_t j = 0; j < func->params.len; ++j) {
+      koopa_raw_value_t param = reinterpret_cast<koopa_raw_value_t>(func->params.buffer[j]);
+      if(param->ty->tag == KOOPA_RTT_POINTER)
+        local_params.insert(param);
+    }
+    init_alias(func);
+    for(koopa_raw_basic_block_t bb : get_bbs(func)) {
+      for(koopa_raw_value_t inst : get_insts(bb)) {
+        if(inst->kind.tag != KOOPA_RVT_CALL || inst->kind.data.call.callee->bbs.len == 0)
+          continue;
+        const koopa_raw_slice_t &params = inst->kind.data.call.callee->params;
+        const koopa_raw_slice_t &call_args = inst->kind.data.call.args;
+        for(size_t j = 0; j < call_args.len && j < params.len; ++j) {
+          koopa_raw_value_t arg = reinterpret_cast<koopa_raw_value_t>(call_args.buffer[j]);
+          if(arg->ty->tag == KOOPA_RTT_POINTER)
+            args.push_back({reinterpret_cast<koopa_raw_value_t>(params.buffer[j]), mem_base(arg)});
+        }
+      }
+    }
+  }
+  // 实参为全局数组, 未知指针或可能指向全局变量的参数时排除, 直到不动点
+  bool changed = true;
+  while(changed) {
+    changed = false;
+    for(auto &arg : args) {
+      koopa_raw_value_t base = arg.second;
+      if(!local_params.count(arg.first) ||
+         (base != nullptr && (base->kind.tag == KOOPA_RVT_ALLOC || local_params.count(base))))
+        continue;
+      local_params.erase(arg.first);
+      changed = true;
+    }
+  }
+}
+
+// 访问的字节数, 标量指针变量按 4 字节计
+static size_t access_size(koopa_raw_value_t ptr) {
+  koopa_raw_type_t base = ptr->ty->data.pointer.base;
+  if(base->tag == KOOPA_RTT_INT32 || base->tag == KOOPA_RTT_ARRAY)
+    return calc_size(base);
+  return 4;
+}
+
+// 将地址分解为来源指针、非常量下标项与常量偏移
+static const addr_t &decompose(koopa_raw_value_t ptr) {
+  auto it = addr_cache.find(ptr);
+  if(it != addr_cache.end())
+    return it->second;
+  addr_t addr;
+  koopa_raw_value_t src = nullptr, index = nullptr;
+  size_t scale = 0;
+  if(ptr->kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
+    src = ptr->kind.data.get_elem_ptr.src;
+    index = ptr->kind.data.get_elem_ptr.index;
+    koopa_raw_type_t base = src->ty->data.pointer.base;
+    scale = calc_size(base->tag == KOOPA_RTT_ARRAY ? base->data.array.base : base);
+  }
+  else if(ptr->kind.tag == KOOPA_RVT_GET_PTR) {
+    src = ptr->kind.data.get_ptr.src;
+    index = ptr->kind.data.get_ptr.index;
+    scale = calc_size(src->ty->data.pointer.base);
+  }
+  if(src == nullptr) {
+    addr.source = ptr;
+    addr.offset = 0;
+  }
+  else {
+    addr = decompose(src);
+    if(index->kind.tag == KOOPA_RVT_INTEGER)
+      addr.offset += (long long)index->kind.data.integer.value * scale;
+    else
+      addr.terms.push_back({index, scale});
+  }
+  return addr_cache[ptr] = addr;
+}
+
+// 地址是否为来源指针 source 加上常量字节偏移 offset
+bool get_const_offset(koopa_raw_value_t ptr, koopa_raw_value_t &source, long long &offset) {
+  const addr_t &addr = decompose(ptr);
+  if(!addr.terms.empty())
+    return false;
+  source = addr.source;
+  offset = addr.offset;
+  return true;
+}
+
+// 两个来源指针是否相同: 同一个值, 或读取同一个只写入过一次的指针变量
+static bool same_source(koopa_raw_value_t a, koopa_raw_value_t b) {
+  if(a == b)
+    return true;
+  return a->kind.tag == KOOPA_RVT_LOAD && b->kind.tag == KOOPA_RVT_LOAD &&
+         a->kind.data.load.src == b->kind.data.load.src && ptr_single.count(a->kind.data.load.src);
+}
+
+// 两个基对象是否可能重叠, nullptr 表示未知
+static bool bases_may_alias(koopa_raw_value_t a, koopa_raw_value_t b) {
+  if(a == nullptr || b == nullptr || a == b)
+    return true;
+  // 数组参数指向调用者的内存, 不会与本函数的局部数组重叠
+  bool a_param = a->kind.tag == KOOPA_RVT_FUNC_ARG_REF, b_param = b->kind.tag == KOOPA_RVT_FUNC_ARG_REF;
+  if(!a_param && !b_param)
+    return false;
+  if(a->kind.tag == KOOPA_RVT_ALLOC || b->kind.tag == KOOPA_RVT_ALLOC)
+    return false;
+  // 只接收局部数组的参数不会与全局变量重叠
+  if((a_param && local_params.count(a) && b->kind.tag == KOOPA_RVT_GLOBAL_ALLOC) ||
+     (b_param && local_params.count(b) && a->kind.tag == KOOPA_RVT_GLOBAL_ALLOC))
+    return false;
+  return true;
+}
+
+// 两个地址是否可能指向同一内存
+bool may_alias(koopa_raw_value_t p, koopa_raw_value_t q) {
+  koopa_raw_value_t a = mem_base(p), b = mem_base(q);
+  if(!bases_may_alias(a, b))
+    return false;
+  if(a != b)
+    return true;
+  // 同一来源且下标项相同时, 比较常量偏移范围
+  const addr_t &x = decompose(p), &y = decompose(q);
+  if(!same_source(x.source, y.source) || x.terms != y.terms)
+    return true;
+  return x.offset < y.offset + (long long)access_size(q) && y.offset < x.offset + (long long)access_size(p);
+}
+
+// 调用是否可能读 (write 为 false) 或写 (write 为 true) ptr 指向的内存
+bool call_may_access(koopa_raw_value_t call, koopa_raw_value_t ptr, const modref_t &callee, bool write) {
+  koopa_raw_value_t base = mem_base(ptr);
+  if(base == nullptr)
+    return true;
+  const std::unordered_set<koopa_raw_value_t> &globals = write ? callee.mod : callee.ref;
+  if(base->kind.tag == KOOPA_RVT_GLOBAL_ALLOC && globals.count(base))
+    return true;
+  // 数组参数可能指向被调用函数访问的全局数组
+  if(base->kind.tag == KOOPA_RVT_FUNC_ARG_REF && !local_params.count(base) && !globals.empty())
+    return true;
+  // 被调用函数可以通过实参访问整个基对象, 不能只比较偏移
+  const koopa_raw_slice_t &args = call->kind.data.call.args;
+  for(size_t i = 0; i < args.len; ++i) {
+    koopa_raw_value_t arg = reinterpret_cast<koopa_raw_value_t>(args.buffer[i]);
+    if(arg->ty->tag == KOOPA_RTT_POINTER && bases_may_alias(mem_base(arg), base))
+      return true;
+  }
+  return false;
+}
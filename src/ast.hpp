@@ -6,6 +6,7 @@
 #include <cassert>
 #include <vector>
 #include <stack>
+#include <algorithm>
 #include <unordered_map>
 #include "symbol.hpp"
 
@@ -19,6 +20,10 @@ static unsigned int logical_id = 0;
 static unsigned int while_id = 0;
 /** Function entry number */
 static unsigned int entry_id = 0;
+/** Zero-fill loop number */
+static unsigned int zero_fill_id = 0;
+/** Local arrays with at least this many padded zeros are cleared by a loop */
+static const int zero_fill_threshold = 16;
 /** True if jump or ret exists inside a block */
 static bool block_end = false;
 /** True if it's a parameter reference */
@@ -29,11 +34,47 @@ static bool is_all_layer = false;
 static symbol_field field = symbol_field::Field_Global;
 /** Vector of `while_id` as an iterative struct */
 static std::stack<int> while_id_stack;
+/** Global definitions of local const arrays, emitted before all functions */
+static std::string const_arr_str;
 /** Current local symbol table */
 extern symbol_table_list_elem_t *curr_symbol_table;
 /** Global symbol table */
 extern std::unordered_map<std::string, symbol_t> global_symbol_table;
 
+/**
+ * @brief Append the Koopa initializer of a flattened array, `zeroinit` if all elements are 0.
+ * @param arr_init Flattened initial value.
+ * @param dim_vec Vector of dimension value, innermost first.
+*/
+static void dumpAggregate(const std::vector<int> &arr_init, const std::vector<int> &dim_vec, std::string &str) {
+    if(std::all_of(arr_init.begin(), arr_init.end(), [](int i) { return i == 0; })) {
+        str += "zeroinit";
+        return;
+    }
+    // Open a brace whenever an index reaches the start of a sub-array, close it at the end
+    int vec_size = dim_vec.size();
+    int arr_len = arr_init.size();
+    for(int i = 0; i < arr_len; ++i) {
+        int layer_size = 1;
+        for(int j = 0; j < vec_size; ++j) {
+            layer_size *= dim_vec[j];
+            if(i % layer_size != 0)
+                break;
+            str += "{";
+        }
+        str += std::to_string(arr_init[i]);
+        layer_size = 1;
+        for(int j = 0; j < vec_size; ++j) {
+            layer_size *= dim_vec[j];
+            if((i + 1) % layer_size != 0)
+                break;
+            str += "}";
+        }
+        if(i + 1 < arr_len)
+            str += ", ";
+    }
+}
+
 /**
  * BaseAST is the base of all AST class.
 */
@@ -60,10 +101,10 @@ class BaseAST {
     */
     virtual std::string getPointer() const = 0;
     /**
-     * @brief Return array initial value whose blank is filled with 0.
+     * @brief Append array initial value to `arr_init`, whose blank is filled with 0 (-1 for local variables).
      * @param dim_vec Vector of dimension value.
     */
-    virtual std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const = 0;
+    virtual void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const = 0;
 };
 
 /**
@@ -76,7 +117,9 @@ class CompUnitRootAST : public BaseAST {
     std::string DumpIR() const override {
         std::string str;
         str += koopa_lib();
-        str += compunit->DumpIR();
+        std::string body = compunit->DumpIR();
+        str += const_arr_str;
+        str += body;
         return str;
     }
 
@@ -92,9 +135,7 @@ class CompUnitRootAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -159,9 +200,7 @@ class CompUnitAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -244,9 +283,7 @@ class FuncDefAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -286,9 +323,7 @@ class FuncTypeAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -396,9 +431,7 @@ class FuncFParamAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -442,9 +475,7 @@ class BlockAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -482,9 +513,7 @@ class StmtAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -597,9 +626,7 @@ class OpenStmtAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -698,9 +725,7 @@ class ClosedStmtAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -821,9 +846,7 @@ class NonIfStmtAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -852,9 +875,7 @@ class ExpAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -920,9 +941,7 @@ class PrimaryExpAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -1031,9 +1050,7 @@ class UnaryExpAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -1117,9 +1134,7 @@ class MulExpAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -1192,9 +1207,7 @@ class AddExpAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -1289,9 +1302,7 @@ class RelExpAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -1364,9 +1375,7 @@ class EqExpAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -1436,9 +1445,7 @@ class LAndExpAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -1507,9 +1514,7 @@ class LOrExpAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -1547,9 +1552,7 @@ class DeclAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -1581,9 +1584,7 @@ class ConstDeclAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -1611,9 +1612,7 @@ class BTypeAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -1636,11 +1635,10 @@ class ConstDefAST : public BaseAST {
     std::unique_ptr<std::vector<std::unique_ptr<BaseAST> > > constexpvec;
 
     std::string DumpIR() const override {
-        std::string str;
-        std::unique_ptr<std::vector<int> > arr_init;
+        std::string str, global_str, dim_str;
+        std::vector<int> arr_init;
         int const_val, arr_len, vec_size;
         std::vector<int> dim_vec;
-        int elem_num;
         switch(type) {
             case ConstDef_Int:
                 const_val = ConstCalc();
@@ -1658,69 +1656,29 @@ class ConstDefAST : public BaseAST {
                     dim_vec.push_back(dim);
                     arr_len *= dim;
                 }
-                arr_init = constinitval->getArrInit(dim_vec, str);
-                elem_num = arr_init->size();
-                for(int _ = elem_num; _ < arr_len; ++_) arr_init->push_back(0);
+                arr_init.reserve(arr_len);
+                constinitval->getArrInit(dim_vec, arr_init, str);
+                // Local const arrays are never written, so they become global data named like the local
                 if(field == symbol_field::Field_Local) {
                     (*(curr_symbol_table->symbol_table_ptr->symbol_table_elem_ptr))[ident] = 
                         symbol_t{(int)(dim_vec.size()), symbol_tag::Symbol_Arr};
-                    str += "\t@" + ident + "_" + std::to_string(curr_symbol_table->symbol_table_ptr->symbol_table_num) + " = alloc ";
-                    std::string dim_str;
-                    dim_str += ("[i32, " + std::to_string(dim_vec[0]) + "]");
-                    for(int i = 1; i < dim_vec.size(); ++i) 
-                        dim_str = "[" + dim_str + ", " + std::to_string(dim_vec[i]) + "]";
-                    str += dim_str + "\n";
-                    for(int i = 0; i < arr_len; ++i) {
-                        std::vector<int> arr_index;
-                        int index = i;
-                        int layer_size = arr_len / dim_vec[vec_size - 1];
-                        int k = 0;
-                        while(k < vec_size - 1) {
-                            arr_index.push_back(index / layer_size);
-                            index = index % layer_size;
-                            layer_size = layer_size / dim_vec[vec_size - 1 - (++k)];
-                        }
-                        arr_index.push_back(index);
-                        int arr_index_size = arr_index.size();
-                        str += "\t\%" + std::to_string(ast_i++) + " = getelemptr @" + ident + "_"
-                             + std::to_string(curr_symbol_table->symbol_table_ptr->symbol_table_num) + ", "
-                             + std::to_string(arr_index[0]) + "\n";
-                        for(int j = 1; j < arr_index_size; ++j) {
-                            str += "\t\%" + std::to_string(ast_i) + " = getelemptr \%" + std::to_string(ast_i - 1)
-                                 + ", " + std::to_string(arr_index[j]) + "\n";
-                            ast_i++;
-                        }
-                        str += "\tstore " + std::to_string((*arr_init)[i]) + ", \%" + std::to_string(ast_i - 1) + "\n";
-                    }
+                    global_str = "global @" + ident + "_"
+                               + std::to_string(curr_symbol_table->symbol_table_ptr->symbol_table_num) + " = alloc ";
                 }
                 else {
                     global_symbol_table[ident] = symbol_t{(int)dim_vec.size(), symbol_tag::Symbol_Arr};
-                    str += "global @" + ident + " = alloc ";
-                    std::string dim_str;
-                    dim_str += ("[i32, " + std::to_string(dim_vec[0]) + "]");
-                    for(int i = 1; i < dim_vec.size(); ++i) 
-                        dim_str = "[" + dim_str + ", " + std::to_string(dim_vec[i]) + "]";
-                    str += dim_str + ", ";
-                    std::vector<std::string> init_str_vec;
-                    std::vector<std::string> compress_init_str_vec;
-                    for(int i : (*arr_init)) init_str_vec.push_back(std::to_string(i));
-                    for(int i = 0; i < vec_size; ++i) {
-                        compress_init_str_vec.clear();
-                        int init_str_vec_size = init_str_vec.size();
-                        int index = 0;
-                        while(index < init_str_vec_size) {
-                            std::string init_str_set;
-                            init_str_set += "{" + init_str_vec[index];
-                            for(int j = 1; j < dim_vec[i]; ++j)
-                                init_str_set += ", " + init_str_vec[index + j];
-                            init_str_set += "}";
-                            index += dim_vec[i];
-                            compress_init_str_vec.push_back(init_str_set);
-                        }
-                        init_str_vec = compress_init_str_vec;
-                    }
-                    str += init_str_vec[0] + "\n";
+                    global_str = "global @" + ident + " = alloc ";
                 }
+                dim_str += ("[i32, " + std::to_string(dim_vec[0]) + "]");
+                for(int i = 1; i < dim_vec.size(); ++i) 
+                    dim_str = "[" + dim_str + ", " + std::to_string(dim_vec[i]) + "]";
+                global_str += dim_str + ", ";
+                dumpAggregate(arr_init, dim_vec, global_str);
+                global_str += "\n";
+                if(field == symbol_field::Field_Local)
+                    const_arr_str += global_str;
+                else
+                    str += global_str;
                 break;
             default:
                 assert(false);
@@ -1740,9 +1698,7 @@ class ConstDefAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -1781,8 +1737,9 @@ class ConstInitValAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
+        // Sub-initializers are appended to the same buffer, offsets are relative to `start`
+        int start = arr_init.size();
         int arr_size = 1;
         int elem_num = 0;
         for(int i : dim_vec) arr_size *= i;
@@ -1817,12 +1774,11 @@ class ConstInitValAST : public BaseAST {
                         std::cerr << "Error: Invalid Array.\n";
                         assert(false);
                     }
-                    std::unique_ptr<std::vector<int> > new_arr = constinitval->getArrInit(new_dim_vec, str);
-                    arr_ptr->insert(arr_ptr->end(), new_arr->begin(), new_arr->end());
-                    elem_num = arr_ptr->size();
+                    constinitval->getArrInit(new_dim_vec, arr_init, str);
+                    elem_num = arr_init.size() - start;
                 }
                 else if(constinitval->type == ConstInitValType::ConstInitVal_Exp) {
-                    arr_ptr->push_back(constinitval->ConstCalc());
+                    arr_init.push_back(constinitval->ConstCalc());
                     elem_num++;
                     continue;
                 }
@@ -1832,10 +1788,8 @@ class ConstInitValAST : public BaseAST {
             std::cerr << "Error: Invalid ConstInitVal.\n";
             assert(false);
         }
-        if(elem_num < arr_size) {
-            for(int _ = elem_num; _ < arr_size; ++_) arr_ptr->push_back(0);
-        }
-        return arr_ptr; 
+        if(elem_num < arr_size)
+            arr_init.resize(start + arr_size, 0);
     }
 };
 
@@ -1885,9 +1839,7 @@ class BlockItemAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -2068,9 +2020,7 @@ class LValAST : public BaseAST {
         return str;
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -2098,9 +2048,7 @@ class ConstExpAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -2132,9 +2080,7 @@ class VarDeclAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -2160,7 +2106,7 @@ class VarDefAST : public BaseAST {
 
     std::string DumpIR() const override {
         std::string str;
-        std::unique_ptr<std::vector<int> > arr_init;
+        std::vector<int> arr_init;
         if(type == VarDef_Int_Init || type == VarDef_Int_NO_Init) {
             if(field == symbol_field::Field_Local) {
                 str += "\t@" + ident + "_" + std::to_string(curr_symbol_table->symbol_table_ptr->symbol_table_num)
@@ -2193,14 +2139,8 @@ class VarDefAST : public BaseAST {
                 dim_vec.push_back(dim);
                 arr_len *= dim;
             }
-            arr_init = initval->getArrInit(dim_vec, str);
-            int elem_num = arr_init->size();
-            if(elem_num < arr_len) {
-                if(field == symbol_field::Field_Local)
-                    for(int _ = elem_num; _ < arr_len; ++_) arr_init->push_back(-1);
-                else
-                    for(int _ = elem_num; _ < arr_len; ++_) arr_init->push_back(0);
-            }
+            arr_init.reserve(arr_len);
+            initval->getArrInit(dim_vec, arr_init, str);
             if(field == symbol_field::Field_Local) {
                 (*(curr_symbol_table->symbol_table_ptr->symbol_table_elem_ptr))[ident] = 
                     symbol_t{(int)(dim_vec.size()), symbol_tag::Symbol_Arr};
@@ -2211,7 +2151,45 @@ class VarDefAST : public BaseAST {
                 for(int i = 1; i < dim_vec.size(); ++i) 
                     dim_str = "[" + dim_str + ", " + std::to_string(dim_vec[i]) + "]";
                 str += dim_str + "\n";
+                // Clear the whole array with a loop when most of it is padding, then store only the initializers
+                bool zero_fill = std::count(arr_init.begin(), arr_init.end(), -1) >= zero_fill_threshold;
+                if(zero_fill) {
+                    std::string fill_id = std::to_string(zero_fill_id++);
+                    std::string counter = "@zero_fill_" + fill_id;
+                    str += "\t\%" + std::to_string(ast_i++) + " = getelemptr @" + ident + "_"
+                         + std::to_string(curr_symbol_table->symbol_table_ptr->symbol_table_num) + ", 0\n";
+                    for(int j = 1; j < vec_size; ++j) {
+                        str += "\t\%" + std::to_string(ast_i) + " = getelemptr \%" + std::to_string(ast_i - 1) + ", 0\n";
+                        ast_i++;
+                    }
+                    int base_id = ast_i - 1;
+                    str += "\t" + counter + " = alloc i32\n";
+                    str += "\tstore 0, " + counter + "\n";
+                    str += "\tjump \%zero_fill_entry_" + fill_id + "\n";
+                    // %zero_fill_entry_<fill_id> Block
+                    str += "\%zero_fill_entry_" + fill_id + ":\n";
+                    str += "\t\%" + std::to_string(ast_i) + " = load " + counter + "\n";
+                    str += "\t\%" + std::to_string(ast_i + 1) + " = lt \%" + std::to_string(ast_i) + ", "
+                         + std::to_string(arr_len) + "\n";
+                    str += "\tbr \%" + std::to_string(ast_i + 1) + ", \%zero_fill_body_" + fill_id
+                         + ", \%zero_fill_end_" + fill_id + "\n";
+                    ast_i += 2;
+                    // %zero_fill_body_<fill_id> Block
+                    str += "\%zero_fill_body_" + fill_id + ":\n";
+                    str += "\t\%" + std::to_string(ast_i) + " = load " + counter + "\n";
+                    str += "\t\%" + std::to_string(ast_i + 1) + " = getptr \%" + std::to_string(base_id) + ", \%"
+                         + std::to_string(ast_i) + "\n";
+                    str += "\tstore 0, \%" + std::to_string(ast_i + 1) + "\n";
+                    str += "\t\%" + std::to_string(ast_i + 2) + " = add \%" + std::to_string(ast_i) + ", 1\n";
+                    str += "\tstore \%" + std::to_string(ast_i + 2) + ", " + counter + "\n";
+                    str += "\tjump \%zero_fill_entry_" + fill_id + "\n";
+                    ast_i += 3;
+                    // %zero_fill_end_<fill_id> Block
+                    str += "\%zero_fill_end_" + fill_id + ":\n";
+                }
                 for(int i = 0; i < arr_len; ++i) {
+                    if(zero_fill && arr_init[i] == -1)
+                        continue;
                     std::vector<int> arr_index;
                     int index = i;
                     int layer_size = arr_len / dim_vec[vec_size - 1];
@@ -2231,8 +2209,8 @@ class VarDefAST : public BaseAST {
                              + std::to_string(arr_index[j]) + "\n";
                         ast_i++;
                     }
-                    if((*arr_init)[i] != -1)
-                        str += "\tstore \%" + std::to_string((*arr_init)[i]) + ", \%" + std::to_string(ast_i - 1) + "\n";
+                    if(arr_init[i] != -1)
+                        str += "\tstore \%" + std::to_string(arr_init[i]) + ", \%" + std::to_string(ast_i - 1) + "\n";
                     else
                         str += "\tstore 0, \%" + std::to_string(ast_i - 1) + "\n";
                 }
@@ -2245,25 +2223,8 @@ class VarDefAST : public BaseAST {
                 for(int i = 1; i < dim_vec.size(); ++i) 
                     dim_str = "[" + dim_str + ", " + std::to_string(dim_vec[i]) + "]";
                 str += dim_str + ", ";
-                std::vector<std::string> init_str_vec;
-                std::vector<std::string> compress_init_str_vec;
-                for(int i : (*arr_init)) init_str_vec.push_back(std::to_string(i));
-                for(int i = 0; i < vec_size; ++i) {
-                    compress_init_str_vec.clear();
-                    int init_str_vec_size = init_str_vec.size();
-                    int index = 0;
-                    while(index < init_str_vec_size) {
-                        std::string init_str_set;
-                        init_str_set += "{" + init_str_vec[index];
-                        for(int j = 1; j < dim_vec[i]; ++j)
-                            init_str_set += ", " + init_str_vec[index + j];
-                        init_str_set += "}";
-                        index += dim_vec[i];
-                        compress_init_str_vec.push_back(init_str_set);
-                    }
-                    init_str_vec = compress_init_str_vec;
-                }
-                str += init_str_vec[0] + "\n";
+                dumpAggregate(arr_init, dim_vec, str);
+                str += "\n";
             }
         }
         else {
@@ -2309,9 +2270,7 @@ class VarDefAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
-        return arr_ptr; 
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
     }
 };
 
@@ -2351,8 +2310,9 @@ class InitValAST : public BaseAST {
         return std::string();
     }
 
-    std::unique_ptr<std::vector<int> > getArrInit(std::vector<int> dim_vec, std::string& str) const override {
-        std::unique_ptr<std::vector<int> > arr_ptr = std::make_unique<std::vector<int> >();
+    void getArrInit(const std::vector<int> &dim_vec, std::vector<int> &arr_init, std::string& str) const override {
+        // Sub-initializers are appended to the same buffer, offsets are relative to `start`
+        int start = arr_init.size();
         int arr_size = 1;
         int elem_num = 0;
         for(int i : dim_vec) arr_size *= i;
@@ -2387,17 +2347,16 @@ class InitValAST : public BaseAST {
                         std::cerr << "Error: Invalid Array.\n";
                         assert(false);
                     }
-                    std::unique_ptr<std::vector<int> > new_arr = initval->getArrInit(new_dim_vec, str);
-                    arr_ptr->insert(arr_ptr->end(), new_arr->begin(), new_arr->end());
-                    elem_num = arr_ptr->size();
+                    initval->getArrInit(new_dim_vec, arr_init, str);
+                    elem_num = arr_init.size() - start;
                 }
                 else if(initval->type == InitValType::InitVal_Exp) {
                     if(field == Field_Local) {
                         str += initval->DumpIR();
-                        arr_ptr->push_back(ast_i - 1);
+                        arr_init.push_back(ast_i - 1);
                     }
                     else {
-                        arr_ptr->push_back(initval->ConstCalc());
+                        arr_init.push_back(initval->ConstCalc());
                     }
                     elem_num++;
                     continue;
@@ -2408,12 +2367,7 @@ class InitValAST : public BaseAST {
             std::cerr << "Error: Invalid ConstInitVal.\n";
             assert(false);
         }
-        if(elem_num < arr_size) {
-            if(field == Field_Local)
-                for(int _ = elem_num; _ < arr_size; ++_) arr_ptr->push_back(-1);
-            else
-                for(int _ = elem_num; _ < arr_size; ++_) arr_ptr->push_back(0);
-        }
-        return arr_ptr; 
+        if(elem_num < arr_size)
+            arr_init.resize(start + arr_size, field == Field_Local ? -1 : 0);
     }
 };
\ No newline at end of file
@@ -0,0 +1,577 @@
+#include "mir.hpp"
+#include "opt.hpp"
+#include <elf.h>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+/** 目标文件中的符号, section 为所在节头的下标, 未定义时为 SHN_UNDEF; 跳转表为局部符号 */
+struct osym_t {
+  std::string name;
+  int section;
+  uint32_t value;
+  uint32_t size;
+  int type;
+  bool local;
+};
+
+/** 重定位项, 跳转表项的 addend 为标号在函数中的偏移 */
+struct oreloc_t {
+  uint32_t offset;
+  int sym;
+  int type;
+  int addend;
+};
+
+/** 节头表中各节的下标, 顺序与 write_obj 输出的节头一致 */
+enum {
+  SH_NULL, SH_TEXT, SH_RELA_TEXT, SH_DATA, SH_BSS, SH_RODATA, SH_RELA_RODATA, SH_SYMTAB, SH_STRTAB, SH_SHSTRTAB, SH_NUM
+};
+
+/** 各节的内容, .bss 只记录大小 */
+static std::vector<uint8_t> sec_bytes[SEC_NUM];
+static uint32_t bss_size = 0;
+static std::vector<osym_t> obj_syms;
+static std::unordered_map<std::string, int> obj_sym_id;
+static std::vector<oreloc_t> text_relocs, rodata_relocs;
+
+static const int sec_index[SEC_NUM] = {SH_TEXT, SH_DATA, SH_BSS, SH_RODATA};
+
+// 取得符号在符号表中的下标, 第一次出现时作为未定义符号加入
+static int obj_symbol(const std::string &name) {
+  auto it = obj_sym_id.find(name);
+  if(it != obj_sym_id.end())
+    return it->second;
+  obj_syms.push_back({name, SHN_UNDEF, 0, 0, STT_NOTYPE, false});
+  return obj_sym_id[name] = obj_syms.size() - 1;
+}
+
+static void define_symbol(const std::string &name, msec_t sec, uint32_t value, uint32_t size, int type) {
+  osym_t &sym = obj_syms[obj_symbol(name)];
+  sym.section = sec_index[sec];
+  sym.value = value;
+  sym.size = size;
+  sym.type = type;
+}
+
+static void put_word(std::vector<uint8_t> &bytes, uint32_t word) {
+  for(int k = 0; k < 4; ++k)
+    bytes.push_back(word >> (8 * k) & 0xff);
+}
+
+static void put_half(std::vector<uint8_t> &bytes, uint16_t half) {
+  bytes.push_back(half & 0xff);
+  bytes.push_back(half >> 8);
+}
+
+static void align_to(std::vector<uint8_t> &bytes, size_t align) {
+  while(bytes.size() % align)
+    bytes.push_back(0);
+}
+
+// 各类指令格式的编码
+static uint32_t r_type(int funct7, reg_t rs2, reg_t rs1, int funct3, reg_t rd, int opcode) {
+  return funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+
+static uint32_t i_type(int imm, reg_t rs1, int funct3, reg_t rd, int opcode) {
+  assert(imm >= -2048 && imm <= 2047);
+  return (uint32_t)(imm & 0xfff) << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+
+static uint32_t s_type(int imm, reg_t rs2, reg_t rs1, int funct3, int opcode) {
+  assert(imm >= -2048 && imm <= 2047);
+  return (uint32_t)(imm >> 5 & 0x7f) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | (imm & 0x1f) << 7 | opcode;
+}
+
+static uint32_t b_type(int off, reg_t rs2, reg_t rs1, int funct3) {
+  assert(off >= -4096 && off <= 4094 && off % 2 == 0);
+  return (uint32_t)(off >> 12 & 1) << 31 | (off >> 5 & 0x3f) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 |
+         (off >> 1 & 0xf) << 8 | (off >> 11 & 1) << 7 | 0x63;
+}
+
+static uint32_t j_type(int off, reg_t rd) {
+  assert(off >= -(1 << 20) && off < (1 << 20) && off % 2 == 0);
+  return (uint32_t)(off >> 20 & 1) << 31 | (off >> 1 & 0x3ff) << 21 | (off >> 11 & 1) << 20 |
+         (off >> 12 & 0xff) << 12 | rd << 7 | 0x6f;
+}
+
+static uint32_t u_type(uint32_t imm20, reg_t rd, int opcode) {
+  return (imm20 & 0xfffff) << 12 | rd << 7 | opcode;
+}
+
+// C 扩展指令中 x8 - x15 的 3 位编码
+static uint16_t creg(reg_t reg) {
+  assert(is_creg(reg));
+  return reg - REG_S0;
+}
+
+static uint16_t bit(int value, int from, int to) {
+  return (value >> from & 1) << to;
+}
+
+// 非跳转指令的 16 位编码, cop 由 compress 选出
+static uint16_t c_encode(const minst_t &inst, cop_t cop) {
+  int imm = inst.imm;
+  switch(cop) {
+    case COP_LI:
+      return 0x4001 | bit(imm, 5, 12) | inst.rd << 7 | (imm & 0x1f) << 2;
+    case COP_MV:
+      return 0x8002 | inst.rd << 7 | inst.rs1 << 2;
+    case COP_LW:
+      return 0x4000 | (imm >> 3 & 7) << 10 | creg(inst.rs1) << 7 | bit(imm, 2, 6) | bit(imm, 6, 5) | creg(inst.rd) << 2;
+    case COP_SW:
+      return 0xc000 | (imm >> 3 & 7) << 10 | creg(inst.rs1) << 7 | bit(imm, 2, 6) | bit(imm, 6, 5) | creg(inst.rs2) << 2;
+    case COP_LWSP:
+      return 0x4002 | bit(imm, 5, 12) | inst.rd << 7 | (imm >> 2 & 7) << 4 | (imm >> 6 & 3) << 2;
+    case COP_SWSP:
+      return 0xc002 | (imm >> 2 & 0xf) << 9 | (imm >> 6 & 3) << 7 | inst.rs2 << 2;
+    case COP_ADD:
+      return 0x9002 | inst.rd << 7 | (inst.rd == inst.rs1 ? inst.rs2 : inst.rs1) << 2;
+    case COP_SUB:
+    case COP_XOR:
+    case COP_OR:
+    case COP_AND: {
+      int funct2 = cop == COP_SUB ? 0 : cop == COP_XOR ? 1 : cop == COP_OR ? 2 : 3;
+      return 0x8c01 | creg(inst.rd) << 7 | funct2 << 5 | creg(inst.rd == inst.rs1 ? inst.rs2 : inst.rs1) << 2;
+    }
+    case COP_ADDI:
+      return 0x0001 | bit(imm, 5, 12) | inst.rd << 7 | (imm & 0x1f) << 2;
+    case COP_ADDI16SP:
+      return 0x6101 | bit(imm, 9, 12) | bit(imm, 4, 6) | bit(imm, 6, 5) | (imm >> 7 & 3) << 3 | bit(imm, 5, 2);
+    case COP_ADDI4SPN:
+      return (imm >> 4 & 3) << 11 | (imm >> 6 & 0xf) << 7 | bit(imm, 2, 6) | bit(imm, 3, 5) | creg(inst.rd) << 2;
+    case COP_ANDI:
+      return 0x8801 | bit(imm, 5, 12) | creg(inst.rd) << 7 | (imm & 0x1f) << 2;
+    case COP_SLLI:
+      return 0x0002 | inst.rd << 7 | (imm & 0x1f) << 2;
+    case COP_JR:
+      return 0x8002 | (inst.op == MOP_RET ? REG_RA : inst.rs1) << 7;
+    default:
+      assert(false);
+      return 0;
+  }
+}
+
+static uint16_t cb_type(int off, reg_t rs1, bool bnez) {
+  assert(off >= -256 && off <= 254 && off % 2 == 0);
+  return (bnez ? 0xe001 : 0xc001) | bit(off, 8, 12) | (off >> 3 & 3) << 10 | creg(rs1) << 7 | (off >> 6 & 3) << 5 |
+         (off >> 1 & 3) << 3 | bit(off, 5, 2);
+}
+
+static uint16_t cj_type(int off) {
+  assert(off >= -2048 && off <= 2046 && off % 2 == 0);
+  return 0xa001 | bit(off, 11, 12) | bit(off, 4, 11) | (off >> 8 & 3) << 9 | bit(off, 10, 8) | bit(off, 6, 7) |
+         bit(off, 7, 6) | (off >> 1 & 7) << 3 | bit(off, 5, 2);
+}
+
+static bool fits_imm(int imm) {
+  return imm >= -2048 && imm <= 2047;
+}
+
+/** 跳转的编码形式, 超出范围时逐级加长 */
+enum jump_form_t {
+  /** C 扩展的 c.beqz / c.bnez / c.j */
+  JUMP_SHORT,
+  JUMP_NORMAL,
+  /** 反向条件跳转越过一条 jal */
+  JUMP_FAR
+};
+
+// li 分为 lui 装入的高 20 位与 addi 加上的低 12 位
+static void split_imm(int imm, uint32_t &hi, int &lo) {
+  hi = ((uint32_t)imm + 0x800) >> 12;
+  lo = (int)((uint32_t)imm - (hi << 12));
+}
+
+// lui 能否使用 c.lui: 目标不为 zero 与 sp, 高 20 位作为有符号数非零且在 6 位范围内
+static bool c_lui(reg_t rd, uint32_t hi) {
+  int value = (int)(hi << 12) >> 12;
+  return opt_options.rvc && rd != REG_ZERO && rd != REG_SP && value != 0 && value >= -32 && value <= 31;
+}
+
+static uint32_t addi_size(reg_t rd, int lo) {
+  return opt_options.rvc && compress({MOP_ADDI, rd, rd, REG_NONE, lo, 0}) != COP_NONE ? 2 : 4;
+}
+
+// 指令编码后的字节数, form 为跳转的编码形式
+static uint32_t inst_size(const minst_t &inst, jump_form_t form) {
+  switch(inst.op) {
+    case MOP_NOP:
+      return 0;
+    case MOP_LI: {
+      if(fits_imm(inst.imm))
+        break;
+      uint32_t hi;
+      int lo;
+      split_imm(inst.imm, hi, lo);
+      return (c_lui(inst.rd, hi) ? 2 : 4) + (lo == 0 ? 0 : addi_size(inst.rd, lo));
+    }
+    case MOP_LA:
+    case MOP_CALL:
+    case MOP_TAIL:
+      return 8;
+    case MOP_BEQZ:
+    case MOP_BNEZ:
+    case MOP_J:
+      return form == JUMP_SHORT ? 2 : form == JUMP_NORMAL ? 4 : 8;
+    default:
+      break;
+  }
+  return opt_options.rvc && compress(inst) != COP_NONE ? 2 : 4;
+}
+
+// 跳转在 form 形式下能否到达偏移 off
+static bool in_range(const minst_t &inst, jump_form_t form, int off) {
+  if(form == JUMP_FAR)
+    return true;
+  if(inst.op == MOP_J)
+    return form == JUMP_SHORT ? off >= -2048 && off <= 2046 : true;
+  return form == JUMP_SHORT ? off >= -256 && off <= 254 : off >= -4096 && off <= 4094;
+}
+
+// 将函数的机器代码编码到 .text, 调用与取地址留下重定位, 函数内的跳转直接求出偏移
+void obj_func(const mfunc_t &func) {
+  std::vector<uint8_t> &text = sec_bytes[SEC_TEXT];
+  uint32_t base = text.size();
+  size_t n = func.insts.size();
+  std::vector<size_t> label_inst(func.syms.size(), n);
+  for(const mblock_t &block : func.blocks)
+    label_inst[block.label] = block.begin;
+
+  // 跳转先取最短的形式, 超出范围时加长; 加长后其他跳转可能也超出范围, 反复计算直到不变
+  std::vector<jump_form_t> form(n, JUMP_NORMAL);
+  for(size_t i = 0; i < n; ++i) {
+    const minst_t &inst = func.insts[i];
+    if(opt_options.rvc && (inst.op == MOP_J || (is_branch(inst.op) && is_creg(inst.rs1))))
+      form[i] = JUMP_SHORT;
+  }
+  std::vector<uint32_t> pos(n + 1, 0);
+  bool changed = true;
+  while(changed) {
+    changed = false;
+    for(size_t i = 0; i < n; ++i)
+      pos[i + 1] = pos[i] + inst_size(func.insts[i], form[i]);
+    for(size_t i = 0; i < n; ++i) {
+      const minst_t &inst = func.insts[i];
+      if(inst.op != MOP_J && !is_branch(inst.op))
+        continue;
+      int off = (int)pos[label_inst[inst.sym]] - (int)pos[i];
+      if(!in_range(inst, form[i], off)) {
+        form[i] = jump_form_t(form[i] + 1);
+        changed = true;
+      }
+    }
+  }
+
+  auto emit = [&](uint32_t word) { put_word(text, word); };
+  auto emit_addi = [&](reg_t rd, reg_t rs1, int imm) {
+    minst_t addi = {MOP_ADDI, rd, rs1, REG_NONE, imm, 0};
+    cop_t cop = opt_options.rvc ? compress(addi) : COP_NONE;
+    if(cop != COP_NONE)
+      put_half(text, c_encode(addi, cop));
+    else
+      emit(i_type(imm, rs1, 0, rd, 0x13));
+  };
+  auto reloc = [&](int type, int sym) {
+    text_relocs.push_back({(uint32_t)text.size(), obj_symbol(func.syms[sym]), type, 0});
+  };
+  for(size_t i = 0; i < n; ++i) {
+    const minst_t &inst = func.insts[i];
+    int target = inst.op == MOP_J || is_branch(inst.op) ? (int)pos[label_inst[inst.sym]] - (int)pos[i] : 0;
+    cop_t cop = opt_options.rvc ? compress(inst) : COP_NONE;
+    if(cop != COP_NONE) {
+      put_half(text, c_encode(inst, cop));
+      continue;
+    }
+    switch(inst.op) {
+      case MOP_NOP:
+        break;
+      case MOP_LI: {
+        // 高 20 位用 lui 装入, 低 12 位按有符号数加上
+        if(fits_imm(inst.imm)) {
+          emit(i_type(inst.imm, REG_ZERO, 0, inst.rd, 0x13));
+          break;
+        }
+        uint32_t hi;
+        int lo;
+        split_imm(inst.imm, hi, lo);
+        if(c_lui(inst.rd, hi))
+          put_half(text, 0x6001 | bit(hi, 5, 12) | inst.rd << 7 | (hi & 0x1f) << 2);
+        else
+          emit(u_type(hi, inst.rd, 0x37));
+        if(lo != 0)
+          emit_addi(inst.rd, inst.rd, lo);
+        break;
+      }
+      case MOP_LA:
+        reloc(R_RISCV_HI20, inst.sym);
+        emit(u_type(0, inst.rd, 0x37));
+        reloc(R_RISCV_LO12_I, inst.sym);
+        emit(i_type(0, inst.rd, 0, inst.rd, 0x13));
+        break;
+      case MOP_MV:
+        emit(i_type(0, inst.rs1, 0, inst.rd, 0x13));
+        break;
+      case MOP_LW:
+        emit(i_type(inst.imm, inst.rs1, 2, inst.rd, 0x03));
+        break;
+      case MOP_SW:
+        emit(s_type(inst.imm, inst.rs2, inst.rs1, 2, 0x23));
+        break;
+      case MOP_ADD:
+        emit(r_type(0x00, inst.rs2, inst.rs1, 0, inst.rd, 0x33));
+        break;
+      case MOP_SUB:
+        emit(r_type(0x20, inst.rs2, inst.rs1, 0, inst.rd, 0x33));
+        break;
+      case MOP_MUL:
+        emit(r_type(0x01, inst.rs2, inst.rs1, 0, inst.rd, 0x33));
+        break;
+      case MOP_DIV:
+        emit(r_type(0x01, inst.rs2, inst.rs1, 4, inst.rd, 0x33));
+        break;
+      case MOP_REM:
+        emit(r_type(0x01, inst.rs2, inst.rs1, 6, inst.rd, 0x33));
+        break;
+      case MOP_AND:
+        emit(r_type(0x00, inst.rs2, inst.rs1, 7, inst.rd, 0x33));
+        break;
+      case MOP_OR:
+        emit(r_type(0x00, inst.rs2, inst.rs1, 6, inst.rd, 0x33));
+        break;
+      case MOP_XOR:
+        emit(r_type(0x00, inst.rs2, inst.rs1, 4, inst.rd, 0x33));
+        break;
+      case MOP_SLT:
+        emit(r_type(0x00, inst.rs2, inst.rs1, 2, inst.rd, 0x33));
+        break;
+      // sgt 为交换操作数的 slt, seqz 与 snez 为与 0 的无符号比较
+      case MOP_SGT:
+        emit(r_type(0x00, inst.rs1, inst.rs2, 2, inst.rd, 0x33));
+        break;
+      case MOP_SH1ADD:
+        emit(r_type(0x10, inst.rs2, inst.rs1, 2, inst.rd, 0x33));
+        break;
+      case MOP_SH2ADD:
+        emit(r_type(0x10, inst.rs2, inst.rs1, 4, inst.rd, 0x33));
+        break;
+      case MOP_SH3ADD:
+        emit(r_type(0x10, inst.rs2, inst.rs1, 6, inst.rd, 0x33));
+        break;
+      case MOP_MIN:
+        emit(r_type(0x05, inst.rs2, inst.rs1, 4, inst.rd, 0x33));
+        break;
+      case MOP_MAX:
+        emit(r_type(0x05, inst.rs2, inst.rs1, 6, inst.rd, 0x33));
+        break;
+      case MOP_CZERO_EQZ:
+        emit(r_type(0x07, inst.rs2, inst.rs1, 5, inst.rd, 0x33));
+        break;
+      case MOP_CZERO_NEZ:
+        emit(r_type(0x07, inst.rs2, inst.rs1, 7, inst.rd, 0x33));
+        break;
+      case MOP_SEQZ:
+        emit(i_type(1, inst.rs1, 3, inst.rd, 0x13));
+        break;
+      case MOP_SNEZ:
+        emit(r_type(0x00, inst.rs1, REG_ZERO, 3, inst.rd, 0x33));
+        break;
+      case MOP_ADDI:
+        emit(i_type(inst.imm, inst.rs1, 0, inst.rd, 0x13));
+        break;
+      case MOP_ANDI:
+        emit(i_type(inst.imm, inst.rs1, 7, inst.rd, 0x13));
+        break;
+      case MOP_ORI:
+        emit(i_type(inst.imm, inst.rs1, 6, inst.rd, 0x13));
+        break;
+      case MOP_XORI:
+        emit(i_type(inst.imm, inst.rs1, 4, inst.rd, 0x13));
+        break;
+      case MOP_SLTI:
+        emit(i_type(inst.imm, inst.rs1, 2, inst.rd, 0x13));
+        break;
+      case MOP_SLTIU:
+        emit(i_type(inst.imm, inst.rs1, 3, inst.rd, 0x13));
+        break;
+      case MOP_SLLI:
+        emit(i_type(inst.imm & 0x1f, inst.rs1, 1, inst.rd, 0x13));
+        break;
+      case MOP_BEQZ:
+      case MOP_BNEZ: {
+        int funct3 = inst.op == MOP_BEQZ ? 0 : 1;
+        if(form[i] == JUMP_SHORT)
+          put_half(text, cb_type(target, inst.rs1, inst.op == MOP_BNEZ));
+        else if(form[i] == JUMP_FAR) {
+          emit(b_type(8, REG_ZERO, inst.rs1, funct3 ^ 1));
+          emit(j_type(target - 4, REG_ZERO));
+        }
+        else
+          emit(b_type(target, REG_ZERO, inst.rs1, funct3));
+        break;
+      }
+      case MOP_J:
+        if(form[i] == JUMP_SHORT)
+          put_half(text, cj_type(target));
+        else
+          emit(j_type(target, REG_ZERO));
+        break;
+      // call 与 tail 为 auipc + jalr, 由链接器填入偏移
+      case MOP_CALL:
+        reloc(R_RISCV_CALL_PLT, inst.sym);
+        emit(u_type(0, REG_RA, 0x17));
+        emit(i_type(0, REG_RA, 0, REG_RA, 0x67));
+        break;
+      case MOP_TAIL:
+        reloc(R_RISCV_CALL_PLT, inst.sym);
+        emit(u_type(0, REG_T1, 0x17));
+        emit(i_type(0, REG_T1, 0, REG_ZERO, 0x67));
+        break;
+      case MOP_RET:
+        emit(i_type(0, REG_RA, 0, REG_ZERO, 0x67));
+        break;
+      case MOP_JR:
+        emit(i_type(0, inst.rs1, 0, REG_ZERO, 0x67));
+        break;
+    }
+  }
+  assert(text.size() - base == pos[n]);
+  define_symbol(func.name, SEC_TEXT, base, pos[n], STT_FUNC);
+
+  // 跳转表放入 .rodata, 表项由链接器填入函数地址加标号的偏移
+  std::vector<uint8_t> &rodata = sec_bytes[SEC_RODATA];
+  for(const mtable_t &table : func.tables) {
+    align_to(rodata, 4);
+    define_symbol(func.syms[table.sym], SEC_RODATA, rodata.size(), table.labels.size() * 4, STT_OBJECT);
+    obj_syms[obj_symbol(func.syms[table.sym])].local = true;
+    for(int label : table.labels) {
+      rodata_relocs.push_back({(uint32_t)rodata.size(), obj_symbol(func.name), R_RISCV_32, (int)pos[label_inst[label]]});
+      put_word(rodata, 0);
+    }
+  }
+}
+
+// 在节 sec 中定义全局变量 name, 初始值为 words, 其后直到 size 字节补 0
+void obj_data(msec_t sec, const std::string &name, const std::vector<int> &words, size_t size) {
+  if(sec == SEC_BSS) {
+    bss_size = (bss_size + 3) / 4 * 4;
+    define_symbol(name, sec, bss_size, size, STT_OBJECT);
+    bss_size += size;
+    return;
+  }
+  std::vector<uint8_t> &bytes = sec_bytes[sec];
+  align_to(bytes, 4);
+  define_symbol(name, sec, bytes.size(), size, STT_OBJECT);
+  for(int word : words)
+    put_word(bytes, word);
+  bytes.resize(bytes.size() + size - words.size() * 4, 0);
+}
+
+// 输出 RV32 的 ELF 可重定位目标文件: 各节内容依次排在文件头之后, 节头表在最后
+void write_obj(std::ostream &os) {
+  std::string strtab(1, '\0'), shstrtab(1, '\0');
+  auto add_str = [](std::string &table, const std::string &str) {
+    size_t offset = table.size();
+    table += str;
+    table += '\0';
+    return (Elf32_Word)offset;
+  };
+
+  // 符号表第 0 项为空, 局部符号须排在全局符号之前, sym_index 为各符号在符号表中的下标
+  std::vector<uint8_t> symtab(sizeof(Elf32_Sym), 0), rela, rela_rodata;
+  std::vector<Elf32_Word> sym_index(obj_syms.size());
+  Elf32_Word locals = 1;
+  for(bool local : {true, false})
+    for(size_t k = 0; k < obj_syms.size(); ++k) {
+      const osym_t &sym = obj_syms[k];
+      if(sym.local != local)
+        continue;
+      Elf32_Sym entry = {};
+      entry.st_name = add_str(strtab, sym.name);
+      entry.st_value = sym.value;
+      entry.st_size = sym.size;
+      entry.st_info = ELF32_ST_INFO(local ? STB_LOCAL : STB_GLOBAL, sym.type);
+      entry.st_shndx = sym.section;
+      sym_index[k] = symtab.size() / sizeof(Elf32_Sym);
+      locals += local;
+      const uint8_t *p = reinterpret_cast<const uint8_t *>(&entry);
+      symtab.insert(symtab.end(), p, p + sizeof(entry));
+    }
+  auto put_relocs = [&](std::vector<uint8_t> &bytes, const std::vector<oreloc_t> &relocs) {
+    for(const oreloc_t &reloc : relocs) {
+      Elf32_Rela entry = {reloc.offset, ELF32_R_INFO(sym_index[reloc.sym], reloc.type), reloc.addend};
+      const uint8_t *p = reinterpret_cast<const uint8_t *>(&entry);
+      bytes.insert(bytes.end(), p, p + sizeof(entry));
+    }
+  };
+  put_relocs(rela, text_relocs);
+  put_relocs(rela_rodata, rodata_relocs);
+
+  std::vector<Elf32_Shdr> shdrs(SH_NUM);
+  std::vector<const std::vector<uint8_t> *> contents(SH_NUM, nullptr);
+  std::vector<uint8_t> strtab_bytes(strtab.begin(), strtab.end()), shstrtab_bytes;
+  auto section = [&](int index, const char *name, Elf32_Word type, Elf32_Word flags, const std::vector<uint8_t> *bytes) {
+    Elf32_Shdr &shdr = shdrs[index];
+    shdr.sh_name = add_str(shstrtab, name);
+    shdr.sh_type = type;
+    shdr.sh_flags = flags;
+    shdr.sh_addralign = 4;
+    contents[index] = bytes;
+  };
+  section(SH_TEXT, ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, &sec_bytes[SEC_TEXT]);
+  if(opt_options.rvc)
+    shdrs[SH_TEXT].sh_addralign = 2;
+  section(SH_RELA_TEXT, ".rela.text", SHT_RELA, SHF_INFO_LINK, &rela);
+  section(SH_DATA, ".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, &sec_bytes[SEC_DATA]);
+  section(SH_BSS, ".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE, nullptr);
+  section(SH_RODATA, ".rodata", SHT_PROGBITS, SHF_ALLOC, &sec_bytes[SEC_RODATA]);
+  section(SH_RELA_RODATA, ".rela.rodata", SHT_RELA, SHF_INFO_LINK, &rela_rodata);
+  section(SH_SYMTAB, ".symtab", SHT_SYMTAB, 0, &symtab);
+  section(SH_STRTAB, ".strtab", SHT_STRTAB, 0, &strtab_bytes);
+  section(SH_SHSTRTAB, ".shstrtab", SHT_STRTAB, 0, &shstrtab_bytes);
+  shstrtab_bytes.assign(shstrtab.begin(), shstrtab.end());
+  for(int index : {SH_RELA_TEXT, SH_RELA_RODATA}) {
+    shdrs[index].sh_link = SH_SYMTAB;
+    shdrs[index].sh_info = index - 1;
+    shdrs[index].sh_entsize = sizeof(Elf32_Rela);
+  }
+  shdrs[SH_SYMTAB].sh_link = SH_STRTAB;
+  shdrs[SH_SYMTAB].sh_info = locals;
+  shdrs[SH_SYMTAB].sh_entsize = sizeof(Elf32_Sym);
+  shdrs[SH_BSS].sh_size = bss_size;
+  for(int index : {SH_STRTAB, SH_SHSTRTAB})
+    shdrs[index].sh_addralign = 1;
+
+  std::vector<uint8_t> file(sizeof(Elf32_Ehdr), 0);
+  for(int index = 1; index < SH_NUM; ++index) {
+    if(!contents[index])
+      continue;
+    align_to(file, shdrs[index].sh_addralign);
+    shdrs[index].sh_offset = file.size();
+    shdrs[index].sh_size = contents[index]->size();
+    file.insert(file.end(), contents[index]->begin(), contents[index]->end());
+  }
+  shdrs[SH_BSS].sh_offset = shdrs[SH_RODATA].sh_offset;
+  align_to(file, 4);
+
+  Elf32_Ehdr ehdr = {};
+  memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+  ehdr.e_ident[EI_CLASS] = ELFCLASS32;
+  ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr.e_type = ET_REL;
+  ehdr.e_machine = EM_RISCV;
+  ehdr.e_version = EV_CURRENT;
+  ehdr.e_flags = opt_options.rvc ? EF_RISCV_RVC : 0;
+  ehdr.e_shoff = file.size();
+  ehdr.e_ehsize = sizeof(Elf32_Ehdr);
+  ehdr.e_shentsize = sizeof(Elf32_Shdr);
+  ehdr.e_shnum = SH_NUM;
+  ehdr.e_shstrndx = SH_SHSTRTAB;
+  memcpy(file.data(), &ehdr, sizeof(ehdr));
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(shdrs.data());
+  file.insert(file.end(), p, p + shdrs.size() * sizeof(Elf32_Shdr));
+  os.write(reinterpret_cast<const char *>(file.data()), file.size());
+}
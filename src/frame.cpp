@@ -0,0 +1,439 @@
+#include "koopa.h"
+#include "raw.hpp"
+#include "opt.hpp"
+#include <cassert>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+/** 可分配的调用者保存寄存器, 只用于不跨越调用的值 */
+static const std::vector<reg_t> caller_saved = {REG_T3, REG_T4, REG_T5, REG_T6};
+/** 可分配的被调用者保存寄存器, 使用前需在栈帧中保存原值 */
+static const std::vector<reg_t> callee_saved = {REG_S1, REG_S2, REG_S3, REG_S4, REG_S5, REG_S6, REG_S7, REG_S8, REG_S9, REG_S10, REG_S11};
+
+// 值是否需要自己的存储位置 (寄存器或栈): 标量局部变量, 以及除读取局部变量外有结果的指令
+static bool has_slot(koopa_raw_value_t value) {
+  switch(value->kind.tag) {
+    case KOOPA_RVT_ALLOC:
+      return value->ty->data.pointer.base->tag != KOOPA_RTT_ARRAY;
+    case KOOPA_RVT_LOAD:
+      return value->kind.data.load.src->kind.tag != KOOPA_RVT_ALLOC;
+    case KOOPA_RVT_BINARY:
+    case KOOPA_RVT_GET_ELEM_PTR:
+    case KOOPA_RVT_GET_PTR:
+      return true;
+    case KOOPA_RVT_CALL:
+      return value->ty->tag != KOOPA_RTT_UNIT;
+    default:
+      return false;
+  }
+}
+
+// 值实际所在存储位置的所有者: 读取局部变量的结果在使用时才从变量中读出
+static koopa_raw_value_t slot_owner(koopa_raw_value_t value) {
+  if(value->kind.tag == KOOPA_RVT_LOAD && value->kind.data.load.src->kind.tag == KOOPA_RVT_ALLOC)
+    return value->kind.data.load.src;
+  return has_slot(value) ? value : nullptr;
+}
+
+// 求指令写入与读取的存储位置所有者, 写入局部变量视为对该变量的定义
+static koopa_raw_value_t get_def_use(koopa_raw_value_t inst, std::vector<koopa_raw_value_t> &uses) {
+  koopa_raw_value_t def = nullptr;
+  if(inst->kind.tag == KOOPA_RVT_STORE && inst->kind.data.store.dest->kind.tag == KOOPA_RVT_ALLOC)
+    def = inst->kind.data.store.dest;
+  else if(inst->kind.tag != KOOPA_RVT_ALLOC && has_slot(inst))
+    def = inst;
+  uses.clear();
+  for(koopa_raw_value_t *operand : get_operands(inst)) {
+    if(inst->kind.tag == KOOPA_RVT_STORE && *operand == inst->kind.data.store.dest && def != nullptr)
+      continue;
+    if(inst->kind.tag == KOOPA_RVT_LOAD && (*operand)->kind.tag == KOOPA_RVT_ALLOC)
+      continue;
+    koopa_raw_value_t owner = slot_owner(*operand);
+    if(owner != nullptr)
+      uses.push_back(owner);
+  }
+  return def;
+}
+
+// 可遍历的稀疏集合, 用于扫描基本块时维护活跃值
+struct live_set_t {
+  std::vector<int> dense;
+  std::vector<int> pos;
+
+  explicit live_set_t(size_t n) : pos(n, -1) {}
+  void insert(int x) {
+    if(pos[x] != -1)
+      return;
+    pos[x] = dense.size();
+    dense.push_back(x);
+  }
+  void erase(int x) {
+    if(pos[x] == -1)
+      return;
+    int last = dense.back();
+    dense[pos[x]] = last;
+    pos[last] = pos[x];
+    dense.pop_back();
+    pos[x] = -1;
+  }
+};
+
+// 求有序集合 a = use ∪ (b - def), 返回是否发生变化
+static bool update_live_in(std::vector<int> &a, const std::vector<int> &use, const std::vector<int> &b,
+                           const std::vector<int> &def) {
+  std::vector<int> rest, result;
+  std::set_difference(b.begin(), b.end(), def.begin(), def.end(), std::back_inserter(rest));
+  std::set_union(use.begin(), use.end(), rest.begin(), rest.end(), std::back_inserter(result));
+  if(result == a)
+    return false;
+  a.swap(result);
+  return true;
+}
+
+// 指令访问的栈帧位置, 包括栈上的值与局部数组元素的地址
+static void frame_accesses(koopa_raw_value_t inst, std::vector<int> &offsets) {
+  std::vector<koopa_raw_value_t> uses;
+  koopa_raw_value_t def = get_def_use(inst, uses);
+  if(def != nullptr)
+    uses.push_back(def);
+  offsets.clear();
+  for(koopa_raw_value_t u : uses)
+    if(stack_offset.count(u))
+      offsets.push_back(stack_offset[u]);
+  koopa_raw_value_t src = nullptr, index = nullptr;
+  size_t elem = 0;
+  if(inst->kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
+    src = inst->kind.data.get_elem_ptr.src;
+    index = inst->kind.data.get_elem_ptr.index;
+    elem = calc_size(src->ty->data.pointer.base->data.array.base);
+  }
+  else if(inst->kind.tag == KOOPA_RVT_GET_PTR) {
+    src = inst->kind.data.get_ptr.src;
+    index = inst->kind.data.get_ptr.index;
+    elem = calc_size(src->ty->data.pointer.base);
+  }
+  if(src == nullptr || src->kind.tag != KOOPA_RVT_ALLOC)
+    return;
+  int offset = stack_offset[src];
+  if(index->kind.tag == KOOPA_RVT_INTEGER)
+    offset += index->kind.data.integer.value * (int)elem;
+  offsets.push_back(offset);
+}
+
+// 基本块中指令的权重, 循环每深一层乘以 10
+static long long block_weight(const cfg_t &cfg, int b) {
+  long long weight = 1;
+  for(int d = 0; d < cfg.loop_depth[b] && d < 6; ++d)
+    weight *= 10;
+  return weight;
+}
+
+// 选择 s0 相对 sp 的偏移, 使超出 sp 立即数范围的栈帧访问中, 按循环深度加权后
+// 能以 s0 为基址用单条指令完成的最多; 无需 s0 时返回 -1
+static int choose_frame_base(const cfg_t &cfg) {
+  std::vector<std::pair<int, long long> > far;
+  std::vector<int> offsets;
+  for(size_t i = 0; i < cfg.bbs.size(); ++i) {
+    long long weight = block_weight(cfg, i);
+    for(koopa_raw_value_t inst : get_insts(cfg.bbs[i])) {
+      frame_accesses(inst, offsets);
+      for(int offset : offsets)
+        if(offset > 2047)
+          far.push_back({offset, weight});
+    }
+  }
+  if(far.empty())
+    return -1;
+  // 窗口 [base - 2048, base + 2047] 以某次访问为下界时最优
+  std::sort(far.begin(), far.end());
+  long long best = -1, sum = 0;
+  int base = -1;
+  size_t j = 0;
+  for(size_t i = 0; i < far.size(); ++i) {
+    while(j < far.size() && far[j].first <= far[i].first + 4095)
+      sum += far[j++].second;
+    if(sum > best) {
+      best = sum;
+      base = far[i].first + 2048;
+    }
+    sum -= far[i].second;
+  }
+  return base;
+}
+
+// 局部变量为参数变量时返回对应的参数下标, 否则返回 -1
+int param_index(const frame_t &frame, koopa_raw_value_t var) {
+  for(auto &param : frame.params)
+    if(param.first == var)
+      return param.second;
+  return -1;
+}
+
+// 选择建立栈帧的基本块: 所有访问栈帧, 写入被调用者保存寄存器或调用其他函数的基本块的最近公共支配者
+// 它不在循环中, 且从它可达的出口 (ret 或尾调用) 都被它支配时, 不经过它的路径无需栈帧
+static int place_frame(const cfg_t &cfg, const frame_t &frame) {
+  int n = cfg.bbs.size();
+  std::vector<int> offsets;
+  std::vector<koopa_raw_value_t> uses;
+  std::vector<char> is_exit(n, 0);
+  int setup = -1;
+  for(int b : cfg.rpo) {
+    bool need = false;
+    for(koopa_raw_value_t inst : get_insts(cfg.bbs[b])) {
+      frame_accesses(inst, offsets);
+      koopa_raw_value_t def = get_def_use(inst, uses);
+      // 参数变量在建立栈帧时才写入寄存器
+      bool saved_def = def != nullptr && value_reg.count(def) &&
+                       std::count(callee_saved.begin(), callee_saved.end(), value_reg[def]) &&
+                       !(inst->kind.tag == KOOPA_RVT_STORE && param_index(frame, def) != -1);
+      if(inst->kind.tag == KOOPA_RVT_CALL && tail_calls.count(inst))
+        is_exit[b] = 1;
+      else if(inst->kind.tag == KOOPA_RVT_CALL || !offsets.empty() || saved_def)
+        need = true;
+      if(inst->kind.tag == KOOPA_RVT_RETURN)
+        is_exit[b] = 1;
+    }
+    if(!need)
+      continue;
+    if(setup == -1)
+      setup = b;
+    while(!dominates(cfg, setup, b))
+      setup = cfg.idom[setup];
+  }
+  if(setup <= 0 || cfg.loop_depth[setup] > 0)
+    return 0;
+  std::vector<char> visited(n, 0);
+  std::vector<int> work = {setup};
+  visited[setup] = 1;
+  while(!work.empty()) {
+    int b = work.back();
+    work.pop_back();
+    if(is_exit[b] && !dominates(cfg, setup, b))
+      return 0;
+    for(int s : cfg.succs[b])
+      if(!visited[s]) {
+        visited[s] = 1;
+        work.push_back(s);
+      }
+  }
+  return setup;
+}
+
+// 为函数中的值分配寄存器与栈位置, 求栈帧布局
+// 按加权使用次数从高到低分配寄存器: 跨越调用的值只用被调用者保存寄存器, 优先与写入的变量共用寄存器
+// 栈帧中 reserved 字节留给栈上传递的参数与 ra, 其后依次为保存的寄存器, 未分配到寄存器的标量,
+// 以及按大小升序放在栈帧最远端的数组, 活跃范围互不重叠的标量共用同一位置
+frame_t layout_frame(koopa_raw_function_t func, int reserved) {
+  cfg_t cfg = build_cfg(func);
+  int n = cfg.bbs.size();
+  frame_t frame;
+  std::vector<koopa_raw_value_t> values, arrays;
+  std::unordered_map<koopa_raw_value_t, int> id;
+  std::unordered_map<koopa_raw_value_t, int> store_num;
+  for(koopa_raw_basic_block_t bb : cfg.bbs) {
+    for(koopa_raw_value_t inst : get_insts(bb)) {
+      if(inst->kind.tag == KOOPA_RVT_ALLOC && !has_slot(inst))
+        arrays.push_back(inst);
+      else if(has_slot(inst)) {
+        id[inst] = values.size();
+        values.push_back(inst);
+      }
+      if(inst->kind.tag == KOOPA_RVT_STORE)
+        store_num[inst->kind.data.store.dest]++;
+    }
+  }
+  // 只在入口由寄存器参数写入一次的局部变量
+  if(n > 0) {
+    for(koopa_raw_value_t inst : get_insts(cfg.bbs[0])) {
+      if(inst->kind.tag != KOOPA_RVT_STORE)
+        continue;
+      koopa_raw_value_t value = inst->kind.data.store.value, dest = inst->kind.data.store.dest;
+      if(value->kind.tag == KOOPA_RVT_FUNC_ARG_REF && value->kind.data.func_arg_ref.index < 8 &&
+         dest->kind.tag == KOOPA_RVT_ALLOC && store_num[dest] == 1)
+        frame.params.push_back({dest, (int)value->kind.data.func_arg_ref.index});
+    }
+  }
+
+  // 每个基本块向上暴露的读取与写入, 求活跃变量直到不动点
+  std::vector<std::vector<int> > use(n), def(n), live_in(n), live_out(n);
+  std::vector<koopa_raw_value_t> uses;
+  std::vector<char> defined(values.size(), 0);
+  std::vector<long long> weight(values.size(), 0);
+  std::vector<std::vector<int> > partners(values.size());
+  for(int i = 0; i < n; ++i) {
+    long long w = block_weight(cfg, i);
+    for(koopa_raw_value_t inst : get_insts(cfg.bbs[i])) {
+      koopa_raw_value_t d = get_def_use(inst, uses);
+      for(koopa_raw_value_t u : uses) {
+        weight[id[u]] += w;
+        if(!defined[id[u]])
+          use[i].push_back(id[u]);
+      }
+      if(d == nullptr)
+        continue;
+      weight[id[d]] += w;
+      if(!defined[id[d]]) {
+        defined[id[d]] = 1;
+        def[i].push_back(id[d]);
+      }
+      // 写入变量的值与变量共用寄存器时可省去复制
+      if(inst->kind.tag == KOOPA_RVT_STORE && slot_owner(inst->kind.data.store.value) != nullptr) {
+        int x = id[d], y = id[slot_owner(inst->kind.data.store.value)];
+        partners[x].push_back(y);
+        partners[y].push_back(x);
+      }
+    }
+    for(int x : def[i])
+      defined[x] = 0;
+    std::sort(use[i].begin(), use[i].end());
+    use[i].erase(std::unique(use[i].begin(), use[i].end()), use[i].end());
+    std::sort(def[i].begin(), def[i].end());
+    live_in[i] = use[i];
+  }
+  std::vector<int> order(cfg.rpo.rbegin(), cfg.rpo.rend());
+  std::vector<char> reachable(n, 0);
+  for(int b : cfg.rpo)
+    reachable[b] = 1;
+  for(int i = 0; i < n; ++i)
+    if(!reachable[i])
+      order.push_back(i);
+  bool changed = true;
+  while(changed) {
+    changed = false;
+    for(int b : order) {
+      std::vector<int> out;
+      for(int s : cfg.succs[b]) {
+        std::vector<int> merged;
+        std::set_union(out.begin(), out.end(), live_in[s].begin(), live_in[s].end(), std::back_inserter(merged));
+        out.swap(merged);
+      }
+      live_out[b].swap(out);
+      changed |= update_live_in(live_in[b], use[b], live_out[b], def[b]);
+    }
+  }
+
+  // 逆序扫描每个基本块, 定义点与此时所有活跃值冲突, 调用后仍活跃的值跨越调用
+  std::vector<std::vector<int> > interfere(values.size());
+  std::vector<char> cross_call(values.size(), 0);
+  live_set_t live(values.size());
+  for(int i = 0; i < n; ++i) {
+    for(int x : live.dense)
+      live.pos[x] = -1;
+    live.dense.clear();
+    for(int x : live_out[i])
+      live.insert(x);
+    std::vector<koopa_raw_value_t> insts = get_insts(cfg.bbs[i]);
+    for(auto it = insts.rbegin(); it != insts.rend(); ++it) {
+      koopa_raw_value_t d = get_def_use(*it, uses);
+      if(d != nullptr) {
+        int x = id[d];
+        for(int y : live.dense) {
+          if(y != x) {
+            interfere[x].push_back(y);
+            interfere[y].push_back(x);
+          }
+        }
+        live.erase(x);
+      }
+      if((*it)->kind.tag == KOOPA_RVT_CALL && !tail_calls.count(*it))
+        for(int y : live.dense)
+          cross_call[y] = 1;
+      for(koopa_raw_value_t u : uses)
+        live.insert(id[u]);
+    }
+  }
+
+  // 按权重从高到低分配寄存器, 分配失败的值放在栈上
+  // 有 C 扩展时不跨越调用的值优先使用不传递参数的 a2 - a5, 使更多指令能用 x8 - x15 的 16 位编码
+  std::vector<reg_t> temps;
+  if(opt_options.rvc)
+    for(reg_t r : {REG_A5, REG_A4, REG_A3, REG_A2})
+      if(r - REG_A0 >= (int)func->params.len)
+        temps.push_back(r);
+  temps.insert(temps.end(), caller_saved.begin(), caller_saved.end());
+  std::vector<reg_t> regs = temps;
+  regs.insert(regs.end(), callee_saved.begin(), callee_saved.end());
+  std::vector<int> reg(values.size(), -1);
+  std::vector<int> by_weight(values.size());
+  for(size_t x = 0; x < values.size(); ++x)
+    by_weight[x] = x;
+  std::stable_sort(by_weight.begin(), by_weight.end(), [&](int a, int b) { return weight[a] > weight[b]; });
+  std::vector<int> taken(regs.size(), -1);
+  std::vector<char> used(regs.size(), 0);
+  for(int x : by_weight) {
+    for(int y : interfere[x])
+      if(reg[y] != -1)
+        taken[reg[y]] = x;
+    int first = cross_call[x] ? temps.size() : 0;
+    for(int y : partners[x])
+      if(reg[y] >= first && taken[reg[y]] != x) {
+        reg[x] = reg[y];
+        break;
+      }
+    for(int r = first; reg[x] == -1 && r < (int)regs.size(); ++r)
+      if(taken[r] != x)
+        reg[x] = r;
+    if(reg[x] != -1) {
+      used[reg[x]] = 1;
+      value_reg[values[x]] = regs[reg[x]];
+    }
+  }
+  int size = reserved;
+  for(size_t r = temps.size(); r < regs.size(); ++r)
+    if(used[r]) {
+      frame.saved.push_back({regs[r], size});
+      size += 4;
+    }
+
+  // 栈上的值按定义顺序贪心着色, 取冲突值未占用的最小位置
+  std::vector<int> color(values.size(), -1);
+  std::vector<int> mark;
+  int slot_num = 0, base = size;
+  for(size_t x = 0; x < values.size(); ++x) {
+    if(reg[x] != -1)
+      continue;
+    for(int y : interfere[x])
+      if(color[y] != -1) {
+        if((size_t)color[y] >= mark.size())
+          mark.resize(color[y] + 1, -1);
+        mark[color[y]] = x;
+      }
+    int c = 0;
+    while(c < (int)mark.size() && mark[c] == (int)x)
+      c++;
+    color[x] = c;
+    slot_num = std::max(slot_num, c + 1);
+    stack_offset[values[x]] = base + c * 4;
+  }
+  size += slot_num * 4;
+
+  std::stable_sort(arrays.begin(), arrays.end(), [](koopa_raw_value_t a, koopa_raw_value_t b) {
+    return calc_size(a->ty->data.pointer.base) < calc_size(b->ty->data.pointer.base);
+  });
+  for(koopa_raw_value_t array : arrays) {
+    stack_offset[array] = size;
+    size += calc_size(array->ty->data.pointer.base);
+  }
+
+  // 读取局部变量的结果直接引用变量的存储位置
+  for(koopa_raw_basic_block_t bb : cfg.bbs) {
+    for(koopa_raw_value_t inst : get_insts(bb)) {
+      if(inst->kind.tag != KOOPA_RVT_LOAD || inst->kind.data.load.src->kind.tag != KOOPA_RVT_ALLOC)
+        continue;
+      koopa_raw_value_t src = inst->kind.data.load.src;
+      if(value_reg.count(src))
+        value_reg[inst] = value_reg[src];
+      else
+        stack_offset[inst] = stack_offset[src];
+    }
+  }
+  frame.size = size;
+  frame.base = choose_frame_base(cfg);
+  int setup = place_frame(cfg, frame);
+  frame.setup = cfg.bbs[setup];
+  for(int i = 0; i < n; ++i)
+    if(setup == 0 || dominates(cfg, setup, i))
+      frame.framed.insert(cfg.bbs[i]);
+  return frame;
+}
@@ -0,0 +1,179 @@
+#include "koopa.h"
+#include "opt.hpp"
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+/** koopa_lib() 附带的运行时函数: memset(dst, value, count) 与 memcpy(dst, src, count), count 为字数 */
+static const char *const memset_name = "@__sysy_memset";
+static const char *const memcpy_name = "@__sysy_memcpy";
+
+// 判断函数是否为 koopa_lib() 附带的运行时函数, 它们不被内联, 其中的循环也不再识别
+bool is_runtime_routine(koopa_raw_function_t func) {
+  return !strcmp(func->name, memset_name) || !strcmp(func->name, memcpy_name);
+}
+
+// 判断 ptr 是否为 getelemptr/getptr 得到的 *i32 地址, 基址在循环中不变, 下标随迭代恰好增加 1
+static bool is_sequential(const counted_loop_t &info, koopa_raw_value_t ptr) {
+  koopa_raw_value_t src, index;
+  if(ptr->kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
+    src = ptr->kind.data.get_elem_ptr.src;
+    index = ptr->kind.data.get_elem_ptr.index;
+  }
+  else if(ptr->kind.tag == KOOPA_RVT_GET_PTR) {
+    src = ptr->kind.data.get_ptr.src;
+    index = ptr->kind.data.get_ptr.index;
+  }
+  else
+    return false;
+  long long coef;
+  return ptr->ty->data.pointer.base->tag == KOOPA_RTT_INT32 && is_invariant(info, src) &&
+         linear_coef(info, index, coef) && coef * info.step == 1;
+}
+
+// 将逐字写入连续地址的计数循环替换为对运行时函数的调用:
+// 写入不变的值时调用 memset, 写入从另一段不重叠的连续地址读出的值时调用 memcpy
+// 迭代次数为常量且会被完全展开的循环留给循环展开处理, 返回调用的运行时函数, 未替换时返回 nullptr
+static koopa_raw_function_t replace_idiom(koopa_raw_function_t func, const counted_loop_t &info,
+                          koopa_raw_function_t memset_func, koopa_raw_function_t memcpy_func) {
+  if(info.body.size() != 1 || info.has_call)
+    return nullptr;
+  if(trip_count(info, opt_options.unroll_size_limit / std::max(info.size, (size_t)1)) >= 0)
+    return nullptr;
+  // 循环变量的 store 须在终结指令之前, 其余指令中读取的循环变量都是本次迭代的值
+  std::vector<koopa_raw_value_t> insts = get_insts(info.body[0]);
+  if(insts.size() < 2 || insts[insts.size() - 2] != info.var_store)
+    return nullptr;
+  koopa_raw_value_t store = nullptr;
+  for(size_t i = 0; i + 2 < insts.size(); ++i) {
+    koopa_raw_value_t inst = insts[i];
+    switch(inst->kind.tag) {
+      case KOOPA_RVT_LOAD:
+      case KOOPA_RVT_GET_ELEM_PTR:
+      case KOOPA_RVT_GET_PTR:
+        break;
+      case KOOPA_RVT_BINARY:
+        // 删除循环会同时删除可能的除零错误
+        if(inst->kind.data.binary.op == KOOPA_RBO_DIV || inst->kind.data.binary.op == KOOPA_RBO_MOD)
+          return nullptr;
+        break;
+      case KOOPA_RVT_STORE:
+        if(store != nullptr)
+          return nullptr;
+        store = inst;
+        break;
+      default:
+        return nullptr;
+    }
+  }
+  if(store == nullptr || !is_sequential(info, store->kind.data.store.dest))
+    return nullptr;
+  koopa_raw_value_t dest = store->kind.data.store.dest;
+  koopa_raw_value_t value = store->kind.data.store.value;
+  koopa_raw_value_t src = nullptr;
+  if(!is_invariant(info, value)) {
+    if(value->kind.tag != KOOPA_RVT_LOAD || !info.values.count(value))
+      return nullptr;
+    src = value->kind.data.load.src;
+    if(!is_sequential(info, src) || may_alias(src, dest))
+      return nullptr;
+  }
+  koopa_raw_function_t callee = src == nullptr ? memset_func : memcpy_func;
+  if(callee == nullptr)
+    return nullptr;
+
+  // 迭代次数 cnt = max(d, 0), 首次迭代的地址由循环变量的初值 i0 计算
+  std::vector<koopa_raw_value_t> idiom_insts;
+  auto emit = [&](koopa_raw_binary_op_t op, koopa_raw_value_t lhs, koopa_raw_value_t rhs) {
+    koopa_raw_value_t inst = new_binary(op, lhs, rhs);
+    idiom_insts.push_back(inst);
+    return inst;
+  };
+  koopa_raw_value_t i0 = new_load(info.var);
+  idiom_insts.push_back(i0);
+  std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> bound_map;
+  koopa_raw_value_t bound = clone_expr(info, info.bound, bound_map, idiom_insts);
+  koopa_raw_value_t d = info.step > 0 ? emit(KOOPA_RBO_SUB, bound, i0) : emit(KOOPA_RBO_SUB, i0, bound);
+  if(info.op == KOOPA_RBO_LE || info.op == KOOPA_RBO_GE)
+    d = emit(KOOPA_RBO_ADD, d, new_integer(1));
+  koopa_raw_value_t cnt = emit(KOOPA_RBO_MUL, d, emit(KOOPA_RBO_GT, d, new_integer(0)));
+
+  std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> replace;
+  for(koopa_raw_value_t inst : insts)
+    if(inst->kind.tag == KOOPA_RVT_LOAD && inst->kind.data.load.src == info.var)
+      replace[inst] = i0;
+  std::vector<const void *> args = {clone_expr(info, dest, replace, idiom_insts)};
+  args.push_back(clone_expr(info, src == nullptr ? value : src, replace, idiom_insts));
+  args.push_back(cnt);
+  koopa_raw_value_data_t *call = new_value(simple_type(KOOPA_RTT_UNIT), KOOPA_RVT_CALL);
+  call->kind.data.call.callee = callee;
+  call->kind.data.call.args = make_slice(args, KOOPA_RSIK_VALUE);
+  idiom_insts.push_back(call);
+  koopa_raw_value_t i_new = emit(KOOPA_RBO_ADD, i0, emit(KOOPA_RBO_MUL, cnt, new_integer(info.step)));
+  idiom_insts.push_back(new_store(i_new, info.var));
+  idiom_insts.push_back(new_jump(info.exit));
+  koopa_raw_basic_block_data_t *idiom = new_basic_block(new_label("idiom", info.header));
+  set_insts(idiom, idiom_insts);
+
+  retarget(info.preheaders, info.header, idiom);
+  std::vector<koopa_raw_basic_block_t> bbs = get_bbs(func);
+  auto pos = std::find(bbs.begin(), bbs.end(), info.header);
+  *pos = idiom;
+  bbs.erase(std::find(bbs.begin(), bbs.end(), info.body[0]));
+  set_bbs(func, bbs);
+  return callee;
+}
+
+// 识别所有函数中逐字清零 / 填充 / 复制数组的循环, 替换为按字展开的运行时函数调用
+// 在函数内联之后进行, 以便区分传入的数组参数; 最后删除未被使用的运行时函数
+void recognize_loop_idioms(koopa_raw_program_t &program) {
+  koopa_raw_function_t memset_func = nullptr, memcpy_func = nullptr;
+  for(size_t i = 0; i < program.funcs.len; ++i) {
+    koopa_raw_function_t func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    if(func->bbs.len == 0)
+      continue;
+    if(!strcmp(func->name, memset_name))
+      memset_func = func;
+    else if(!strcmp(func->name, memcpy_name))
+      memcpy_func = func;
+  }
+  if(memset_func == nullptr && memcpy_func == nullptr)
+    return;
+  std::unordered_set<koopa_raw_function_t> used;
+  init_alias(program);
+  for(size_t i = 0; i < program.funcs.len; ++i) {
+    koopa_raw_function_t func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    if(func->bbs.len == 0 || is_runtime_routine(func))
+      continue;
+    init_alias(func);
+    std::unordered_set<koopa_raw_basic_block_t> done;
+    bool changed = true;
+    while(changed) {
+      changed = false;
+      cfg_t cfg = build_cfg(func);
+      for(const loop_t &loop : cfg.loops) {
+        if(done.count(cfg.bbs[loop.header]))
+          continue;
+        done.insert(cfg.bbs[loop.header]);
+        counted_loop_t info;
+        if(!analyze_counted_loop(cfg, loop, info))
+          continue;
+        koopa_raw_function_t callee = replace_idiom(func, info, memset_func, memcpy_func);
+        if(callee != nullptr) {
+          used.insert(callee);
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+
+  std::vector<const void *> live_funcs;
+  for(size_t i = 0; i < program.funcs.len; ++i) {
+    koopa_raw_function_t func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    if(func->bbs.len == 0 || !is_runtime_routine(func) || used.count(func))
+      live_funcs.push_back(func);
+  }
+  program.funcs = make_slice(live_funcs, KOOPA_RSIK_FUNCTION);
+}
@@ -0,0 +1,374 @@
+#include "mir.hpp"
+#include "opt.hpp"
+
+/** 条件分支一侧执行的指令, 即 insts 中 [begin, end) 的指令 */
+struct arm_t {
+  size_t begin;
+  size_t end;
+};
+
+/** 可转换的区域: 块 b 末尾的条件跳转不跳转时执行 then 一侧, 跳转时执行 other 一侧, 两侧都到达块 join
+ * 三角形的 other 为空, 菱形的 then 以跳到 join 的 j 结束, other 为紧随其后的块 */
+struct region_t {
+  size_t branch;
+  arm_t then_arm;
+  arm_t other_arm;
+  /** 块 b 中被替换的指令的结束位置 (三角形为 then 的末尾, 菱形为 j 之后) */
+  size_t end;
+  size_t join;
+};
+
+/** 每侧最多的指令数, 更长的分支由代价模型也不会转换 */
+static const size_t max_arm_size = 3;
+
+// 可以在两条路径上都执行的指令: 不访存, 不跳转, 没有长延迟
+static bool speculatable(mop_t op) {
+  switch(op) {
+    case MOP_LI:
+    case MOP_LA:
+    case MOP_MV:
+    case MOP_ADD:
+    case MOP_SUB:
+    case MOP_AND:
+    case MOP_OR:
+    case MOP_XOR:
+    case MOP_SLT:
+    case MOP_SGT:
+    case MOP_SH1ADD:
+    case MOP_SH2ADD:
+    case MOP_SH3ADD:
+    case MOP_MIN:
+    case MOP_MAX:
+    case MOP_SEQZ:
+    case MOP_SNEZ:
+    case MOP_ADDI:
+    case MOP_ANDI:
+    case MOP_ORI:
+    case MOP_XORI:
+    case MOP_SLTI:
+    case MOP_SLTIU:
+    case MOP_SLLI:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool speculatable(const mfunc_t &func, const arm_t &arm) {
+  if(arm.end - arm.begin > max_arm_size)
+    return false;
+  for(size_t i = arm.begin; i < arm.end; ++i)
+    if(!speculatable(func.insts[i].op))
+      return false;
+  return true;
+}
+
+// 判断块 b 是否以三角形或菱形结束
+// 窥孔优化已把没有其他前驱的 then 块并入 b, 所以 then 一侧就在块 b 的条件跳转之后
+static bool match_region(const mfunc_t &func, size_t b, const std::vector<int> &refs, region_t &region) {
+  size_t n = func.blocks.size(), begin = func.blocks[b].begin, end = mblock_end(func, b);
+  if(b + 1 >= n || end == begin)
+    return false;
+  bool diamond = func.insts[end - 1].op == MOP_J;
+  size_t last = diamond ? end - 1 : end;
+  size_t p = last;
+  while(p > begin && !is_branch(func.insts[p - 1].op))
+    --p;
+  if(p == begin)
+    return false;
+  region.branch = p - 1;
+  region.then_arm = {p, last};
+  region.end = end;
+  if(!speculatable(func, region.then_arm))
+    return false;
+  const minst_t &branch = func.insts[region.branch];
+  if(!diamond) {
+    region.other_arm = {end, end};
+    region.join = b + 1;
+    return branch.sym == func.blocks[b + 1].label;
+  }
+  // 菱形: 跳转目标为下一个块, 它只有这一个前驱并落入 j 的目标
+  if(b + 2 >= n || branch.sym != func.blocks[b + 1].label || refs[branch.sym] != 1 ||
+     func.insts[end - 1].sym != func.blocks[b + 2].label)
+    return false;
+  region.other_arm = {func.blocks[b + 1].begin, mblock_end(func, b + 1)};
+  region.join = b + 2;
+  return speculatable(func, region.other_arm);
+}
+
+// 区域中两侧写入的寄存器, 只有一个时返回它, 否则返回 REG_NONE
+static reg_t region_def(const mfunc_t &func, const region_t &region) {
+  uint32_t defs = 0;
+  for(const arm_t &arm : {region.then_arm, region.other_arm})
+    for(size_t i = arm.begin; i < arm.end; ++i)
+      defs |= inst_defs(func.insts[i]);
+  if(defs == 0 || (defs & (defs - 1)) != 0)
+    return REG_NONE;
+  reg_t m = reg_t(__builtin_ctz(defs));
+  return m == REG_SP ? REG_NONE : m;
+}
+
+// 条件寄存器在跳转前是否由比较得到, 即只能是 0 或 1
+static bool is_boolean(const mfunc_t &func, size_t b, size_t branch) {
+  reg_t cond = func.insts[branch].rs1;
+  for(size_t i = branch; i-- > func.blocks[b].begin;) {
+    const minst_t &inst = func.insts[i];
+    if(inst_defs(inst) >> cond & 1) {
+      mop_t op = inst.op;
+      return op == MOP_SLT || op == MOP_SGT || op == MOP_SLTI || op == MOP_SEQZ || op == MOP_SNEZ;
+    }
+  }
+  return false;
+}
+
+/** 生成不跳转的指令序列时的状态 */
+struct select_t {
+  std::vector<minst_t> seq;
+  /** 不可用作临时寄存器的寄存器集合 */
+  uint32_t busy;
+  reg_t cond;
+  /** cond 是否只能是 0 或 1 */
+  bool boolean;
+
+  // 取一个空闲的临时寄存器, 没有时返回 REG_NONE
+  reg_t scratch() {
+    for(reg_t reg : {REG_T0, REG_T1, REG_T2, REG_T3, REG_T4, REG_T5, REG_T6}) {
+      if(busy >> reg & 1)
+        continue;
+      busy |= 1u << reg;
+      return reg;
+    }
+    return REG_NONE;
+  }
+
+  void emit(mop_t op, reg_t rd, reg_t rs1, reg_t rs2, int imm = 0) {
+    seq.push_back({op, rd, rs1, rs2, imm, 0});
+  }
+
+  // 在 mask 中生成条件成立时全 1, 否则为 0 的掩码, nonzero 表示条件为 cond 不为 0
+  void make_mask(reg_t mask, bool nonzero) {
+    if(!boolean) {
+      emit(nonzero ? MOP_SNEZ : MOP_SEQZ, mask, cond, REG_NONE);
+      emit(MOP_SUB, mask, REG_ZERO, mask);
+    }
+    else if(nonzero)
+      emit(MOP_SUB, mask, REG_ZERO, cond);
+    else
+      emit(MOP_ADDI, mask, cond, REG_NONE, -1);
+  }
+};
+
+// 求一侧写入 m 的值所在的寄存器: 空的一侧为 m 原来的值, 单条 mv 或 li 0 直接取其来源,
+// 否则把该侧的指令改为写入临时寄存器后加入序列
+static reg_t arm_value(const mfunc_t &func, const arm_t &arm, reg_t m, select_t &sel) {
+  if(arm.end == arm.begin)
+    return m;
+  const minst_t &first = func.insts[arm.begin];
+  if(arm.end - arm.begin == 1 && first.op == MOP_MV)
+    return first.rs1;
+  if(arm.end - arm.begin == 1 && first.op == MOP_LI && first.imm == 0)
+    return REG_ZERO;
+  reg_t value = sel.scratch();
+  if(value == REG_NONE)
+    return REG_NONE;
+  bool renamed = false;
+  for(size_t i = arm.begin; i < arm.end; ++i) {
+    minst_t inst = func.insts[i];
+    if(renamed && inst.rs1 == m)
+      inst.rs1 = value;
+    if(renamed && inst.rs2 == m)
+      inst.rs2 = value;
+    if(inst.rd == m) {
+      inst.rd = value;
+      renamed = true;
+    }
+    sel.seq.push_back(inst);
+  }
+  return value;
+}
+
+// 三角形的一侧为 m = m op x 时, 改为 m = m op (条件成立 ? x : 0), op 与 0 运算不改变 m
+// nonzero 表示 then 一侧在 cond 不为 0 时执行
+static bool conditional_op(const mfunc_t &func, const region_t &region, reg_t m, bool nonzero, select_t &sel) {
+  const arm_t &arm = region.then_arm;
+  if(region.other_arm.end != region.other_arm.begin || arm.end - arm.begin != 1 || sel.cond == m)
+    return false;
+  minst_t inst = func.insts[arm.begin];
+  if(inst.rs1 != m)
+    return false;
+  if(inst.op == MOP_ADDI) {
+    // 条件为比较结果时, 加减 1 可以直接加减条件本身
+    if(sel.boolean && (inst.imm == 1 || inst.imm == -1)) {
+      sel.emit((inst.imm == 1) == nonzero ? MOP_ADD : MOP_SUB, m, m, sel.cond);
+      if(!nonzero)
+        sel.emit(MOP_ADDI, m, m, REG_NONE, inst.imm);
+      return true;
+    }
+    reg_t imm = sel.scratch();
+    if(imm == REG_NONE)
+      return false;
+    sel.emit(MOP_LI, imm, REG_NONE, REG_NONE, inst.imm);
+    inst = {MOP_ADD, m, m, imm, 0, 0};
+  }
+  else if((inst.op != MOP_ADD && inst.op != MOP_SUB && inst.op != MOP_OR && inst.op != MOP_XOR) || inst.rs2 == m)
+    return false;
+  reg_t part = sel.scratch();
+  if(part == REG_NONE)
+    return false;
+  if(opt_options.zicond)
+    sel.emit(nonzero ? MOP_CZERO_EQZ : MOP_CZERO_NEZ, part, inst.rs2, sel.cond);
+  else {
+    sel.make_mask(part, nonzero);
+    sel.emit(MOP_AND, part, part, inst.rs2);
+  }
+  sel.emit(inst.op, m, m, part);
+  return true;
+}
+
+// 生成 m = cond != 0 ? v_nz : v_z 的选择序列
+static bool select_value(reg_t m, reg_t v_nz, reg_t v_z, select_t &sel) {
+  if(v_nz == v_z) {
+    sel.emit(MOP_MV, m, v_nz, REG_NONE);
+    return true;
+  }
+  if(opt_options.zicond) {
+    if(v_z == REG_ZERO || v_nz == REG_ZERO) {
+      sel.emit(v_z == REG_ZERO ? MOP_CZERO_EQZ : MOP_CZERO_NEZ, m, v_z == REG_ZERO ? v_nz : v_z, sel.cond);
+      return true;
+    }
+    reg_t part = sel.scratch();
+    if(part == REG_NONE)
+      return false;
+    sel.emit(MOP_CZERO_EQZ, part, v_nz, sel.cond);
+    sel.emit(MOP_CZERO_NEZ, m, v_z, sel.cond);
+    sel.emit(MOP_OR, m, m, part);
+    return true;
+  }
+  reg_t mask = sel.scratch();
+  if(mask == REG_NONE)
+    return false;
+  if(v_z == REG_ZERO || v_nz == REG_ZERO) {
+    sel.make_mask(mask, v_z == REG_ZERO);
+    sel.emit(MOP_AND, m, v_z == REG_ZERO ? v_nz : v_z, mask);
+    return true;
+  }
+  // m = v_z ^ ((v_nz ^ v_z) & mask)
+  reg_t diff = sel.scratch();
+  if(diff == REG_NONE)
+    return false;
+  sel.make_mask(mask, true);
+  sel.emit(MOP_XOR, diff, v_nz, v_z);
+  sel.emit(MOP_AND, diff, diff, mask);
+  sel.emit(MOP_XOR, m, v_z, diff);
+  return true;
+}
+
+// 用 Zbb 的 min / max 替换三角形: 比较 x 与 m, 满足条件时 m = x 的为最值, m 小于 0 时取反的为绝对值
+// 成功时返回被替换的第一条指令 (比较) 的位置, 否则返回 region.branch
+static size_t select_minmax(const mfunc_t &func, size_t b, const region_t &region, uint32_t live_after,
+                            select_t &sel) {
+  const arm_t &arm = region.then_arm;
+  if(!opt_options.zbb || region.branch == func.blocks[b].begin || arm.end - arm.begin != 1 ||
+     region.other_arm.end != region.other_arm.begin)
+    return region.branch;
+  const minst_t &cmp = func.insts[region.branch - 1], &branch = func.insts[region.branch];
+  const minst_t &inst = func.insts[arm.begin];
+  reg_t cond = cmp.rd;
+  if((cmp.op != MOP_SLT && cmp.op != MOP_SGT) || cond != branch.rs1 || cond == cmp.rs1 || cond == cmp.rs2 ||
+     (live_after >> cond & 1) || inst.rd == cond)
+    return region.branch;
+  // 执行 then 一侧的条件为 lhs < rhs; 跳转为 bnez 时取反为 lhs >= rhs, 交换后相等时两值相同, 对选取最值没有影响
+  reg_t lhs = cmp.op == MOP_SLT ? cmp.rs1 : cmp.rs2;
+  reg_t rhs = cmp.op == MOP_SLT ? cmp.rs2 : cmp.rs1;
+  if(branch.op == MOP_BNEZ)
+    std::swap(lhs, rhs);
+  if(inst.op == MOP_MV && inst.rd != inst.rs1) {
+    reg_t m = inst.rd, x = inst.rs1;
+    if(lhs == x && rhs == m)
+      sel.emit(MOP_MIN, m, m, x);
+    else if(lhs == m && rhs == x)
+      sel.emit(MOP_MAX, m, m, x);
+    else
+      return region.branch;
+  }
+  else if(inst.op == MOP_SUB && inst.rs1 == REG_ZERO && inst.rd == inst.rs2 && lhs == inst.rd && rhs == REG_ZERO) {
+    sel.emit(MOP_SUB, cond, REG_ZERO, inst.rd);
+    sel.emit(MOP_MAX, inst.rd, inst.rd, cond);
+  }
+  else
+    return region.branch;
+  return region.branch - 1;
+}
+
+// 把 insts 中 [from, to) 的指令替换为 seq, 并移动之后各基本块的起始位置
+static void splice(mfunc_t &func, size_t from, size_t to, const std::vector<minst_t> &seq) {
+  func.insts.erase(func.insts.begin() + from, func.insts.begin() + to);
+  func.insts.insert(func.insts.begin() + from, seq.begin(), seq.end());
+  for(mblock_t &block : func.blocks)
+    if(block.begin >= to)
+      block.begin = block.begin - (to - from) + seq.size();
+}
+
+// 转换块 b 末尾的区域, 成功时返回 true
+static bool convert_region(mfunc_t &func, size_t b, const region_t &region, uint32_t live_after) {
+  const minst_t &branch = func.insts[region.branch];
+  reg_t m = region_def(func, region);
+  if(m == REG_NONE)
+    return false;
+  select_t sel;
+  sel.cond = branch.rs1;
+  sel.boolean = is_boolean(func, b, region.branch);
+  sel.busy = live_after | (1u << REG_ZERO) | (1u << m) | (1u << sel.cond);
+  for(const arm_t &arm : {region.then_arm, region.other_arm})
+    for(size_t i = arm.begin; i < arm.end; ++i)
+      sel.busy |= inst_uses(func.insts[i]) | inst_defs(func.insts[i]);
+
+  size_t from = select_minmax(func, b, region, live_after, sel);
+  if(from == region.branch) {
+    // 循环外的分支只执行一次, 不值得增加指令
+    if(func.blocks[b].depth == 0)
+      return false;
+    // then 一侧在跳转不发生时执行, beqz 不跳转即 cond 不为 0
+    bool nonzero = branch.op == MOP_BEQZ;
+    uint32_t busy = sel.busy;
+    if(!conditional_op(func, region, m, nonzero, sel)) {
+      sel.seq.clear();
+      sel.busy = busy;
+      reg_t v_then = arm_value(func, region.then_arm, m, sel);
+      reg_t v_other = arm_value(func, region.other_arm, m, sel);
+      if(v_then == REG_NONE || v_other == REG_NONE ||
+         !select_value(m, nonzero ? v_then : v_other, nonzero ? v_other : v_then, sel))
+        return false;
+    }
+    // 代价模型: 新序列不长于原来平均执行的指令数 (跳转与两侧各一半) 加上跳转的代价
+    size_t then_size = region.end - region.then_arm.begin, other_size = region.other_arm.end - region.other_arm.begin;
+    if(2 * sel.seq.size() > 2 * (1 + (size_t)opt_options.branch_cost) + then_size + other_size)
+      return false;
+  }
+  // 先删除后面的 other 块, 再替换块 b 末尾的指令
+  if(region.join == b + 2)
+    splice(func, region.other_arm.begin, region.other_arm.end, {});
+  splice(func, from, region.end, sel.seq);
+  return true;
+}
+
+// 条件转换: 把两侧只有少量指令的条件分支改为不跳转的指令序列
+// 有 Zbb 时优先选取 min / max, 有 Zicond 时用 czero 选择, 否则用比较结果生成掩码; 不再使用的标号由窥孔优化删除
+void if_convert(mfunc_t &func) {
+  std::vector<int> refs(func.syms.size(), 0);
+  for(const minst_t &inst : func.insts)
+    for(int label : jump_targets(func, inst))
+      refs[label]++;
+  std::vector<uint32_t> live = live_in(func);
+  for(size_t b = 0; b + 1 < func.blocks.size(); ++b) {
+    region_t region;
+    if(!match_region(func, b, refs, region))
+      continue;
+    int target = func.insts[region.branch].sym, join = func.blocks[region.join].label;
+    if(convert_region(func, b, region, live[region.join])) {
+      refs[target]--;
+      if(region.join == b + 2)
+        refs[join]--;
+    }
+  }
+}
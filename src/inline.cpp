@@ -0,0 +1,218 @@
+#include "koopa.h"
+#include "opt.hpp"
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+/** 调用图: 函数 -> 其中所有 call 指令 */
+static std::unordered_map<koopa_raw_function_t, std::vector<koopa_raw_value_t> > call_sites;
+/** 位于递归调用环中的函数, 不会被内联 */
+static std::unordered_set<koopa_raw_function_t> recursive_funcs;
+
+// 收集函数中的所有 call 指令
+static std::vector<koopa_raw_value_t> collect_calls(koopa_raw_function_t func) {
+  std::vector<koopa_raw_value_t> calls;
+  for(koopa_raw_basic_block_t bb : get_bbs(func))
+    for(koopa_raw_value_t inst : get_insts(bb))
+      if(inst->kind.tag == KOOPA_RVT_CALL)
+        calls.push_back(inst);
+  return calls;
+}
+
+// Tarjan 算法求强连通分量, 分量按被调用者在前的顺序加入 order
+static void tarjan(koopa_raw_function_t func,
+                   std::unordered_map<koopa_raw_function_t, int> &dfn,
+                   std::unordered_map<koopa_raw_function_t, int> &low,
+                   std::vector<koopa_raw_function_t> &stack,
+                   std::unordered_set<koopa_raw_function_t> &on_stack,
+                   std::vector<koopa_raw_function_t> &order) {
+  int id = dfn.size();
+  dfn[func] = low[func] = id;
+  stack.push_back(func);
+  on_stack.insert(func);
+  for(koopa_raw_value_t call : call_sites[func]) {
+    koopa_raw_function_t callee = call->kind.data.call.callee;
+    if(callee->bbs.len == 0)
+      continue;
+    if(callee == func)
+      recursive_funcs.insert(func);
+    if(dfn.find(callee) == dfn.end()) {
+      tarjan(callee, dfn, low, stack, on_stack, order);
+      low[func] = std::min(low[func], low[callee]);
+    }
+    else if(on_stack.count(callee))
+      low[func] = std::min(low[func], dfn[callee]);
+  }
+  if(low[func] != dfn[func])
+    return;
+  std::vector<koopa_raw_function_t> scc;
+  koopa_raw_function_t top;
+  do {
+    top = stack.back();
+    stack.pop_back();
+    on_stack.erase(top);
+    scc.push_back(top);
+  } while(top != func);
+  if(scc.size() > 1)
+    recursive_funcs.insert(scc.begin(), scc.end());
+  order.insert(order.end(), scc.begin(), scc.end());
+}
+
+// 根据代价模型判断是否内联: 循环内的调用点与唯一调用点放宽阈值, 极小的函数总是内联
+static bool should_inline(koopa_raw_function_t caller, koopa_raw_value_t call, int loop_depth,
+                          size_t caller_size, std::unordered_map<koopa_raw_function_t, int> &call_count) {
+  koopa_raw_function_t callee = call->kind.data.call.callee;
+  if(callee->bbs.len == 0 || callee == caller || recursive_funcs.count(callee) || is_runtime_routine(callee))
+    return false;
+  size_t size = func_size(callee);
+  size_t call_cost = 6 + 2 * call->kind.data.call.args.len;
+  if(size <= call_cost)
+    return true;
+  size_t limit = opt_options.inline_threshold;
+  if(loop_depth > 0)
+    limit *= 2;
+  if(call_count[callee] == 1)
+    limit *= 2;
+  return size <= limit && caller_size + size <= (size_t)opt_options.inline_caller_limit;
+}
+
+// 将 bbs[bb_id] 中的调用指令 insts[inst_id] 替换为被调用函数体
+// 被调用函数的 alloc 被移到 hoisted_allocs 中, 由调用者统一放入入口块
+static void inline_call(std::vector<koopa_raw_basic_block_t> &bbs, size_t bb_id, size_t inst_id,
+                        std::vector<koopa_raw_value_t> &hoisted_allocs) {
+  koopa_raw_basic_block_t bb = bbs[bb_id];
+  std::vector<koopa_raw_value_t> insts = get_insts(bb);
+  koopa_raw_value_t call = insts[inst_id];
+  koopa_raw_function_t callee = call->kind.data.call.callee;
+
+  // 被调用函数的参数替换为实参
+  std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> value_map;
+  std::unordered_map<koopa_raw_basic_block_t, koopa_raw_basic_block_t> bb_map;
+  for(size_t i = 0; i < callee->params.len; ++i)
+    value_map[reinterpret_cast<koopa_raw_value_t>(callee->params.buffer[i])] =
+      reinterpret_cast<koopa_raw_value_t>(call->kind.data.call.args.buffer[i]);
+  std::vector<koopa_raw_basic_block_t> body = clone_blocks(get_bbs(callee), value_map, bb_map, "inl");
+
+  // 调用点之后的指令移入新基本块, 返回值通过一个局部变量传递
+  koopa_raw_basic_block_data_t *ret_bb = new_basic_block(new_label("inl", bb));
+  koopa_raw_value_data_t *ret_slot = nullptr;
+  std::vector<koopa_raw_value_t> ret_insts;
+  if(call->ty->tag != KOOPA_RTT_UNIT) {
+    ret_slot = new_value(pointer_type(call->ty), KOOPA_RVT_ALLOC);
+    hoisted_allocs.push_back(ret_slot);
+    koopa_raw_value_data_t *load = new_value(call->ty, KOOPA_RVT_LOAD);
+    load->kind.data.load.src = ret_slot;
+    ret_insts.push_back(load);
+  }
+  ret_insts.insert(ret_insts.end(), insts.begin() + inst_id + 1, insts.end());
+  set_insts(ret_bb, ret_insts);
+
+  // ret 改写为写返回值并跳转到调用点之后
+  for(koopa_raw_basic_block_t body_bb : body) {
+    std::vector<koopa_raw_value_t> body_insts;
+    for(koopa_raw_value_t inst : get_insts(body_bb)) {
+      if(inst->kind.tag == KOOPA_RVT_ALLOC) {
+        hoisted_allocs.push_back(inst);
+        continue;
+      }
+      if(inst->kind.tag == KOOPA_RVT_RETURN) {
+        if(ret_slot != nullptr && inst->kind.data.ret.value != nullptr) {
+          koopa_raw_value_data_t *store = new_value(simple_type(KOOPA_RTT_UNIT), KOOPA_RVT_STORE);
+          store->kind.data.store.value = inst->kind.data.ret.value;
+          store->kind.data.store.dest = ret_slot;
+          body_insts.push_back(store);
+        }
+        body_insts.push_back(new_jump(ret_bb));
+        continue;
+      }
+      body_insts.push_back(inst);
+    }
+    set_insts(body_bb, body_insts);
+  }
+
+  insts.resize(inst_id);
+  insts.push_back(new_jump(body[0]));
+  set_insts(bb, insts);
+
+  body.push_back(ret_bb);
+  bbs.insert(bbs.begin() + bb_id + 1, body.begin(), body.end());
+  if(ret_slot != nullptr)
+    replace_uses(bbs, call, ret_insts[0]);
+}
+
+// 在 func 中内联满足代价模型的调用点, 只考虑函数原有的调用
+static void inline_calls(koopa_raw_function_t func, std::unordered_map<koopa_raw_function_t, int> &call_count) {
+  cfg_t cfg = build_cfg(func);
+  std::unordered_map<koopa_raw_value_t, int> candidates;
+  for(size_t i = 0; i < cfg.bbs.size(); ++i)
+    for(koopa_raw_value_t inst : get_insts(cfg.bbs[i]))
+      if(inst->kind.tag == KOOPA_RVT_CALL)
+        candidates[inst] = cfg.loop_depth[i];
+  if(candidates.empty())
+    return;
+
+  std::vector<koopa_raw_basic_block_t> bbs = cfg.bbs;
+  std::vector<koopa_raw_value_t> hoisted_allocs;
+  size_t size = func_size(func);
+  bool changed = false;
+  for(size_t i = 0; i < bbs.size(); ++i) {
+    std::vector<koopa_raw_value_t> insts = get_insts(bbs[i]);
+    for(size_t j = 0; j < insts.size(); ++j) {
+      auto it = candidates.find(insts[j]);
+      if(it == candidates.end())
+        continue;
+      if(!should_inline(func, insts[j], it->second, size, call_count))
+        continue;
+      koopa_raw_function_t callee = insts[j]->kind.data.call.callee;
+      size += func_size(callee);
+      call_count[callee]--;
+      inline_call(bbs, i, j, hoisted_allocs);
+      changed = true;
+      // 调用点之后的指令已移入 bbs[i + 1 ...] 中的新块, 之后会被继续扫描
+      break;
+    }
+  }
+  if(!changed)
+    return;
+  std::vector<koopa_raw_value_t> entry_insts = get_insts(bbs[0]);
+  hoisted_allocs.insert(hoisted_allocs.end(), entry_insts.begin(), entry_insts.end());
+  set_insts(bbs[0], hoisted_allocs);
+  set_bbs(func, bbs);
+}
+
+// 自底向上遍历调用图进行函数内联, 并删除不再被调用的函数, 运行时函数留给循环惯用法识别删除
+void inline_functions(koopa_raw_program_t &program) {
+  std::vector<koopa_raw_function_t> funcs;
+  std::unordered_map<koopa_raw_function_t, int> call_count;
+  call_sites.clear();
+  recursive_funcs.clear();
+  for(size_t i = 0; i < program.funcs.len; ++i) {
+    koopa_raw_function_t func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    if(func->bbs.len == 0)
+      continue;
+    funcs.push_back(func);
+    call_sites[func] = collect_calls(func);
+    for(koopa_raw_value_t call : call_sites[func])
+      call_count[call->kind.data.call.callee]++;
+  }
+
+  std::unordered_map<koopa_raw_function_t, int> dfn, low;
+  std::vector<koopa_raw_function_t> stack, order;
+  std::unordered_set<koopa_raw_function_t> on_stack;
+  for(koopa_raw_function_t func : funcs)
+    if(dfn.find(func) == dfn.end())
+      tarjan(func, dfn, low, stack, on_stack, order);
+  for(koopa_raw_function_t func : order)
+    inline_calls(func, call_count);
+
+  std::vector<const void *> live_funcs;
+  for(size_t i = 0; i < program.funcs.len; ++i) {
+    koopa_raw_function_t func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    if(func->bbs.len != 0 && call_count[func] <= 0 && strcmp(func->name, "@main") != 0 && !is_runtime_routine(func))
+      continue;
+    live_funcs.push_back(func);
+  }
+  program.funcs = make_slice(live_funcs, KOOPA_RSIK_FUNCTION);
+}
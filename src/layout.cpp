@@ -0,0 +1,93 @@
+#include "mir.hpp"
+#include <cassert>
+#include <unordered_map>
+
+/** 基本块之间的控制流边, fall 表示原排列中顺序落入下一个基本块 */
+struct medge_t {
+  size_t target;
+  bool fall;
+};
+
+// 第 b 个基本块执行完后是否落入原排列中的下一个基本块
+static bool falls_through(const mfunc_t &func, size_t b) {
+  size_t begin = func.blocks[b].begin, end = mblock_end(func, b);
+  return end == begin || !is_exit(func.insts[end - 1].op);
+}
+
+// 重排基本块, 使同一循环中的热后继紧跟在前驱之后, 跳转可由窥孔优化删除或改为不跳转的条件分支
+// 没有剖析数据时以循环深度估计执行频率: 深度大的后继更热, 离开循环的块放到循环体之后
+void layout_blocks(mfunc_t &func) {
+  size_t n = func.blocks.size();
+  if(n < 3)
+    return;
+  std::unordered_map<int, size_t> label_block;
+  for(size_t b = 0; b < n; ++b)
+    label_block[func.blocks[b].label] = b;
+  std::vector<std::vector<medge_t> > succs(n), preds(n);
+  for(size_t b = 0; b < n; ++b) {
+    for(size_t i = func.blocks[b].begin; i < mblock_end(func, b); ++i) {
+      for(int label : jump_targets(func, func.insts[i]))
+        succs[b].push_back({label_block.at(label), false});
+    }
+    if(falls_through(func, b)) {
+      assert(b + 1 < n);
+      succs[b].push_back({b + 1, true});
+    }
+    for(const medge_t &edge : succs[b])
+      preds[edge.target].push_back({b, edge.fall});
+  }
+
+  // 从入口开始贪心地连接链: 优先接循环深度大的后继, 其次是原来就落入的后继, 离开循环的边不接
+  std::vector<char> placed(n, 0);
+  std::vector<size_t> order;
+  auto place_chain = [&](size_t b) {
+    while(true) {
+      placed[b] = 1;
+      order.push_back(b);
+      size_t next = n;
+      bool next_fall = false;
+      for(const medge_t &edge : succs[b]) {
+        size_t s = edge.target;
+        if(placed[s] || func.blocks[s].depth < func.blocks[b].depth)
+          continue;
+        if(next == n || func.blocks[s].depth > func.blocks[next].depth ||
+           (func.blocks[s].depth == func.blocks[next].depth && edge.fall && !next_fall)) {
+          next = s;
+          next_fall = edge.fall;
+        }
+      }
+      if(next == n)
+        return;
+      b = next;
+    }
+  };
+  place_chain(0);
+  while(order.size() < n) {
+    // 链断开时先放置当前循环中剩下的块, 使循环体内的块排在离开循环的块之前, 否则按原顺序继续
+    size_t seed = n;
+    int depth = func.blocks[order.back()].depth;
+    for(size_t b = 0; b < n && seed == n; ++b) {
+      if(placed[b] || func.blocks[b].depth < depth)
+        continue;
+      for(const medge_t &edge : preds[b])
+        if(placed[edge.target] && func.blocks[edge.target].depth >= depth)
+          seed = b;
+    }
+    if(seed == n)
+      for(seed = 0; placed[seed]; ++seed);
+    place_chain(seed);
+  }
+
+  // 按新顺序重建指令序列, 原来落入的后继不再紧跟时补上 j
+  std::vector<minst_t> insts;
+  std::vector<mblock_t> blocks;
+  for(size_t k = 0; k < n; ++k) {
+    size_t b = order[k];
+    blocks.push_back({func.blocks[b].label, insts.size(), func.blocks[b].depth});
+    insts.insert(insts.end(), func.insts.begin() + func.blocks[b].begin, func.insts.begin() + mblock_end(func, b));
+    if(falls_through(func, b) && (k + 1 == n || order[k + 1] != b + 1))
+      insts.push_back({MOP_J, REG_NONE, REG_NONE, REG_NONE, 0, func.blocks[b + 1].label});
+  }
+  func.insts.swap(insts);
+  func.blocks.swap(blocks);
+}
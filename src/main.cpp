@@ -6,6 +6,7 @@
 #include <cstring>
 #include "ast.hpp"
 #include "raw.hpp"
+#include "opt.hpp"
 
 using namespace std;
 
@@ -19,12 +20,18 @@ extern int yyparse(unique_ptr<BaseAST> &ast);
 
 int main(int argc, const char *argv[]) {
   // 解析命令行参数. 测试脚本/评测平台要求你的编译器能接收如下参数:
-  // compiler 模式 输入文件 -o 输出文件
-  assert(argc == 5);
+  // compiler 模式 输入文件 -o 输出文件 [优化选项...]
+  assert(argc >= 5);
   auto mode = argv[1];
   auto input = argv[2];
   auto output = argv[4];
   FILE *yyout;
+  for(int i = 5; i < argc; ++i) {
+    if(!parse_opt_option(argv[i])) {
+      std::cerr << "Error: Unknown option " << argv[i] << ".\n";
+      return 1;
+    }
+  }
 
   // 打开输入文件, 并且指定 lexer 在解析的时候读取这个文件
   yyin = fopen(input, "r");
@@ -35,7 +42,8 @@ int main(int argc, const char *argv[]) {
   auto ret = yyparse(ast);
   assert(!ret);
 
-  // 获取字符串形式的 Koopa IR
+  // 获取字符串形式的 Koopa IR, 优化时附带循环惯用法识别所用的运行时函数
+  runtime_routines = !strcmp(mode, "-perf") || !strcmp(mode, "-obj");
   std::string IR = ast->DumpIR();
   char* str = new char[IR.size() + 1];
   strcpy(str, IR.c_str());
@@ -51,7 +59,22 @@ int main(int argc, const char *argv[]) {
     yyout = freopen(output, "w", stdout);
     koopa_raw_program_builder_t builder = new_builder();
     koopa_raw_program_t raw = generate_raw(str, builder);
+    if(!strcmp(mode, "-perf"))
+      optimize_raw(raw);
+    Visit(raw);
+    fclose(yyout);
+    delete_builder(builder);
+  }
+  else if(!strcmp(mode, "-obj")) {
+    // 经过与 -perf 相同的优化, 直接输出 RV32IM 的 ELF 可重定位目标文件
+    yyout = freopen(output, "wb", stdout);
+    koopa_raw_program_builder_t builder = new_builder();
+    koopa_raw_program_t raw = generate_raw(str, builder);
+    optimize_raw(raw);
+    obj_output = true;
     Visit(raw);
+    write_obj(std::cout);
+    std::cout.flush();
     fclose(yyout);
     delete_builder(builder);
   }
@@ -0,0 +1,426 @@
+#include "koopa.h"
+#include "raw.hpp"
+#include "opt.hpp"
+#include <cassert>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+/** 值编号的状态, 沿支配树向下传递 */
+struct vn_state_t {
+  /** 纯表达式到最早计算出它的指令 */
+  std::unordered_map<std::string, koopa_raw_value_t> exprs;
+  /** 内存地址到其中当前保存的值, 以及该地址本身 */
+  std::unordered_map<std::string, std::pair<koopa_raw_value_t, koopa_raw_value_t> > mem;
+  /** 局部变量的版本号, 每次写入后更新 */
+  std::unordered_map<koopa_raw_value_t, int> version;
+  /** 汇合点处所有局部变量的版本号一并失效 */
+  int epoch;
+};
+
+/** 被替换的指令及替换成的值 */
+static std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> replaced;
+/** 待删除的指令 */
+static std::unordered_set<koopa_raw_value_t> removed;
+static std::unordered_map<koopa_raw_function_t, modref_t> *summary;
+/** 没有被任何函数写入的全局变量 */
+static std::unordered_set<koopa_raw_value_t> readonly_globals;
+static int version_id = 0;
+/** 同时跟踪的内存内容与未读 store 的数量上限, 避免大数组初始化时复杂度为平方级 */
+static const size_t max_tracked = 64;
+
+// 加入新的跟踪项, 超过上限时丢弃任意一项
+template<typename T>
+static void track(std::unordered_map<std::string, T> &table, const std::string &key, const T &item) {
+  if(table.size() >= max_tracked && !table.count(key))
+    table.erase(table.begin());
+  table[key] = item;
+}
+
+// 读取局部变量的 load, 后端不为其分配新的栈位置, 使用时才读取变量
+static bool is_var_load(koopa_raw_value_t value) {
+  return value->kind.tag == KOOPA_RVT_LOAD && value->kind.data.load.src->kind.tag == KOOPA_RVT_ALLOC;
+}
+
+// 值是否有独立的栈位置 (或为常量), 可以在之后任意位置代替其他值使用
+static bool is_stable(koopa_raw_value_t value) {
+  switch(value->kind.tag) {
+    case KOOPA_RVT_INTEGER:
+    case KOOPA_RVT_BINARY:
+    case KOOPA_RVT_CALL:
+    case KOOPA_RVT_GET_ELEM_PTR:
+    case KOOPA_RVT_GET_PTR:
+      return true;
+    case KOOPA_RVT_LOAD:
+      return !is_var_load(value);
+    default:
+      return false;
+  }
+}
+
+// 值编号用的键: 常量按值, 局部变量的读取按变量及版本, 其余按指令本身
+static std::string value_key(koopa_raw_value_t value, const vn_state_t &state) {
+  if(value->kind.tag == KOOPA_RVT_INTEGER)
+    return "#" + std::to_string(value->kind.data.integer.value);
+  if(is_var_load(value)) {
+    koopa_raw_value_t var = value->kind.data.load.src;
+    auto it = state.version.find(var);
+    std::string ver = it == state.version.end() ? "e" + std::to_string(state.epoch) : std::to_string(it->second);
+    return "L" + std::to_string((uintptr_t)var) + "." + ver;
+  }
+  return "v" + std::to_string((uintptr_t)value);
+}
+
+// 纯表达式的键, 可交换运算的操作数按序排列
+static std::string expr_key(koopa_raw_value_t inst, const vn_state_t &state) {
+  const auto &kind = inst->kind;
+  std::string lhs, rhs, op;
+  if(kind.tag == KOOPA_RVT_BINARY) {
+    lhs = value_key(kind.data.binary.lhs, state);
+    rhs = value_key(kind.data.binary.rhs, state);
+    op = std::to_string(kind.data.binary.op);
+    switch(kind.data.binary.op) {
+      case KOOPA_RBO_ADD: case KOOPA_RBO_MUL: case KOOPA_RBO_EQ: case KOOPA_RBO_NOT_EQ:
+      case KOOPA_RBO_AND: case KOOPA_RBO_OR: case KOOPA_RBO_XOR:
+        if(rhs < lhs)
+          std::swap(lhs, rhs);
+        break;
+      default:
+        break;
+    }
+  }
+  else if(kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
+    lhs = value_key(kind.data.get_elem_ptr.src, state);
+    rhs = value_key(kind.data.get_elem_ptr.index, state);
+    op = "E";
+  }
+  else {
+    lhs = value_key(kind.data.get_ptr.src, state);
+    rhs = value_key(kind.data.get_ptr.index, state);
+    op = "P";
+  }
+  return op + "(" + lhs + "," + rhs + ")";
+}
+
+// 计算两个常量的运算结果, 除零等未定义情况返回 false
+static bool fold_binary(koopa_raw_binary_op_t op, int lhs, int rhs, int &result) {
+  unsigned int l = lhs, r = rhs;
+  switch(op) {
+    case KOOPA_RBO_NOT_EQ: result = lhs != rhs; break;
+    case KOOPA_RBO_EQ: result = lhs == rhs; break;
+    case KOOPA_RBO_GT: result = lhs > rhs; break;
+    case KOOPA_RBO_LT: result = lhs < rhs; break;
+    case KOOPA_RBO_GE: result = lhs >= rhs; break;
+    case KOOPA_RBO_LE: result = lhs <= rhs; break;
+    case KOOPA_RBO_ADD: result = (int)(l + r); break;
+    case KOOPA_RBO_SUB: result = (int)(l - r); break;
+    case KOOPA_RBO_MUL: result = (int)(l * r); break;
+    case KOOPA_RBO_DIV:
+    case KOOPA_RBO_MOD:
+      if(rhs == 0 || (lhs == INT_MIN && rhs == -1))
+        return false;
+      result = op == KOOPA_RBO_DIV ? lhs / rhs : lhs % rhs;
+      break;
+    case KOOPA_RBO_AND: result = lhs & rhs; break;
+    case KOOPA_RBO_OR: result = lhs | rhs; break;
+    case KOOPA_RBO_XOR: result = lhs ^ rhs; break;
+    case KOOPA_RBO_SHL:
+    case KOOPA_RBO_SHR:
+    case KOOPA_RBO_SAR:
+      if(rhs < 0 || rhs > 31)
+        return false;
+      result = op == KOOPA_RBO_SHL ? (int)(l << rhs) : op == KOOPA_RBO_SHR ? (int)(l >> rhs) : lhs >> rhs;
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+// 读取只读全局变量在常量偏移处的初值
+static bool read_init(koopa_raw_value_t ptr, int &value) {
+  koopa_raw_value_t global;
+  long long offset;
+  if(!get_const_offset(ptr, global, offset) || !readonly_globals.count(global))
+    return false;
+  koopa_raw_value_t init = global->kind.data.global_alloc.init;
+  if(offset < 0 || offset % 4 != 0 || offset + 4 > (long long)calc_size(init->ty))
+    return false;
+  while(init->kind.tag == KOOPA_RVT_AGGREGATE) {
+    size_t elem_size = calc_size(init->ty->data.array.base);
+    init = reinterpret_cast<koopa_raw_value_t>(init->kind.data.aggregate.elems.buffer[offset / elem_size]);
+    offset %= elem_size;
+  }
+  if(init->kind.tag == KOOPA_RVT_ZERO_INIT)
+    value = 0;
+  else if(init->kind.tag == KOOPA_RVT_INTEGER)
+    value = init->kind.data.integer.value;
+  else
+    return false;
+  return true;
+}
+
+// 用 to 代替 inst 并删除 inst
+static void replace_inst(koopa_raw_value_t inst, koopa_raw_value_t to) {
+  replaced[inst] = to;
+  removed.insert(inst);
+}
+
+// 对基本块做值编号: 常量折叠, 公共子表达式消除, 冗余 load 消除, 块内死 store 消除
+static void number_block(const cfg_t &cfg, int b, bool is_main, vn_state_t &state) {
+  // 写入后未被读取的 store
+  std::unordered_map<std::string, koopa_raw_value_t> pending;
+  for(koopa_raw_value_t inst : get_insts(cfg.bbs[b])) {
+    for(koopa_raw_value_t *operand : get_operands(inst)) {
+      auto it = replaced.find(*operand);
+      if(it != replaced.end())
+        *operand = it->second;
+      // 使用读取局部变量的值时才真正读取该变量
+      if(is_var_load(*operand))
+        pending.erase(value_key((*operand)->kind.data.load.src, state));
+    }
+    auto &kind = inst->kind;
+    switch(kind.tag) {
+      case KOOPA_RVT_BINARY: {
+        const auto &binary = kind.data.binary;
+        int result;
+        if(binary.lhs->kind.tag == KOOPA_RVT_INTEGER && binary.rhs->kind.tag == KOOPA_RVT_INTEGER &&
+           fold_binary(binary.op, binary.lhs->kind.data.integer.value, binary.rhs->kind.data.integer.value, result)) {
+          replace_inst(inst, new_integer(result));
+          break;
+        }
+      }
+      // fallthrough
+      case KOOPA_RVT_GET_ELEM_PTR:
+      case KOOPA_RVT_GET_PTR: {
+        std::string key = expr_key(inst, state);
+        auto it = state.exprs.find(key);
+        if(it != state.exprs.end())
+          replace_inst(inst, it->second);
+        else
+          state.exprs[key] = inst;
+        break;
+      }
+      case KOOPA_RVT_LOAD: {
+        koopa_raw_value_t src = kind.data.load.src;
+        if(is_var_load(inst)) {
+          pending.erase(value_key(src, state));
+          break;
+        }
+        int init;
+        if(read_init(src, init)) {
+          replace_inst(inst, new_integer(init));
+          break;
+        }
+        std::string key = value_key(src, state);
+        auto it = state.mem.find(key);
+        if(it != state.mem.end()) {
+          replace_inst(inst, it->second.first);
+          break;
+        }
+        track(state.mem, key, {inst, src});
+        for(auto p = pending.begin(); p != pending.end();) {
+          if(may_alias(p->second->kind.data.store.dest, src))
+            p = pending.erase(p);
+          else
+            ++p;
+        }
+        break;
+      }
+      case KOOPA_RVT_STORE: {
+        koopa_raw_value_t value = kind.data.store.value, dest = kind.data.store.dest;
+        std::string key = value_key(dest, state);
+        auto it = pending.find(key);
+        if(it != pending.end())
+          removed.insert(it->second);
+        track(pending, key, inst);
+        if(dest->kind.tag == KOOPA_RVT_ALLOC) {
+          state.version[dest] = ++version_id;
+          break;
+        }
+        for(auto m = state.mem.begin(); m != state.mem.end();) {
+          if(may_alias(m->second.second, dest))
+            m = state.mem.erase(m);
+          else
+            ++m;
+        }
+        if(is_stable(value))
+          track(state.mem, key, {value, dest});
+        break;
+      }
+      case KOOPA_RVT_CALL: {
+        const modref_t &callee = (*summary)[kind.data.call.callee];
+        for(auto m = state.mem.begin(); m != state.mem.end();) {
+          if(call_may_access(inst, m->second.second, callee, true))
+            m = state.mem.erase(m);
+          else
+            ++m;
+        }
+        for(auto p = pending.begin(); p != pending.end();) {
+          koopa_raw_value_t dest = p->second->kind.data.store.dest;
+          if(dest->kind.tag != KOOPA_RVT_ALLOC && call_may_access(inst, dest, callee, false))
+            p = pending.erase(p);
+          else
+            ++p;
+        }
+        break;
+      }
+      case KOOPA_RVT_RETURN:
+        // 返回后局部变量不再可见, main 返回后全局变量也不再被读取
+        for(auto &p : pending) {
+          koopa_raw_value_t base = mem_base(p.second->kind.data.store.dest);
+          if(base != nullptr && (base->kind.tag == KOOPA_RVT_ALLOC ||
+                                 (is_main && base->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)))
+            removed.insert(p.second);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+// 沿支配树遍历, 只有唯一前驱的基本块继承前驱的内存状态
+static void number_tree(const cfg_t &cfg, const std::vector<std::vector<int> > &children, int b, bool is_main,
+                        vn_state_t state) {
+  if(cfg.preds[b].size() != 1) {
+    state.mem.clear();
+    state.version.clear();
+    state.epoch = ++version_id;
+  }
+  number_block(cfg, b, is_main, state);
+  for(size_t i = 0; i < children[b].size(); ++i) {
+    if(i + 1 == children[b].size())
+      number_tree(cfg, children, children[b][i], is_main, std::move(state));
+    else
+      number_tree(cfg, children, children[b][i], is_main, state);
+  }
+}
+
+// 删除从未被读取的局部变量 / 局部数组的所有 store
+static void remove_unread_stores(const std::vector<koopa_raw_basic_block_t> &bbs) {
+  std::unordered_set<koopa_raw_value_t> read;
+  bool unknown = false;
+  auto mark = [&](koopa_raw_value_t ptr) {
+    koopa_raw_value_t base = mem_base(ptr);
+    if(base == nullptr)
+      unknown = true;
+    else
+      read.insert(base);
+  };
+  for(koopa_raw_basic_block_t bb : bbs) {
+    for(koopa_raw_value_t inst : get_insts(bb)) {
+      if(removed.count(inst))
+        continue;
+      if(inst->kind.tag == KOOPA_RVT_LOAD)
+        mark(inst->kind.data.load.src);
+      else if(inst->kind.tag == KOOPA_RVT_CALL || inst->kind.tag == KOOPA_RVT_STORE) {
+        for(koopa_raw_value_t *operand : get_operands(inst))
+          if((*operand)->ty->tag == KOOPA_RTT_POINTER && operand != &inst->kind.data.store.dest)
+            mark(*operand);
+      }
+    }
+  }
+  for(koopa_raw_basic_block_t bb : bbs) {
+    for(koopa_raw_value_t inst : get_insts(bb)) {
+      if(inst->kind.tag != KOOPA_RVT_STORE)
+        continue;
+      koopa_raw_value_t base = mem_base(inst->kind.data.store.dest);
+      if(base == nullptr || base->kind.tag != KOOPA_RVT_ALLOC || read.count(base))
+        continue;
+      // 标量变量的地址不会被取出, 只能被直接读取
+      if(base->ty->data.pointer.base->tag != KOOPA_RTT_ARRAY || !unknown)
+        removed.insert(inst);
+    }
+  }
+}
+
+// 删除结果未被使用的无副作用指令
+static void remove_dead_code(const std::vector<koopa_raw_basic_block_t> &bbs) {
+  std::unordered_map<koopa_raw_value_t, int> uses;
+  for(koopa_raw_basic_block_t bb : bbs)
+    for(koopa_raw_value_t inst : get_insts(bb))
+      if(!removed.count(inst))
+        for(koopa_raw_value_t *operand : get_operands(inst))
+          uses[*operand]++;
+  std::vector<koopa_raw_value_t> work;
+  for(koopa_raw_basic_block_t bb : bbs)
+    for(koopa_raw_value_t inst : get_insts(bb))
+      work.push_back(inst);
+  while(!work.empty()) {
+    koopa_raw_value_t inst = work.back();
+    work.pop_back();
+    if(removed.count(inst) || uses[inst] != 0)
+      continue;
+    switch(inst->kind.tag) {
+      case KOOPA_RVT_BINARY:
+      case KOOPA_RVT_LOAD:
+      case KOOPA_RVT_GET_ELEM_PTR:
+      case KOOPA_RVT_GET_PTR:
+      case KOOPA_RVT_ALLOC:
+        break;
+      default:
+        continue;
+    }
+    removed.insert(inst);
+    for(koopa_raw_value_t *operand : get_operands(inst)) {
+      if(--uses[*operand] == 0)
+        work.push_back(*operand);
+    }
+  }
+}
+
+// 对函数做基于支配树的值编号及冗余访存消除
+static void eliminate_redundant_accesses(koopa_raw_function_t func) {
+  cfg_t cfg = build_cfg(func);
+  init_alias(func);
+  replaced.clear();
+  removed.clear();
+  std::vector<std::vector<int> > children(cfg.bbs.size());
+  for(int b : cfg.rpo)
+    if(cfg.idom[b] != -1)
+      children[cfg.idom[b]].push_back(b);
+  vn_state_t state;
+  state.epoch = ++version_id;
+  number_tree(cfg, children, 0, strcmp(func->name, "@main") == 0, state);
+
+  // 不可达的基本块中也可能使用被替换的指令
+  for(koopa_raw_basic_block_t bb : cfg.bbs) {
+    for(koopa_raw_value_t inst : get_insts(bb)) {
+      for(koopa_raw_value_t *operand : get_operands(inst)) {
+        auto it = replaced.find(*operand);
+        if(it != replaced.end())
+          *operand = it->second;
+      }
+    }
+  }
+  remove_unread_stores(cfg.bbs);
+  remove_dead_code(cfg.bbs);
+  for(koopa_raw_basic_block_t bb : cfg.bbs) {
+    std::vector<koopa_raw_value_t> insts = get_insts(bb);
+    insts.erase(std::remove_if(insts.begin(), insts.end(),
+                               [](koopa_raw_value_t inst) { return removed.count(inst) != 0; }), insts.end());
+    set_insts(bb, insts);
+  }
+}
+
+// 对所有函数消除冗余的 load 与无用的 store
+void eliminate_redundant_accesses(koopa_raw_program_t &program) {
+  std::unordered_map<koopa_raw_function_t, modref_t> info = compute_modref(program);
+  summary = &info;
+  readonly_globals.clear();
+  for(size_t i = 0; i < program.values.len; ++i)
+    readonly_globals.insert(reinterpret_cast<koopa_raw_value_t>(program.values.buffer[i]));
+  for(auto &entry : info)
+    for(koopa_raw_value_t global : entry.second.mod)
+      readonly_globals.erase(global);
+  init_alias(program);
+  for(size_t i = 0; i < program.funcs.len; ++i) {
+    koopa_raw_function_t func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    if(func->bbs.len != 0)
+      eliminate_redundant_accesses(func);
+  }
+  summary = nullptr;
+}
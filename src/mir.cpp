@@ -0,0 +1,317 @@
+#include "mir.hpp"
+#include "opt.hpp"
+#include <cassert>
+#include <iostream>
+
+/** 寄存器的 ABI 名称, 按编号排列 */
+static const char *reg_name[] = {
+  "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+  "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+  "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+  "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
+};
+
+/** 操作码的助记符, 按 mop_t 排列 */
+static const char *op_name[] = {
+  "nop",
+  "li", "la", "mv", "lw", "sw",
+  "add", "sub", "mul", "div", "rem", "and", "or", "xor", "slt", "sgt",
+  "sh1add", "sh2add", "sh3add", "min", "max",
+  "czero.eqz", "czero.nez",
+  "seqz", "snez",
+  "addi", "andi", "ori", "xori", "slti", "sltiu", "slli",
+  "beqz", "bnez", "j", "call", "tail", "ret", "jr"
+};
+
+// 取得标号或符号的下标, 第一次出现时加入符号表
+int intern_sym(mfunc_t &func, const std::string &sym) {
+  auto it = func.sym_id.find(sym);
+  if(it != func.sym_id.end())
+    return it->second;
+  func.syms.push_back(sym);
+  return func.sym_id[sym] = func.syms.size() - 1;
+}
+
+// 第 b 个基本块的指令结束位置
+size_t mblock_end(const mfunc_t &func, size_t b) {
+  return b + 1 < func.blocks.size() ? func.blocks[b + 1].begin : func.insts.size();
+}
+
+// 移除已删除的指令, 并更新各基本块的起始位置
+void compact(mfunc_t &func) {
+  size_t n = 0, b = 0;
+  for(size_t i = 0; i < func.insts.size(); ++i) {
+    while(b < func.blocks.size() && func.blocks[b].begin == i)
+      func.blocks[b++].begin = n;
+    if(func.insts[i].op != MOP_NOP)
+      func.insts[n++] = func.insts[i];
+  }
+  while(b < func.blocks.size())
+    func.blocks[b++].begin = n;
+  func.insts.resize(n);
+}
+
+bool is_branch(mop_t op) {
+  return op == MOP_BEQZ || op == MOP_BNEZ;
+}
+
+// 无条件离开当前位置的指令, 其后直到下一个基本块的指令不可达
+bool is_exit(mop_t op) {
+  return op == MOP_J || op == MOP_TAIL || op == MOP_RET || op == MOP_JR;
+}
+
+// 跳转指令可能到达的函数内标号, jr 为其跳转表中的所有标号
+std::vector<int> jump_targets(const mfunc_t &func, const minst_t &inst) {
+  if(inst.op == MOP_J || is_branch(inst.op))
+    return {inst.sym};
+  if(inst.op == MOP_JR)
+    return func.tables[inst.imm].labels;
+  return {};
+}
+
+// 指令是否以 imm 为第二个源操作数 (li, lw, sw 除外)
+bool has_imm(mop_t op) {
+  return op >= MOP_ADDI && op <= MOP_SLLI;
+}
+
+/** 16 位指令的助记符, 按 cop_t 排列 */
+static const char *cop_name[] = {
+  "",
+  "c.li", "c.mv", "c.lw", "c.lwsp", "c.sw", "c.swsp",
+  "c.add", "c.sub", "c.and", "c.or", "c.xor",
+  "c.addi", "c.addi16sp", "c.addi4spn", "c.andi", "c.slli", "c.jr"
+};
+
+// 寄存器能否用 C 扩展中的 3 位编码表示, 即 x8 - x15
+bool is_creg(reg_t reg) {
+  return reg >= REG_S0 && reg <= REG_A5;
+}
+
+static bool fits_imm6(int imm) {
+  return imm >= -32 && imm <= 31;
+}
+
+// 选出非跳转指令在 C 扩展中的 16 位形式, 操作数不满足要求时返回 COP_NONE
+cop_t compress(const minst_t &inst) {
+  switch(inst.op) {
+    case MOP_LI:
+      return inst.rd != REG_ZERO && fits_imm6(inst.imm) ? COP_LI : COP_NONE;
+    case MOP_MV:
+      return inst.rd != REG_ZERO && inst.rs1 != REG_ZERO ? COP_MV : COP_NONE;
+    case MOP_LW:
+      if(inst.imm % 4 != 0 || inst.imm < 0)
+        return COP_NONE;
+      if(inst.rs1 == REG_SP)
+        return inst.rd != REG_ZERO && inst.imm <= 252 ? COP_LWSP : COP_NONE;
+      return is_creg(inst.rd) && is_creg(inst.rs1) && inst.imm <= 124 ? COP_LW : COP_NONE;
+    case MOP_SW:
+      if(inst.imm % 4 != 0 || inst.imm < 0)
+        return COP_NONE;
+      if(inst.rs1 == REG_SP)
+        return inst.imm <= 252 ? COP_SWSP : COP_NONE;
+      return is_creg(inst.rs2) && is_creg(inst.rs1) && inst.imm <= 124 ? COP_SW : COP_NONE;
+    // 双操作数形式要求目标与一个源操作数相同, 可交换的运算两个源操作数均可
+    case MOP_ADD:
+      if(inst.rd != REG_ZERO && inst.rs1 != REG_ZERO && inst.rs2 == REG_ZERO)
+        return COP_MV;
+      return inst.rd != REG_ZERO && inst.rs1 != REG_ZERO && inst.rs2 != REG_ZERO &&
+             (inst.rd == inst.rs1 || inst.rd == inst.rs2) ? COP_ADD : COP_NONE;
+    case MOP_SUB:
+      return is_creg(inst.rd) && inst.rd == inst.rs1 && is_creg(inst.rs2) ? COP_SUB : COP_NONE;
+    case MOP_AND:
+    case MOP_OR:
+    case MOP_XOR:
+      if(!is_creg(inst.rd) || !((inst.rd == inst.rs1 && is_creg(inst.rs2)) || (inst.rd == inst.rs2 && is_creg(inst.rs1))))
+        return COP_NONE;
+      return inst.op == MOP_AND ? COP_AND : inst.op == MOP_OR ? COP_OR : COP_XOR;
+    case MOP_ADDI:
+      if(inst.rd == REG_SP && inst.rs1 == REG_SP && inst.imm != 0 && inst.imm % 16 == 0 && inst.imm >= -512 && inst.imm <= 496)
+        return COP_ADDI16SP;
+      if(inst.rs1 == REG_SP && is_creg(inst.rd) && inst.imm > 0 && inst.imm % 4 == 0 && inst.imm <= 1020)
+        return COP_ADDI4SPN;
+      return inst.rd != REG_ZERO && inst.rd == inst.rs1 && inst.imm != 0 && fits_imm6(inst.imm) ? COP_ADDI : COP_NONE;
+    case MOP_ANDI:
+      return is_creg(inst.rd) && inst.rd == inst.rs1 && fits_imm6(inst.imm) ? COP_ANDI : COP_NONE;
+    case MOP_SLLI:
+      return inst.rd != REG_ZERO && inst.rd == inst.rs1 && (inst.imm & 31) != 0 ? COP_SLLI : COP_NONE;
+    case MOP_RET:
+    case MOP_JR:
+      return COP_JR;
+    default:
+      return COP_NONE;
+  }
+}
+
+static uint32_t reg_bit(reg_t reg) {
+  return reg == REG_NONE || reg == REG_ZERO ? 0 : 1u << reg;
+}
+
+// 寄存器 first 起的 num 个寄存器的集合
+static uint32_t reg_range(reg_t first, int num) {
+  uint32_t set = 0;
+  for(int k = 0; k < num; ++k)
+    set |= reg_bit(reg_t(first + k));
+  return set;
+}
+
+/** 调用前后需保持不变的寄存器: sp 与 s0 - s11 */
+static const uint32_t preserved = reg_bit(REG_SP) | reg_range(REG_S0, 2) | reg_range(REG_S2, 10);
+
+// 指令读取的寄存器集合, 调用与返回按调用约定读取参数, 返回值与被调用者保存寄存器
+uint32_t inst_uses(const minst_t &inst) {
+  switch(inst.op) {
+    case MOP_NOP:
+    case MOP_J:
+      return 0;
+    case MOP_CALL:
+      return reg_range(REG_A0, inst.imm) | reg_bit(REG_SP);
+    case MOP_TAIL:
+      return reg_range(REG_A0, inst.imm) | reg_bit(REG_RA) | preserved;
+    case MOP_RET:
+      return reg_bit(REG_A0) | reg_bit(REG_RA) | preserved;
+    default:
+      return reg_bit(inst.rs1) | reg_bit(inst.rs2);
+  }
+}
+
+// 指令写入的寄存器集合, 调用写入所有调用者保存寄存器
+uint32_t inst_defs(const minst_t &inst) {
+  switch(inst.op) {
+    case MOP_NOP:
+    case MOP_SW:
+    case MOP_J:
+    case MOP_TAIL:
+    case MOP_RET:
+      return 0;
+    case MOP_CALL:
+      return reg_bit(REG_RA) | reg_range(REG_T0, 3) | reg_range(REG_A0, 8) | reg_range(REG_T3, 4);
+    default:
+      return reg_bit(inst.rd);
+  }
+}
+
+// 求每个基本块入口处活跃的寄存器集合
+std::vector<uint32_t> live_in(const mfunc_t &func) {
+  size_t n = func.blocks.size();
+  std::unordered_map<int, size_t> label_block;
+  for(size_t b = 0; b < n; ++b)
+    label_block[func.blocks[b].label] = b;
+  std::vector<uint32_t> live(n, 0);
+  bool changed = true;
+  while(changed) {
+    changed = false;
+    for(size_t b = n; b-- > 0;) {
+      // 块尾之后落入下一个基本块, 遇到跳转时加上目标入口的活跃寄存器
+      uint32_t set = b + 1 < n ? live[b + 1] : 0;
+      for(size_t i = mblock_end(func, b); i-- > func.blocks[b].begin;) {
+        const minst_t &inst = func.insts[i];
+        if(is_exit(inst.op))
+          set = 0;
+        for(int label : jump_targets(func, inst))
+          set |= live[label_block.at(label)];
+        set = (set & ~inst_defs(inst)) | inst_uses(inst);
+      }
+      if(set != live[b]) {
+        live[b] = set;
+        changed = true;
+      }
+    }
+  }
+  return live;
+}
+
+// 以 C 扩展的助记符输出指令, 双操作数形式省略与目标相同的源操作数
+static void print_compressed(const minst_t &inst, cop_t cop) {
+  std::cout << "\t" << cop_name[cop] << " ";
+  switch(cop) {
+    case COP_LW:
+    case COP_LWSP:
+      std::cout << reg_name[inst.rd] << ", " << inst.imm << "(" << reg_name[inst.rs1] << ")\n";
+      break;
+    case COP_SW:
+    case COP_SWSP:
+      std::cout << reg_name[inst.rs2] << ", " << inst.imm << "(" << reg_name[inst.rs1] << ")\n";
+      break;
+    case COP_MV:
+      std::cout << reg_name[inst.rd] << ", " << reg_name[inst.rs1] << std::endl;
+      break;
+    case COP_ADD:
+    case COP_SUB:
+    case COP_AND:
+    case COP_OR:
+    case COP_XOR:
+      std::cout << reg_name[inst.rd] << ", " << reg_name[inst.rd == inst.rs1 ? inst.rs2 : inst.rs1] << std::endl;
+      break;
+    case COP_ADDI4SPN:
+      std::cout << reg_name[inst.rd] << ", sp, " << inst.imm << std::endl;
+      break;
+    case COP_JR:
+      std::cout << reg_name[inst.op == MOP_RET ? REG_RA : inst.rs1] << "\n\n";
+      break;
+    default:
+      std::cout << reg_name[inst.rd] << ", " << inst.imm << std::endl;
+  }
+}
+
+// 以汇编文本输出函数的机器代码
+void print_func(const mfunc_t &func) {
+  for(size_t b = 0; b < func.blocks.size(); ++b) {
+    std::cout << func.syms[func.blocks[b].label] << ":\n";
+    for(size_t i = func.blocks[b].begin; i < mblock_end(func, b); ++i) {
+      const minst_t &inst = func.insts[i];
+      const char *op = op_name[inst.op];
+      cop_t cop = opt_options.rvc ? compress(inst) : COP_NONE;
+      if(cop != COP_NONE) {
+        print_compressed(inst, cop);
+        continue;
+      }
+      switch(inst.op) {
+        case MOP_NOP:
+          break;
+        case MOP_LI:
+          std::cout << "\tli " << reg_name[inst.rd] << ", " << inst.imm << std::endl;
+          break;
+        case MOP_LA:
+          std::cout << "\tla " << reg_name[inst.rd] << ", " << func.syms[inst.sym] << std::endl;
+          break;
+        case MOP_LW:
+          std::cout << "\tlw " << reg_name[inst.rd] << ", " << inst.imm << "(" << reg_name[inst.rs1] << ")\n";
+          break;
+        case MOP_SW:
+          std::cout << "\tsw " << reg_name[inst.rs2] << ", " << inst.imm << "(" << reg_name[inst.rs1] << ")\n";
+          break;
+        case MOP_BEQZ:
+        case MOP_BNEZ:
+          std::cout << "\t" << op << " " << reg_name[inst.rs1] << ", " << func.syms[inst.sym] << std::endl;
+          break;
+        case MOP_J:
+        case MOP_CALL:
+          std::cout << "\t" << op << " " << func.syms[inst.sym] << std::endl;
+          break;
+        // 函数出口后空一行
+        case MOP_TAIL:
+          std::cout << "\ttail " << func.syms[inst.sym] << "\n\n";
+          break;
+        case MOP_RET:
+          std::cout << "\tret\n\n";
+          break;
+        case MOP_JR:
+          std::cout << "\tjr " << reg_name[inst.rs1] << "\n\n";
+          break;
+        default:
+          std::cout << "\t" << op << " " << reg_name[inst.rd] << ", " << reg_name[inst.rs1];
+          if(has_imm(inst.op))
+            std::cout << ", " << inst.imm;
+          else if(inst.rs2 != REG_NONE)
+            std::cout << ", " << reg_name[inst.rs2];
+          std::cout << std::endl;
+      }
+    }
+  }
+  // 跳转表放在只读数据段, 之后的函数由 .text 切换回代码段
+  for(const mtable_t &table : func.tables) {
+    std::cout << "\t.section .rodata\n\t.p2align 2\n" << func.syms[table.sym] << ":\n";
+    for(int label : table.labels)
+      std::cout << "\t.word " << func.syms[label] << std::endl;
+  }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/** RISC-V 整数寄存器, 按编码顺序编号 */
+enum reg_t : int8_t {
+  REG_NONE = -1,
+  REG_ZERO, REG_RA, REG_SP, REG_GP, REG_TP, REG_T0, REG_T1, REG_T2,
+  REG_S0, REG_S1, REG_A0, REG_A1, REG_A2, REG_A3, REG_A4, REG_A5,
+  REG_A6, REG_A7, REG_S2, REG_S3, REG_S4, REG_S5, REG_S6, REG_S7,
+  REG_S8, REG_S9, REG_S10, REG_S11, REG_T3, REG_T4, REG_T5, REG_T6
+};
+
+/** 机器指令的操作码 */
+enum mop_t : uint8_t {
+  /** 已删除的指令, 由 compact 移除 */
+  MOP_NOP,
+  MOP_LI, MOP_LA, MOP_MV, MOP_LW, MOP_SW,
+  MOP_ADD, MOP_SUB, MOP_MUL, MOP_DIV, MOP_REM, MOP_AND, MOP_OR, MOP_XOR, MOP_SLT, MOP_SGT,
+  /** Zba 的移位相加 (rd = (rs1 << n) + rs2) 与 Zbb 的有符号最小 / 最大值 */
+  MOP_SH1ADD, MOP_SH2ADD, MOP_SH3ADD, MOP_MIN, MOP_MAX,
+  /** Zicond 的条件清零: rs2 为 0 / 不为 0 时 rd = 0, 否则 rd = rs1 */
+  MOP_CZERO_EQZ, MOP_CZERO_NEZ,
+  MOP_SEQZ, MOP_SNEZ,
+  MOP_ADDI, MOP_ANDI, MOP_ORI, MOP_XORI, MOP_SLTI, MOP_SLTIU, MOP_SLLI,
+  MOP_BEQZ, MOP_BNEZ, MOP_J, MOP_CALL, MOP_TAIL, MOP_RET,
+  /** 经跳转表的间接跳转, imm 为 mfunc_t::tables 中的下标 */
+  MOP_JR
+};
+
+/** 机器指令, 不使用的寄存器为 REG_NONE, sw 写出的寄存器记在 rs2 中, call 与 tail 的 imm 为寄存器参数个数 */
+struct minst_t {
+  mop_t op;
+  reg_t rd, rs1, rs2;
+  int imm;
+  /** la, 跳转与调用的标号或符号在 mfunc_t::syms 中的下标 */
+  int sym;
+};
+
+/** 机器基本块: 以标号开始, 包含 insts 中从 begin 到下一个块的 begin 之间的指令 */
+struct mblock_t {
+  int label;
+  size_t begin;
+  /** 所在 Koopa 基本块的循环嵌套深度, 用于估计执行频率 */
+  int depth;
+};
+
+/** 只读数据段中的跳转表: 符号 sym 处依次存放各标号的地址 */
+struct mtable_t {
+  int sym;
+  std::vector<int> labels;
+};
+
+/** 一个函数的机器代码, 所有基本块的指令连续存放在 insts 中 */
+struct mfunc_t {
+  std::string name;
+  std::vector<minst_t> insts;
+  std::vector<mblock_t> blocks;
+  std::vector<std::string> syms;
+  std::unordered_map<std::string, int> sym_id;
+  std::vector<mtable_t> tables;
+};
+
+/** C 扩展的 16 位指令形式, 跳转的形式取决于布局, 不在其中 */
+enum cop_t : uint8_t {
+  COP_NONE,
+  COP_LI, COP_MV, COP_LW, COP_LWSP, COP_SW, COP_SWSP,
+  COP_ADD, COP_SUB, COP_AND, COP_OR, COP_XOR,
+  COP_ADDI, COP_ADDI16SP, COP_ADDI4SPN, COP_ANDI, COP_SLLI, COP_JR
+};
+
+/** 目标文件中存放代码与全局变量的节 */
+enum msec_t { SEC_TEXT, SEC_DATA, SEC_BSS, SEC_RODATA, SEC_NUM };
+
+int intern_sym(mfunc_t &func, const std::string &sym);
+size_t mblock_end(const mfunc_t &func, size_t b);
+void compact(mfunc_t &func);
+bool is_branch(mop_t op);
+bool is_exit(mop_t op);
+std::vector<int> jump_targets(const mfunc_t &func, const minst_t &inst);
+bool has_imm(mop_t op);
+bool is_creg(reg_t reg);
+cop_t compress(const minst_t &inst);
+uint32_t inst_uses(const minst_t &inst);
+uint32_t inst_defs(const minst_t &inst);
+std::vector<uint32_t> live_in(const mfunc_t &func);
+void print_func(const mfunc_t &func);
+void peephole(mfunc_t &func);
+void if_convert(mfunc_t &func);
+void layout_blocks(mfunc_t &func);
+void schedule(mfunc_t &func);
+void obj_func(const mfunc_t &func);
+void obj_data(msec_t sec, const std::string &name, const std::vector<int> &words, size_t size);
+void write_obj(std::ostream &os);
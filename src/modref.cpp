@@ -0,0 +1,80 @@
+#include "koopa.h"
+#include "opt.hpp"
+#include <cassert>
+#include <unordered_map>
+#include <unordered_set>
+
+// 记录地址所基于的全局变量, 无法确定基对象时记录所有全局变量
+static void add_global(koopa_raw_value_t ptr, const std::vector<koopa_raw_value_t> &globals,
+                       std::unordered_set<koopa_raw_value_t> &set) {
+  koopa_raw_value_t base = mem_base(ptr);
+  if(base == nullptr)
+    set.insert(globals.begin(), globals.end());
+  else if(base->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
+    set.insert(base);
+}
+
+// 计算每个函数 (包括其调用的函数) 直接读写的全局变量
+// 通过指针参数访问的内存不计入, 由调用点的实参体现
+std::unordered_map<koopa_raw_function_t, modref_t> compute_modref(const koopa_raw_program_t &program) {
+  std::unordered_map<koopa_raw_function_t, modref_t> summary;
+  std::unordered_map<koopa_raw_function_t, std::vector<koopa_raw_function_t> > callees;
+  std::vector<koopa_raw_function_t> funcs;
+  std::vector<koopa_raw_value_t> globals;
+  for(size_t i = 0; i < program.values.len; ++i)
+    globals.push_back(reinterpret_cast<koopa_raw_value_t>(program.values.buffer[i]));
+  for(size_t i = 0; i < program.funcs.len; ++i) {
+    koopa_raw_function_t func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    modref_t &info = summary[func];
+    funcs.push_back(func);
+    init_alias(func);
+    for(koopa_raw_basic_block_t bb : get_bbs(func)) {
+      for(koopa_raw_value_t inst : get_insts(bb)) {
+        switch(inst->kind.tag) {
+          case KOOPA_RVT_LOAD:
+            add_global(inst->kind.data.load.src, globals, info.ref);
+            break;
+          case KOOPA_RVT_STORE:
+            add_global(inst->kind.data.store.dest, globals, info.mod);
+            break;
+          case KOOPA_RVT_CALL:
+            callees[func].push_back(inst->kind.data.call.callee);
+            break;
+          default:
+            break;
+        }
+        // 作为实参传出的全局数组可能被读写
+        if(inst->kind.tag == KOOPA_RVT_CALL) {
+          const koopa_raw_slice_t &args = inst->kind.data.call.args;
+          for(size_t j = 0; j < args.len; ++j) {
+            koopa_raw_value_t arg = reinterpret_cast<koopa_raw_value_t>(args.buffer[j]);
+            if(arg->ty->tag == KOOPA_RTT_POINTER) {
+              add_global(arg, globals, info.ref);
+              add_global(arg, globals, info.mod);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // 沿调用图传播直到不动点
+  bool changed = true;
+  while(changed) {
+    changed = false;
+    for(koopa_raw_function_t func : funcs) {
+      modref_t &info = summary[func];
+      size_t size = info.mod.size() + info.ref.size();
+      for(koopa_raw_function_t callee : callees[func]) {
+        if(callee == func)
+          continue;
+        const modref_t &other = summary[callee];
+        info.mod.insert(other.mod.begin(), other.mod.end());
+        info.ref.insert(other.ref.begin(), other.ref.end());
+      }
+      if(info.mod.size() + info.ref.size() != size)
+        changed = true;
+    }
+  }
+  return summary;
+}
@@ -0,0 +1,508 @@
+#include "koopa.h"
+#include "opt.hpp"
+#include <cassert>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+
+opt_options_t opt_options = {
+  48,     // inline_threshold
+  3000,   // inline_caller_limit
+  4,      // unroll_factor
+  256,    // unroll_size_limit
+  3,      // load_latency
+  3,      // mul_latency
+  20,     // div_latency
+  false,  // rvc
+  false,  // zba
+  false,  // zbb
+  false,  // zicond
+  3       // branch_cost
+};
+
+/** 新建基本块的编号, 保证生成的标号全局唯一 */
+static unsigned int label_id = 0;
+
+// 解析 -march=rv32imc_zba_zbb 形式的目标指令集, 基本指令集 rv32i 之后为单字母扩展, 其后为以 _ 分隔的多字母扩展
+static bool parse_march(const std::string &arch) {
+  if(arch.compare(0, 5, "rv32i") != 0)
+    return false;
+  opt_options.rvc = opt_options.zba = opt_options.zbb = opt_options.zicond = false;
+  size_t i = 5;
+  for(; i < arch.size() && arch[i] != '_'; ++i) {
+    if(arch[i] == 'c')
+      opt_options.rvc = true;
+    else if(!strchr("mafd", arch[i]))
+      return false;
+  }
+  while(i < arch.size()) {
+    size_t next = arch.find('_', i + 1);
+    std::string ext = arch.substr(i + 1, next == std::string::npos ? std::string::npos : next - i - 1);
+    if(ext == "zba")
+      opt_options.zba = true;
+    else if(ext == "zbb")
+      opt_options.zbb = true;
+    else if(ext == "zicond")
+      opt_options.zicond = true;
+    else
+      return false;
+    i = next == std::string::npos ? arch.size() : next;
+  }
+  return true;
+}
+
+// 解析 -perf 模式下的优化参数, 形如 -inline-threshold=64
+bool parse_opt_option(const char *arg) {
+  const char *eq = strchr(arg, '=');
+  if(eq == nullptr)
+    return false;
+  std::string key(arg, eq - arg);
+  if(key == "-march")
+    return parse_march(eq + 1);
+  int value = atoi(eq + 1);
+  if(key == "-inline-threshold")
+    opt_options.inline_threshold = value;
+  else if(key == "-inline-caller-limit")
+    opt_options.inline_caller_limit = value;
+  else if(key == "-unroll-factor")
+    opt_options.unroll_factor = std::max(value, 1);
+  else if(key == "-unroll-size-limit")
+    opt_options.unroll_size_limit = value;
+  else if(key == "-load-latency")
+    opt_options.load_latency = std::max(value, 1);
+  else if(key == "-mul-latency")
+    opt_options.mul_latency = std::max(value, 1);
+  else if(key == "-div-latency")
+    opt_options.div_latency = std::max(value, 1);
+  else if(key == "-branch-cost")
+    opt_options.branch_cost = std::max(value, 0);
+  else
+    return false;
+  return true;
+}
+
+// 对 raw program 执行所有优化
+void optimize_raw(koopa_raw_program_t &program) {
+  eliminate_tail_recursion(program);
+  inline_functions(program);
+  recognize_loop_idioms(program);
+  promote_globals(program);
+  eliminate_redundant_accesses(program);
+  reduce_induction_variables(program);
+  unroll_loops(program);
+  eliminate_redundant_accesses(program);
+  lower_switches(program);
+  mark_tail_calls(program);
+}
+
+// 由 vector 构造 raw slice
+koopa_raw_slice_t make_slice(const std::vector<const void *> &vec, koopa_raw_slice_item_kind_t kind) {
+  koopa_raw_slice_t slice;
+  slice.buffer = new const void *[vec.size() + 1];
+  for(size_t i = 0; i < vec.size(); ++i)
+    slice.buffer[i] = vec[i];
+  slice.len = vec.size();
+  slice.kind = kind;
+  return slice;
+}
+
+// 获取函数的所有基本块
+std::vector<koopa_raw_basic_block_t> get_bbs(koopa_raw_function_t func) {
+  std::vector<koopa_raw_basic_block_t> bbs;
+  for(size_t i = 0; i < func->bbs.len; ++i)
+    bbs.push_back(reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]));
+  return bbs;
+}
+
+// 替换函数的基本块列表
+void set_bbs(koopa_raw_function_t func, const std::vector<koopa_raw_basic_block_t> &bbs) {
+  std::vector<const void *> vec(bbs.begin(), bbs.end());
+  const_cast<koopa_raw_function_data_t *>(func)->bbs = make_slice(vec, KOOPA_RSIK_BASIC_BLOCK);
+}
+
+// 获取基本块的所有指令
+std::vector<koopa_raw_value_t> get_insts(koopa_raw_basic_block_t bb) {
+  std::vector<koopa_raw_value_t> insts;
+  for(size_t i = 0; i < bb->insts.len; ++i)
+    insts.push_back(reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[i]));
+  return insts;
+}
+
+// 替换基本块的指令列表
+void set_insts(koopa_raw_basic_block_t bb, const std::vector<koopa_raw_value_t> &insts) {
+  std::vector<const void *> vec(insts.begin(), insts.end());
+  const_cast<koopa_raw_basic_block_data_t *>(bb)->insts = make_slice(vec, KOOPA_RSIK_VALUE);
+}
+
+// 新建一个指令, 操作数由调用者填写
+koopa_raw_value_data_t *new_value(koopa_raw_type_t ty, koopa_raw_value_tag_t tag) {
+  koopa_raw_value_data_t *value = new koopa_raw_value_data_t();
+  value->ty = ty;
+  value->name = nullptr;
+  value->used_by = make_slice(std::vector<const void *>(), KOOPA_RSIK_VALUE);
+  value->kind.tag = tag;
+  return value;
+}
+
+// 新建一个空基本块
+koopa_raw_basic_block_data_t *new_basic_block(const std::string &name) {
+  koopa_raw_basic_block_data_t *bb = new koopa_raw_basic_block_data_t();
+  char *bb_name = new char[name.size() + 1];
+  strcpy(bb_name, name.c_str());
+  bb->name = bb_name;
+  bb->params = make_slice(std::vector<const void *>(), KOOPA_RSIK_VALUE);
+  bb->used_by = make_slice(std::vector<const void *>(), KOOPA_RSIK_VALUE);
+  bb->insts = make_slice(std::vector<const void *>(), KOOPA_RSIK_VALUE);
+  return bb;
+}
+
+// 构造指向 base 的指针类型
+koopa_raw_type_t pointer_type(koopa_raw_type_t base) {
+  koopa_raw_type_kind_t *ty = new koopa_raw_type_kind_t();
+  ty->tag = KOOPA_RTT_POINTER;
+  ty->data.pointer.base = base;
+  return ty;
+}
+
+// 获取 i32 或 unit 类型
+koopa_raw_type_t simple_type(koopa_raw_type_tag_t tag) {
+  static koopa_raw_type_kind_t int32_ty = {KOOPA_RTT_INT32};
+  static koopa_raw_type_kind_t unit_ty = {KOOPA_RTT_UNIT};
+  assert(tag == KOOPA_RTT_INT32 || tag == KOOPA_RTT_UNIT);
+  return tag == KOOPA_RTT_INT32 ? &int32_ty : &unit_ty;
+}
+
+// 新建整数常量
+koopa_raw_value_t new_integer(int value) {
+  koopa_raw_value_data_t *integer = new_value(simple_type(KOOPA_RTT_INT32), KOOPA_RVT_INTEGER);
+  integer->kind.data.integer.value = value;
+  return integer;
+}
+
+// 新建二元运算指令
+koopa_raw_value_t new_binary(koopa_raw_binary_op_t op, koopa_raw_value_t lhs, koopa_raw_value_t rhs) {
+  koopa_raw_value_data_t *binary = new_value(simple_type(KOOPA_RTT_INT32), KOOPA_RVT_BINARY);
+  binary->kind.data.binary.op = op;
+  binary->kind.data.binary.lhs = lhs;
+  binary->kind.data.binary.rhs = rhs;
+  return binary;
+}
+
+// 新建从 src 读取的 load 指令
+koopa_raw_value_t new_load(koopa_raw_value_t src) {
+  koopa_raw_value_data_t *load = new_value(src->ty->data.pointer.base, KOOPA_RVT_LOAD);
+  load->kind.data.load.src = src;
+  return load;
+}
+
+// 新建将 value 写入 dest 的 store 指令
+koopa_raw_value_t new_store(koopa_raw_value_t value, koopa_raw_value_t dest) {
+  koopa_raw_value_data_t *store = new_value(simple_type(KOOPA_RTT_UNIT), KOOPA_RVT_STORE);
+  store->kind.data.store.value = value;
+  store->kind.data.store.dest = dest;
+  return store;
+}
+
+// 新建跳转到 target 的 jump 指令
+koopa_raw_value_t new_jump(koopa_raw_basic_block_t target) {
+  koopa_raw_value_data_t *jump = new_value(simple_type(KOOPA_RTT_UNIT), KOOPA_RVT_JUMP);
+  jump->kind.data.jump.target = target;
+  jump->kind.data.jump.args = make_slice(std::vector<const void *>(), KOOPA_RSIK_VALUE);
+  return jump;
+}
+
+// 新建条件为 cond 的 br 指令
+koopa_raw_value_t new_branch(koopa_raw_value_t cond, koopa_raw_basic_block_t true_bb, koopa_raw_basic_block_t false_bb) {
+  koopa_raw_value_data_t *branch = new_value(simple_type(KOOPA_RTT_UNIT), KOOPA_RVT_BRANCH);
+  branch->kind.data.branch.cond = cond;
+  branch->kind.data.branch.true_bb = true_bb;
+  branch->kind.data.branch.false_bb = false_bb;
+  branch->kind.data.branch.true_args = make_slice(std::vector<const void *>(), KOOPA_RSIK_VALUE);
+  branch->kind.data.branch.false_args = make_slice(std::vector<const void *>(), KOOPA_RSIK_VALUE);
+  return branch;
+}
+
+// 根据原基本块名生成一个全局唯一的新标号
+std::string new_label(const std::string &prefix, koopa_raw_basic_block_t bb) {
+  return "%" + prefix + std::to_string(label_id++) + "_" + std::string(bb->name + 1);
+}
+
+// 获取指令所有操作数的地址, 便于替换操作数
+std::vector<koopa_raw_value_t *> get_operands(koopa_raw_value_t value) {
+  std::vector<koopa_raw_value_t *> operands;
+  auto &kind = const_cast<koopa_raw_value_data_t *>(value)->kind;
+  switch(kind.tag) {
+    case KOOPA_RVT_LOAD:
+      operands.push_back(&kind.data.load.src);
+      break;
+    case KOOPA_RVT_STORE:
+      operands.push_back(&kind.data.store.value);
+      operands.push_back(&kind.data.store.dest);
+      break;
+    case KOOPA_RVT_GET_PTR:
+      operands.push_back(&kind.data.get_ptr.src);
+      operands.push_back(&kind.data.get_ptr.index);
+      break;
+    case KOOPA_RVT_GET_ELEM_PTR:
+      operands.push_back(&kind.data.get_elem_ptr.src);
+      operands.push_back(&kind.data.get_elem_ptr.index);
+      break;
+    case KOOPA_RVT_BINARY:
+      operands.push_back(&kind.data.binary.lhs);
+      operands.push_back(&kind.data.binary.rhs);
+      break;
+    case KOOPA_RVT_BRANCH:
+      operands.push_back(&kind.data.branch.cond);
+      break;
+    case KOOPA_RVT_CALL:
+      for(size_t i = 0; i < kind.data.call.args.len; ++i)
+        operands.push_back(reinterpret_cast<koopa_raw_value_t *>(&kind.data.call.args.buffer[i]));
+      break;
+    case KOOPA_RVT_RETURN:
+      if(kind.data.ret.value)
+        operands.push_back(&kind.data.ret.value);
+      break;
+    default:
+      break;
+  }
+  return operands;
+}
+
+// 获取基本块的终结指令
+koopa_raw_value_t get_terminator(koopa_raw_basic_block_t bb) {
+  if(bb->insts.len == 0)
+    return nullptr;
+  return reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[bb->insts.len - 1]);
+}
+
+// 获取基本块的后继
+std::vector<koopa_raw_basic_block_t> get_succs(koopa_raw_basic_block_t bb) {
+  std::vector<koopa_raw_basic_block_t> succs;
+  koopa_raw_value_t term = get_terminator(bb);
+  if(term == nullptr)
+    return succs;
+  if(term->kind.tag == KOOPA_RVT_BRANCH) {
+    succs.push_back(term->kind.data.branch.true_bb);
+    succs.push_back(term->kind.data.branch.false_bb);
+  }
+  else if(term->kind.tag == KOOPA_RVT_JUMP)
+    succs.push_back(term->kind.data.jump.target);
+  return succs;
+}
+
+// 将一组基本块中对 from 的所有使用替换为 to
+void replace_uses(const std::vector<koopa_raw_basic_block_t> &bbs, koopa_raw_value_t from, koopa_raw_value_t to) {
+  for(koopa_raw_basic_block_t bb : bbs)
+    for(koopa_raw_value_t inst : get_insts(bb))
+      for(koopa_raw_value_t *operand : get_operands(inst))
+        if(*operand == from)
+          *operand = to;
+}
+
+// 将一组基本块中跳转到 from 的目标改为 to
+void retarget(const std::vector<koopa_raw_basic_block_t> &bbs, koopa_raw_basic_block_t from, koopa_raw_basic_block_t to) {
+  for(koopa_raw_basic_block_t bb : bbs) {
+    koopa_raw_value_t term = get_terminator(bb);
+    if(term == nullptr)
+      continue;
+    auto &kind = const_cast<koopa_raw_value_data_t *>(term)->kind;
+    if(kind.tag == KOOPA_RVT_BRANCH) {
+      if(kind.data.branch.true_bb == from)
+        kind.data.branch.true_bb = to;
+      if(kind.data.branch.false_bb == from)
+        kind.data.branch.false_bb = to;
+    }
+    else if(kind.tag == KOOPA_RVT_JUMP && kind.data.jump.target == from)
+      kind.data.jump.target = to;
+  }
+}
+
+// 复制一条指令, 操作数暂不替换
+static koopa_raw_value_data_t *clone_value(koopa_raw_value_t value) {
+  koopa_raw_value_data_t *new_value = new koopa_raw_value_data_t(*value);
+  new_value->used_by = make_slice(std::vector<const void *>(), KOOPA_RSIK_VALUE);
+  if(value->kind.tag == KOOPA_RVT_CALL) {
+    const koopa_raw_slice_t &args = value->kind.data.call.args;
+    std::vector<const void *> vec(args.buffer, args.buffer + args.len);
+    new_value->kind.data.call.args = make_slice(vec, KOOPA_RSIK_VALUE);
+  }
+  return new_value;
+}
+
+// 复制一组基本块, value_map 与 bb_map 中已有的映射会被用于替换操作数和跳转目标
+std::vector<koopa_raw_basic_block_t> clone_blocks(const std::vector<koopa_raw_basic_block_t> &bbs,
+                                                  std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> &value_map,
+                                                  std::unordered_map<koopa_raw_basic_block_t, koopa_raw_basic_block_t> &bb_map,
+                                                  const std::string &prefix) {
+  std::vector<koopa_raw_basic_block_t> new_bbs;
+  for(koopa_raw_basic_block_t bb : bbs) {
+    koopa_raw_basic_block_data_t *new_bb = new_basic_block(new_label(prefix, bb));
+    bb_map[bb] = new_bb;
+    new_bbs.push_back(new_bb);
+  }
+  // 先复制全部指令, 再统一替换操作数, 以处理定义在后面基本块中的值
+  for(size_t i = 0; i < bbs.size(); ++i) {
+    std::vector<koopa_raw_value_t> insts;
+    for(koopa_raw_value_t inst : get_insts(bbs[i])) {
+      koopa_raw_value_data_t *new_inst = clone_value(inst);
+      value_map[inst] = new_inst;
+      insts.push_back(new_inst);
+    }
+    set_insts(new_bbs[i], insts);
+  }
+  for(koopa_raw_basic_block_t new_bb : new_bbs) {
+    for(koopa_raw_value_t inst : get_insts(new_bb)) {
+      for(koopa_raw_value_t *operand : get_operands(inst)) {
+        auto it = value_map.find(*operand);
+        if(it != value_map.end())
+          *operand = it->second;
+      }
+      auto &kind = const_cast<koopa_raw_value_data_t *>(inst)->kind;
+      if(kind.tag == KOOPA_RVT_BRANCH) {
+        if(bb_map.count(kind.data.branch.true_bb))
+          kind.data.branch.true_bb = bb_map[kind.data.branch.true_bb];
+        if(bb_map.count(kind.data.branch.false_bb))
+          kind.data.branch.false_bb = bb_map[kind.data.branch.false_bb];
+      }
+      else if(kind.tag == KOOPA_RVT_JUMP) {
+        if(bb_map.count(kind.data.jump.target))
+          kind.data.jump.target = bb_map[kind.data.jump.target];
+      }
+    }
+  }
+  return new_bbs;
+}
+
+// 构建控制流图, 计算支配关系与循环嵌套深度
+cfg_t build_cfg(koopa_raw_function_t func) {
+  cfg_t cfg;
+  cfg.bbs = get_bbs(func);
+  int n = cfg.bbs.size();
+  for(int i = 0; i < n; ++i)
+    cfg.index[cfg.bbs[i]] = i;
+  cfg.succs.resize(n);
+  cfg.preds.resize(n);
+  for(int i = 0; i < n; ++i) {
+    for(koopa_raw_basic_block_t succ : get_succs(cfg.bbs[i])) {
+      int j = cfg.index[succ];
+      cfg.succs[i].push_back(j);
+      cfg.preds[j].push_back(i);
+    }
+  }
+
+  // 非递归 DFS 求逆后序
+  std::vector<int> visited(n, 0);
+  std::vector<std::pair<int, size_t> > stack;
+  std::vector<int> post;
+  if(n > 0) {
+    stack.push_back({0, 0});
+    visited[0] = 1;
+  }
+  while(!stack.empty()) {
+    auto &top = stack.back();
+    if(top.second < cfg.succs[top.first].size()) {
+      int succ = cfg.succs[top.first][top.second++];
+      if(!visited[succ]) {
+        visited[succ] = 1;
+        stack.push_back({succ, 0});
+      }
+    }
+    else {
+      post.push_back(top.first);
+      stack.pop_back();
+    }
+  }
+  cfg.rpo.assign(post.rbegin(), post.rend());
+
+  // 迭代求直接支配者 (Cooper-Harvey-Kennedy)
+  std::vector<int> rpo_id(n, -1);
+  for(size_t i = 0; i < cfg.rpo.size(); ++i)
+    rpo_id[cfg.rpo[i]] = i;
+  cfg.idom.assign(n, -1);
+  if(n > 0)
+    cfg.idom[0] = 0;
+  bool changed = true;
+  while(changed) {
+    changed = false;
+    for(size_t i = 1; i < cfg.rpo.size(); ++i) {
+      int b = cfg.rpo[i];
+      int new_idom = -1;
+      for(int p : cfg.preds[b]) {
+        if(cfg.idom[p] == -1)
+          continue;
+        if(new_idom == -1) {
+          new_idom = p;
+          continue;
+        }
+        int x = p, y = new_idom;
+        while(x != y) {
+          while(rpo_id[x] > rpo_id[y]) x = cfg.idom[x];
+          while(rpo_id[y] > rpo_id[x]) y = cfg.idom[y];
+        }
+        new_idom = x;
+      }
+      if(new_idom != cfg.idom[b]) {
+        cfg.idom[b] = new_idom;
+        changed = true;
+      }
+    }
+  }
+
+  // 回边 b -> h (h 支配 b) 确定自然循环, 同一循环头的回边合并为一个循环
+  std::vector<std::vector<int> > latches(n);
+  for(int b : cfg.rpo) {
+    for(int h : cfg.succs[b]) {
+      int x = b;
+      while(x != h && x != 0)
+        x = cfg.idom[x];
+      if(x == h)
+        latches[h].push_back(b);
+    }
+  }
+  cfg.loop_depth.assign(n, 0);
+  for(int h = 0; h < n; ++h) {
+    if(latches[h].empty())
+      continue;
+    loop_t loop;
+    loop.header = h;
+    loop.latches = latches[h];
+    std::vector<int> in_loop(n, 0);
+    std::vector<int> work = latches[h];
+    in_loop[h] = 1;
+    while(!work.empty()) {
+      int x = work.back();
+      work.pop_back();
+      if(in_loop[x])
+        continue;
+      in_loop[x] = 1;
+      for(int p : cfg.preds[x])
+        if(cfg.idom[p] != -1)
+          work.push_back(p);
+    }
+    for(int i = 0; i < n; ++i) {
+      cfg.loop_depth[i] += in_loop[i];
+      if(in_loop[i])
+        loop.blocks.push_back(i);
+    }
+    cfg.loops.push_back(loop);
+  }
+  if(n > 0)
+    cfg.idom[0] = -1;
+  return cfg;
+}
+
+// 基本块 a 是否支配 b
+bool dominates(const cfg_t &cfg, int a, int b) {
+  while(b != -1 && b != a)
+    b = cfg.idom[b];
+  return b == a;
+}
+
+// 函数的指令总数
+size_t func_size(koopa_raw_function_t func) {
+  size_t size = 0;
+  for(size_t i = 0; i < func->bbs.len; ++i)
+    size += reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i])->insts.len;
+  return size;
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "koopa.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+/** -perf 模式下可调节的优化参数 */
+struct opt_options_t {
+  /** 被内联函数的指令数上限 */
+  int inline_threshold;
+  /** 内联后调用者函数的指令数上限 */
+  int inline_caller_limit;
+  /** 循环部分展开的次数, 为 1 时不做部分展开 */
+  int unroll_factor;
+  /** 展开后循环体的指令数上限 */
+  int unroll_size_limit;
+  /** 指令调度使用的 lw, mul 与 div / rem 的结果延迟 (周期) */
+  int load_latency;
+  int mul_latency;
+  int div_latency;
+  /** 目标支持的 C, Zba, Zbb 与 Zicond 扩展, 由 -march 给出 */
+  bool rvc;
+  bool zba;
+  bool zbb;
+  bool zicond;
+  /** 条件转换时一次难以预测的条件跳转估计的代价 (指令条数), 为 0 时只在不多于原来平均执行的指令数时转换 */
+  int branch_cost;
+};
+
+extern opt_options_t opt_options;
+/** 可由后端释放栈帧后直接跳转的尾调用 */
+extern std::unordered_set<koopa_raw_value_t> tail_calls;
+
+/** 改为跳转表的等值比较链: 以 value - low 为下标取出目标, 超出范围时跳到 default_bb
+ * 比较链仍保留在 IR 中表示控制流, 后端不能使用跳转表时照常输出 */
+struct jump_table_t {
+  koopa_raw_value_t value;
+  int low;
+  std::vector<koopa_raw_basic_block_t> targets;
+  koopa_raw_basic_block_t default_bb;
+  /** 链首只被 br 使用的比较, 使用跳转表时不必计算, 没有时为 nullptr */
+  koopa_raw_value_t cond;
+};
+
+/** 按跳转表输出的链首 br */
+extern std::unordered_map<koopa_raw_value_t, jump_table_t> jump_tables;
+
+/** 自然循环, 同一循环头的回边合并为一个循环 */
+struct loop_t {
+  int header;
+  /** 回边的起点 */
+  std::vector<int> latches;
+  /** 循环中的基本块, 按下标升序排列 */
+  std::vector<int> blocks;
+};
+
+/** 控制流图及循环信息, 基本块以在函数中的下标表示 */
+struct cfg_t {
+  std::vector<koopa_raw_basic_block_t> bbs;
+  std::unordered_map<koopa_raw_basic_block_t, int> index;
+  std::vector<std::vector<int> > succs;
+  std::vector<std::vector<int> > preds;
+  /** 逆后序, 只包含从入口可达的基本块 */
+  std::vector<int> rpo;
+  /** 直接支配者, 入口及不可达块为 -1 */
+  std::vector<int> idom;
+  /** 循环嵌套深度 */
+  std::vector<int> loop_depth;
+  std::vector<loop_t> loops;
+};
+
+/** 计数循环: 每次迭代循环变量 var 恰好增加 step, 循环条件为 var op bound */
+struct counted_loop_t {
+  koopa_raw_basic_block_t header;
+  /** 循环体入口, 即循环头条件为真时的目标 */
+  koopa_raw_basic_block_t entry;
+  koopa_raw_basic_block_t exit;
+  /** 除循环头外的循环体基本块 */
+  std::vector<koopa_raw_basic_block_t> body;
+  /** 循环外跳转到循环头的基本块 */
+  std::vector<koopa_raw_basic_block_t> preheaders;
+  koopa_raw_value_t var;
+  /** 循环中唯一写入 var 的 store 及其所在基本块 */
+  koopa_raw_value_t var_store;
+  koopa_raw_basic_block_t store_bb;
+  koopa_raw_value_t load;
+  koopa_raw_value_t cond;
+  koopa_raw_value_t bound;
+  koopa_raw_binary_op_t op;
+  int step;
+  /** 循环体 (不含循环头) 的指令数 */
+  size_t size;
+  /** 循环中定义的值, 以及被写入的地址 */
+  std::unordered_set<koopa_raw_value_t> values;
+  std::unordered_set<koopa_raw_value_t> stored;
+  bool has_call;
+};
+
+/** 函数及其调用的函数可能读写的全局变量 */
+struct modref_t {
+  std::unordered_set<koopa_raw_value_t> mod;
+  std::unordered_set<koopa_raw_value_t> ref;
+};
+
+bool parse_opt_option(const char *arg);
+void optimize_raw(koopa_raw_program_t &program);
+void inline_functions(koopa_raw_program_t &program);
+void eliminate_tail_recursion(koopa_raw_program_t &program);
+void mark_tail_calls(koopa_raw_program_t &program);
+void lower_switches(koopa_raw_program_t &program);
+void unroll_loops(koopa_raw_program_t &program);
+void reduce_induction_variables(koopa_raw_program_t &program);
+void recognize_loop_idioms(koopa_raw_program_t &program);
+bool is_runtime_routine(koopa_raw_function_t func);
+void promote_globals(koopa_raw_program_t &program);
+std::unordered_map<koopa_raw_function_t, modref_t> compute_modref(const koopa_raw_program_t &program);
+void eliminate_redundant_accesses(koopa_raw_program_t &program);
+void init_alias(const koopa_raw_program_t &program);
+void init_alias(koopa_raw_function_t func);
+koopa_raw_value_t mem_base(koopa_raw_value_t ptr);
+bool may_alias(koopa_raw_value_t p, koopa_raw_value_t q);
+bool get_const_offset(koopa_raw_value_t ptr, koopa_raw_value_t &source, long long &offset);
+bool call_may_access(koopa_raw_value_t call, koopa_raw_value_t ptr, const modref_t &callee, bool write);
+
+koopa_raw_slice_t make_slice(const std::vector<const void *> &vec, koopa_raw_slice_item_kind_t kind);
+std::vector<koopa_raw_basic_block_t> get_bbs(koopa_raw_function_t func);
+void set_bbs(koopa_raw_function_t func, const std::vector<koopa_raw_basic_block_t> &bbs);
+std::vector<koopa_raw_value_t> get_insts(koopa_raw_basic_block_t bb);
+void set_insts(koopa_raw_basic_block_t bb, const std::vector<koopa_raw_value_t> &insts);
+koopa_raw_value_data_t *new_value(koopa_raw_type_t ty, koopa_raw_value_tag_t tag);
+koopa_raw_basic_block_data_t *new_basic_block(const std::string &name);
+koopa_raw_type_t pointer_type(koopa_raw_type_t base);
+koopa_raw_type_t simple_type(koopa_raw_type_tag_t tag);
+koopa_raw_value_t new_integer(int value);
+koopa_raw_value_t new_binary(koopa_raw_binary_op_t op, koopa_raw_value_t lhs, koopa_raw_value_t rhs);
+koopa_raw_value_t new_load(koopa_raw_value_t src);
+koopa_raw_value_t new_store(koopa_raw_value_t value, koopa_raw_value_t dest);
+koopa_raw_value_t new_jump(koopa_raw_basic_block_t target);
+koopa_raw_value_t new_branch(koopa_raw_value_t cond, koopa_raw_basic_block_t true_bb, koopa_raw_basic_block_t false_bb);
+std::string new_label(const std::string &prefix, koopa_raw_basic_block_t bb);
+std::vector<koopa_raw_value_t *> get_operands(koopa_raw_value_t value);
+std::vector<koopa_raw_basic_block_t> get_succs(koopa_raw_basic_block_t bb);
+koopa_raw_value_t get_terminator(koopa_raw_basic_block_t bb);
+void replace_uses(const std::vector<koopa_raw_basic_block_t> &bbs, koopa_raw_value_t from, koopa_raw_value_t to);
+std::vector<koopa_raw_basic_block_t> clone_blocks(const std::vector<koopa_raw_basic_block_t> &bbs,
+                                                  std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> &value_map,
+                                                  std::unordered_map<koopa_raw_basic_block_t, koopa_raw_basic_block_t> &bb_map,
+                                                  const std::string &prefix);
+void retarget(const std::vector<koopa_raw_basic_block_t> &bbs, koopa_raw_basic_block_t from, koopa_raw_basic_block_t to);
+cfg_t build_cfg(koopa_raw_function_t func);
+bool dominates(const cfg_t &cfg, int a, int b);
+size_t func_size(koopa_raw_function_t func);
+bool get_const(koopa_raw_value_t value, int &result);
+bool eval_compare(koopa_raw_binary_op_t op, long long lhs, long long rhs);
+bool analyze_counted_loop(const cfg_t &cfg, const loop_t &loop, counted_loop_t &info);
+bool is_invariant(const counted_loop_t &info, koopa_raw_value_t value);
+bool linear_coef(const counted_loop_t &info, koopa_raw_value_t value, long long &coef);
+koopa_raw_value_t clone_expr(const counted_loop_t &info, koopa_raw_value_t value,
+                             std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> &replace,
+                             std::vector<koopa_raw_value_t> &insts);
+int trip_count(const counted_loop_t &info, int limit);
@@ -0,0 +1,260 @@
+#include "mir.hpp"
+#include <cassert>
+#include <map>
+#include <unordered_map>
+
+// 第二个操作数为常量时可改用的立即数指令, 没有时返回 MOP_NOP
+static mop_t imm_form(mop_t op) {
+  switch(op) {
+    case MOP_ADD: return MOP_ADDI;
+    case MOP_AND: return MOP_ANDI;
+    case MOP_OR: return MOP_ORI;
+    case MOP_XOR: return MOP_XORI;
+    case MOP_SLT: return MOP_SLTI;
+    default: return MOP_NOP;
+  }
+}
+
+static bool commutative(mop_t op) {
+  return op == MOP_ADD || op == MOP_AND || op == MOP_OR || op == MOP_XOR || op == MOP_MUL || op == MOP_MIN || op == MOP_MAX;
+}
+
+// 只在单条中间表示指令内部使用的临时寄存器, 在基本块边界与跳转处一定已死
+static bool is_scratch(reg_t reg) {
+  return reg == REG_T0 || reg == REG_T1 || reg == REG_T2;
+}
+
+static bool is_temp(reg_t reg) {
+  return is_scratch(reg) || reg >= REG_T3;
+}
+
+static bool is_arg(reg_t reg) {
+  return reg >= REG_A0 && reg <= REG_A7;
+}
+
+static bool fits_imm(long long imm) {
+  return imm >= -2048 && imm <= 2047;
+}
+
+static bool reads(const minst_t &inst, reg_t reg) {
+  return inst.rs1 == reg || inst.rs2 == reg;
+}
+
+// 寄存器 reg 在第 b 个基本块的第 i 条指令之后是否不再被读取
+// 只向后扫描到第一条控制流指令, 之后只能确定临时寄存器与调用约定规定的寄存器
+static bool dead_after(const mfunc_t &func, size_t b, size_t i, reg_t reg) {
+  for(size_t j = i + 1; j < mblock_end(func, b); ++j) {
+    const minst_t &inst = func.insts[j];
+    if(inst.op == MOP_NOP)
+      continue;
+    if(reads(inst, reg))
+      return false;
+    if(inst.op == MOP_CALL || inst.op == MOP_TAIL) {
+      // 传递参数的寄存器由被调用函数读取, 调用者保存寄存器中的值不跨越调用
+      if(is_arg(reg))
+        return reg - REG_A0 >= inst.imm;
+      if(is_temp(reg))
+        return true;
+      if(inst.op == MOP_TAIL)
+        return false;
+      continue;
+    }
+    if(inst.op == MOP_RET)
+      return reg != REG_A0 && (is_temp(reg) || is_arg(reg));
+    if(is_branch(inst.op) || is_exit(inst.op))
+      return is_scratch(reg);
+    if(inst.rd == reg)
+      return true;
+  }
+  return is_scratch(reg);
+}
+
+// 整理跳转: 跳到 j 的跳转直接跳到最终目标, 互补的条件跳转改为 j, 条件跳转越过紧跟的 j 时取反,
+// 删除跳到下一条指令的跳转, 不可达的指令, 以及无人引用标号的基本块 (并入前一个基本块)
+static bool simplify_jumps(mfunc_t &func) {
+  bool changed = false;
+  std::vector<minst_t> &insts = func.insts;
+  std::unordered_map<int, size_t> label_block;
+  for(size_t b = 0; b < func.blocks.size(); ++b)
+    label_block[func.blocks[b].label] = b;
+  // 标号 label 处的第一条指令位置, 空的基本块直接落入下一个基本块
+  auto target_pos = [&](int label) { return func.blocks[label_block.at(label)].begin; };
+
+  auto thread = [&](int &label) {
+    for(int step = 0; step < 8; ++step) {
+      size_t pos = target_pos(label);
+      if(pos >= insts.size() || insts[pos].op != MOP_J || insts[pos].sym == label)
+        break;
+      label = insts[pos].sym;
+      changed = true;
+    }
+  };
+  for(minst_t &inst : insts)
+    if(inst.op == MOP_J || is_branch(inst.op))
+      thread(inst.sym);
+  for(mtable_t &table : func.tables)
+    for(int &label : table.labels)
+      thread(label);
+  for(size_t b = 0; b < func.blocks.size(); ++b) {
+    size_t end = mblock_end(func, b);
+    bool reachable = true;
+    for(size_t i = func.blocks[b].begin; i < end; ++i) {
+      minst_t &inst = insts[i];
+      if(!reachable) {
+        inst.op = MOP_NOP;
+        changed = true;
+        continue;
+      }
+      if(i + 1 < end && is_branch(inst.op) && is_branch(insts[i + 1].op) && inst.op != insts[i + 1].op &&
+         inst.rs1 == insts[i + 1].rs1) {
+        insts[i + 1] = {MOP_J, REG_NONE, REG_NONE, REG_NONE, 0, insts[i + 1].sym};
+        changed = true;
+      }
+      if(is_exit(inst.op))
+        reachable = false;
+    }
+  }
+  compact(func);
+
+  std::vector<char> starts(insts.size() + 1, 0);
+  for(const mblock_t &block : func.blocks)
+    starts[block.begin] = 1;
+  for(size_t i = 0; i < insts.size(); ++i) {
+    minst_t &inst = insts[i];
+    if(is_branch(inst.op) && i + 1 < insts.size() && insts[i + 1].op == MOP_J && !starts[i + 1] &&
+       target_pos(inst.sym) == i + 2) {
+      inst.op = inst.op == MOP_BNEZ ? MOP_BEQZ : MOP_BNEZ;
+      inst.sym = insts[i + 1].sym;
+      insts[i + 1].op = MOP_NOP;
+      changed = true;
+    }
+  }
+  compact(func);
+  for(size_t i = 0; i < insts.size(); ++i) {
+    minst_t &inst = insts[i];
+    if((inst.op == MOP_J || is_branch(inst.op)) && target_pos(inst.sym) == i + 1) {
+      inst.op = MOP_NOP;
+      changed = true;
+    }
+  }
+  compact(func);
+
+  std::vector<char> used(func.syms.size(), 0);
+  for(const minst_t &inst : insts)
+    for(int label : jump_targets(func, inst))
+      used[label] = 1;
+  std::vector<mblock_t> blocks;
+  for(size_t b = 0; b < func.blocks.size(); ++b) {
+    if(b > 0 && !used[func.blocks[b].label]) {
+      changed = true;
+      continue;
+    }
+    blocks.push_back(func.blocks[b]);
+  }
+  func.blocks.swap(blocks);
+  return changed;
+}
+
+// 消除刚写入栈或内存又读出的 lw, 以及重复读取同一地址的 lw
+// 同一基址的不同偏移不重叠, 不同基址 (包括 sp 与 s0) 可能指向同一位置
+static bool forward_stores(mfunc_t &func) {
+  bool changed = false;
+  std::map<std::pair<reg_t, int>, reg_t> known;
+  for(size_t b = 0; b < func.blocks.size(); ++b) {
+    known.clear();
+    for(size_t i = func.blocks[b].begin; i < mblock_end(func, b); ++i) {
+      minst_t &inst = func.insts[i];
+      if(inst.op == MOP_CALL || is_branch(inst.op) || is_exit(inst.op)) {
+        known.clear();
+        continue;
+      }
+      if(inst.op == MOP_SW) {
+        for(auto it = known.begin(); it != known.end();)
+          it = it->first.first != inst.rs1 ? known.erase(it) : std::next(it);
+        known[{inst.rs1, inst.imm}] = inst.rs2;
+        continue;
+      }
+      if(inst.op == MOP_LW) {
+        auto it = known.find({inst.rs1, inst.imm});
+        if(it != known.end()) {
+          inst = {MOP_MV, inst.rd, it->second, REG_NONE, 0, 0};
+          changed = true;
+        }
+      }
+      // 写入的寄存器不再持有原来的值, 作为基址时原偏移也失效
+      if(inst.rd != REG_NONE) {
+        for(auto it = known.begin(); it != known.end();)
+          it = it->first.first == inst.rd || it->second == inst.rd ? known.erase(it) : std::next(it);
+        if(inst.op == MOP_LW && inst.rd != inst.rs1)
+          known[{inst.rs1, inst.imm}] = inst.rd;
+      }
+    }
+  }
+  return changed;
+}
+
+// 合并相邻指令: li 与运算合并为立即数指令, addi 并入随后访存的偏移, 结果复制到其他寄存器时直接写入目标,
+// 复制后只使用一次时直接使用来源
+static bool combine(mfunc_t &func) {
+  bool changed = false;
+  for(size_t b = 0; b < func.blocks.size(); ++b) {
+    size_t end = mblock_end(func, b);
+    for(size_t i = func.blocks[b].begin; i < end; ++i) {
+      minst_t &inst = func.insts[i];
+      if(inst.op == MOP_MV && inst.rd == inst.rs1) {
+        inst.op = MOP_NOP;
+        changed = true;
+        continue;
+      }
+      if(i + 1 >= end || inst.op == MOP_NOP || inst.rd == REG_NONE)
+        continue;
+      minst_t &next = func.insts[i + 1];
+      reg_t reg = inst.rd;
+      if(next.op == MOP_NOP || (next.rd != reg && !dead_after(func, b, i + 1, reg)))
+        continue;
+      if(inst.op == MOP_LI && fits_imm(inst.imm) && next.rs2 == reg && next.rs1 != reg && imm_form(next.op) != MOP_NOP)
+        next = {imm_form(next.op), next.rd, next.rs1, REG_NONE, inst.imm, 0};
+      else if(inst.op == MOP_LI && fits_imm(inst.imm) && next.rs1 == reg && next.rs2 != reg && next.rs2 != REG_NONE &&
+              commutative(next.op) && imm_form(next.op) != MOP_NOP)
+        next = {imm_form(next.op), next.rd, next.rs2, REG_NONE, inst.imm, 0};
+      else if(inst.op == MOP_LI && fits_imm(-(long long)inst.imm) && next.op == MOP_SUB && next.rs2 == reg && next.rs1 != reg)
+        next = {MOP_ADDI, next.rd, next.rs1, REG_NONE, -inst.imm, 0};
+      else if(inst.op == MOP_ADDI && (next.op == MOP_LW || (next.op == MOP_SW && next.rs2 != reg)) &&
+              next.rs1 == reg && fits_imm((long long)inst.imm + next.imm)) {
+        // 只用作访存基址的地址计算并入访存指令的偏移
+        next.rs1 = inst.rs1;
+        next.imm += inst.imm;
+      }
+      else if(next.op == MOP_MV && next.rs1 == reg && next.rd != reg) {
+        // 运算结果只用于复制时直接写入复制的目标
+        inst.rd = next.rd;
+        next.op = MOP_NOP;
+        changed = true;
+        continue;
+      }
+      else if(inst.op == MOP_MV && reads(next, reg) && next.op != MOP_CALL && next.op != MOP_TAIL && next.op != MOP_RET) {
+        // 复制的值只被下一条指令使用时直接使用来源
+        if(next.rs1 == reg)
+          next.rs1 = inst.rs1;
+        if(next.rs2 == reg)
+          next.rs2 = inst.rs1;
+      }
+      else
+        continue;
+      inst.op = MOP_NOP;
+      changed = true;
+    }
+  }
+  compact(func);
+  return changed;
+}
+
+// 在函数的机器代码上做窥孔优化, 直到不再变化
+void peephole(mfunc_t &func) {
+  bool changed = true;
+  while(changed) {
+    changed = forward_stores(func);
+    changed |= combine(func);
+    changed |= simplify_jumps(func);
+  }
+}
@@ -0,0 +1,99 @@
+#include "koopa.h"
+#include "opt.hpp"
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+// 将函数中在循环内访问的标量全局变量提升为局部变量
+// 函数入口读入, 在可能访问该变量的调用前写回、调用后重新读入, 函数返回前写回
+static void promote_globals(koopa_raw_function_t func, std::unordered_map<koopa_raw_function_t, modref_t> &summary) {
+  cfg_t cfg = build_cfg(func);
+  std::unordered_set<koopa_raw_value_t> in_loop, stored, candidates;
+  std::vector<koopa_raw_value_t> order;
+  for(size_t i = 0; i < cfg.bbs.size(); ++i) {
+    for(koopa_raw_value_t inst : get_insts(cfg.bbs[i])) {
+      koopa_raw_value_t global = nullptr;
+      if(inst->kind.tag == KOOPA_RVT_LOAD)
+        global = inst->kind.data.load.src;
+      else if(inst->kind.tag == KOOPA_RVT_STORE)
+        global = inst->kind.data.store.dest;
+      if(global == nullptr || global->kind.tag != KOOPA_RVT_GLOBAL_ALLOC ||
+         global->ty->data.pointer.base->tag != KOOPA_RTT_INT32)
+        continue;
+      if(inst->kind.tag == KOOPA_RVT_STORE)
+        stored.insert(global);
+      if(cfg.loop_depth[i] > 0 && !in_loop.count(global)) {
+        in_loop.insert(global);
+        order.push_back(global);
+      }
+    }
+  }
+  if(order.empty())
+    return;
+
+  // main 不会被调用, 返回前无需写回
+  bool is_main = strcmp(func->name, "@main") == 0;
+  std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> locals;
+  std::vector<koopa_raw_value_t> entry_insts;
+  for(koopa_raw_value_t global : order) {
+    koopa_raw_value_data_t *local = new_value(global->ty, KOOPA_RVT_ALLOC);
+    locals[global] = local;
+    entry_insts.insert(entry_insts.begin(), local);
+    koopa_raw_value_t load = new_load(global);
+    entry_insts.push_back(load);
+    entry_insts.push_back(new_store(load, local));
+  }
+  // 将局部变量写回全局变量 / 从全局变量重新读入
+  auto sync = [&](koopa_raw_value_t global, bool write_back, std::vector<koopa_raw_value_t> &insts) {
+    koopa_raw_value_t from = write_back ? locals[global] : global;
+    koopa_raw_value_t to = write_back ? global : locals[global];
+    koopa_raw_value_t load = new_load(from);
+    insts.push_back(load);
+    insts.push_back(new_store(load, to));
+  };
+
+  for(koopa_raw_basic_block_t bb : cfg.bbs) {
+    std::vector<koopa_raw_value_t> insts;
+    for(koopa_raw_value_t inst : get_insts(bb)) {
+      auto &kind = const_cast<koopa_raw_value_data_t *>(inst)->kind;
+      if(kind.tag == KOOPA_RVT_LOAD && locals.count(kind.data.load.src))
+        kind.data.load.src = locals[kind.data.load.src];
+      else if(kind.tag == KOOPA_RVT_STORE && locals.count(kind.data.store.dest))
+        kind.data.store.dest = locals[kind.data.store.dest];
+      else if(kind.tag == KOOPA_RVT_CALL) {
+        const modref_t &callee = summary[kind.data.call.callee];
+        for(koopa_raw_value_t global : order)
+          if(stored.count(global) && (callee.ref.count(global) || callee.mod.count(global)))
+            sync(global, true, insts);
+        insts.push_back(inst);
+        for(koopa_raw_value_t global : order)
+          if(callee.mod.count(global))
+            sync(global, false, insts);
+        continue;
+      }
+      else if(kind.tag == KOOPA_RVT_RETURN && !is_main) {
+        for(koopa_raw_value_t global : order)
+          if(stored.count(global))
+            sync(global, true, insts);
+      }
+      insts.push_back(inst);
+    }
+    set_insts(bb, insts);
+  }
+
+  std::vector<koopa_raw_value_t> insts = get_insts(cfg.bbs[0]);
+  entry_insts.insert(entry_insts.end(), insts.begin(), insts.end());
+  set_insts(cfg.bbs[0], entry_insts);
+}
+
+// 根据各函数的全局变量读写摘要, 对所有函数进行全局变量提升
+void promote_globals(koopa_raw_program_t &program) {
+  std::unordered_map<koopa_raw_function_t, modref_t> summary = compute_modref(program);
+  for(size_t i = 0; i < program.funcs.len; ++i) {
+    koopa_raw_function_t func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    if(func->bbs.len != 0)
+      promote_globals(func, summary);
+  }
+}
@@ -1,11 +1,33 @@
 #include "koopa.h"
 #include "raw.hpp"
+#include "opt.hpp"
 #include <cassert>
 #include <iostream>
 #include <unordered_map>
+#include <unordered_set>
 #include <algorithm>
 
 std::unordered_map<koopa_raw_value_t, int> stack_offset;
+std::unordered_map<koopa_raw_value_t, reg_t> value_reg;
+bool obj_output = false;
+// 当前函数的机器代码
+mfunc_t mfunc;
+// ra 在当前函数栈帧中的位置
+int ra_offset = 0;
+// 大栈帧中 s0 相对 sp 的偏移, 为 -1 时不使用 s0
+int frame_base = -1;
+// 当前函数的栈帧布局
+frame_t frame;
+// 当前基本块执行时栈帧是否已建立
+bool frame_active = false;
+// 当前基本块已以尾调用结束, 其后的指令不再生成
+bool after_tail_call = false;
+// 当前函数各基本块的循环嵌套深度
+std::unordered_map<koopa_raw_basic_block_t, int> bb_depth;
+// branch 中转标号的编号
+unsigned int median_branch_id = 0;
+// 当前函数中按跳转表输出的 br, 以及因此不必计算的比较
+std::unordered_set<koopa_raw_value_t> table_branches, table_conds;
 
 // 生成 raw program
 koopa_raw_program_t generate_raw(const char *str, koopa_raw_program_builder_t builder) {
@@ -36,34 +58,60 @@ void delete_builder(koopa_raw_program_builder_t builder) {
 
 // 处理 raw program
 void Visit(const koopa_raw_program_t &program) {
-  int st_id = 0;
   // 执行一些其他的必要操作
 
-  // 访问所有全局变量
-  if(program.values.len != 0)
+  // 访问所有全局变量: 全零的放入 .bss, 从未被写入的放入只读数据段, 其余放入 .data
+  std::unordered_set<koopa_raw_value_t> written;
+  for(auto &entry : compute_modref(program))
+    written.insert(entry.second.mod.begin(), entry.second.mod.end());
+  std::vector<const void *> data, bss, rodata;
+  for(size_t i = 0; i < program.values.len; ++i) {
+    koopa_raw_value_t global = reinterpret_cast<koopa_raw_value_t>(program.values.buffer[i]);
+    if(is_zero_init(global->kind.data.global_alloc.init))
+      bss.push_back(global);
+    else
+      (written.count(global) ? data : rodata).push_back(global);
+  }
+  // 输出目标文件时初始值直接写入对应的节
+  if(obj_output) {
+    obj_globals(data, SEC_DATA);
+    obj_globals(bss, SEC_BSS);
+    obj_globals(rodata, SEC_RODATA);
+    Visit(program.funcs, 0, false);
+    return;
+  }
+  if(opt_options.rvc)
+    std::cout << "\t.option rvc\n";
+  if(!data.empty())
     std::cout << "\t.data\n";
-  Visit(program.values, 0, st_id, false);
+  Visit(make_slice(data, KOOPA_RSIK_VALUE), 0, false);
+  if(!bss.empty())
+    std::cout << "\t.bss\n";
+  Visit(make_slice(bss, KOOPA_RSIK_VALUE), 0, false);
+  if(!rodata.empty())
+    std::cout << "\t.section .rodata\n";
+  Visit(make_slice(rodata, KOOPA_RSIK_VALUE), 0, false);
   // 访问所有函数
-  Visit(program.funcs, 0, st_id, false);
+  Visit(program.funcs, 0, false);
 }
 
 // 访问 raw slice
-void Visit(const koopa_raw_slice_t &slice, int st_offset, int &st_id, bool RA_call) {
+void Visit(const koopa_raw_slice_t &slice, int st_offset, bool RA_call) {
   for (size_t i = 0; i < slice.len; ++i) {
     auto ptr = slice.buffer[i];
     // 根据 slice 的 kind 决定将 ptr 视作何种元素
     switch (slice.kind) {
       case KOOPA_RSIK_FUNCTION:
         // 访问函数
-        Visit(reinterpret_cast<koopa_raw_function_t>(ptr), st_id);
+        Visit(reinterpret_cast<koopa_raw_function_t>(ptr));
         break;
       case KOOPA_RSIK_BASIC_BLOCK:
         // 访问基本块
-        Visit(reinterpret_cast<koopa_raw_basic_block_t>(ptr), st_offset, st_id, RA_call);
+        Visit(reinterpret_cast<koopa_raw_basic_block_t>(ptr), st_offset, RA_call);
         break;
       case KOOPA_RSIK_VALUE:
         // 访问指令
-        Visit(reinterpret_cast<koopa_raw_value_t>(ptr), st_offset, st_id, RA_call);
+        Visit(reinterpret_cast<koopa_raw_value_t>(ptr), st_offset, RA_call);
         break;
       default:
         // 我们暂时不会遇到其他内容, 于是不对其做任何处理
@@ -73,56 +121,87 @@ void Visit(const koopa_raw_slice_t &slice, int st_offset, int &st_id, bool RA_ca
 }
 
 // 访问函数
-void Visit(const koopa_raw_function_t &func, int &st_id) {
+void Visit(const koopa_raw_function_t &func) {
   if(func->bbs.len == 0)
     return;
   // 执行一些其他的必要操作
-  std::cout << "\t.text" << std::endl;
-  std::cout << "\t.globl ";
-  std::cout << (func->name + 1) << std::endl;
-  std::cout << (func->name + 1) << ":\n";
+  if(!obj_output) {
+    std::cout << "\t.text" << std::endl;
+    std::cout << "\t.globl ";
+    std::cout << (func->name + 1) << std::endl;
+    std::cout << (func->name + 1) << ":\n";
+  }
 
-  // 获取存在返回值的指令数
-  unsigned int S_num = get_S_num(func->bbs);
+  // 栈帧依次为栈上传递的参数, ra, 标量与数组, 使用 s0 时其旧值保存在栈帧顶部
+  // 只有尾调用的函数无需保存 ra
   bool RA_call = false;
   unsigned int RA_num = get_RA_num(func->bbs, RA_call);
-  st_id = RA_num * 4;
-  unsigned int st_offset = (((S_num + RA_num + RA_call) * 4 + 15) / 16) * 16;
-  if(st_offset != 0){
-    if (st_offset <= 2048)
-      std::cout << "\taddi sp, sp, -" << st_offset << std::endl;
-    else{
-      std::cout << "\tli t0, -" << st_offset << std::endl;
-      std::cout << "\tadd sp, sp, t0\n";
-    }
-    if(RA_call) {
-      if(st_offset - 4 <= 2047) {
-        std::cout << "\tsw ra, " << st_offset - 4 << "(sp)\n";
-      }
-      else {
-        std::cout << "\tli t6, " << st_offset - 4 << std::endl;
-        std::cout << "\tadd t6, t6, sp\n";
-        std::cout << "\tsw ra, (t6)\n";
-      }
-    }
-  } 
-  // 访问所有基本块
-  Visit(func->bbs, st_offset, st_id, RA_call);
+  ra_offset = RA_num * 4;
+  frame = layout_frame(func, (RA_num + RA_call) * 4);
+  if(frame.base != -1)
+    frame.size += 4;
+  frame.size = ((frame.size + 15) / 16) * 16;
+  unsigned int st_offset = frame.size;
+  cfg_t cfg = build_cfg(func);
+  bb_depth.clear();
+  for(size_t i = 0; i < cfg.bbs.size(); ++i)
+    bb_depth[cfg.bbs[i]] = cfg.loop_depth[i];
+  // 跳转表直接跳到各目标, 目标与链首的栈帧状态不同 (栈帧在比较链中建立) 时仍按比较链输出
+  table_branches.clear();
+  table_conds.clear();
+  for(koopa_raw_basic_block_t bb : cfg.bbs) {
+    koopa_raw_value_t term = get_terminator(bb);
+    auto it = jump_tables.find(term);
+    if(it == jump_tables.end())
+      continue;
+    bool framed = frame.framed.count(bb);
+    std::vector<koopa_raw_basic_block_t> targets = it->second.targets;
+    targets.push_back(it->second.default_bb);
+    bool usable = true;
+    for(koopa_raw_basic_block_t target : targets)
+      usable &= (bool)frame.framed.count(target) == framed || (target == frame.setup && !framed);
+    if(!usable)
+      continue;
+    table_branches.insert(term);
+    if(it->second.cond)
+      table_conds.insert(it->second.cond);
+  }
+  // 访问所有基本块生成机器代码, 经窥孔优化, 基本块重排与指令调度后输出
+  mfunc = mfunc_t();
+  mfunc.name = func->name + 1;
+  Visit(func->bbs, st_offset, RA_call);
+  peephole(mfunc);
+  if_convert(mfunc);
+  layout_blocks(mfunc);
+  peephole(mfunc);
+  schedule(mfunc);
+  if(obj_output)
+    obj_func(mfunc);
+  else
+    print_func(mfunc);
 }
 
 // 访问基本块
-void Visit(const koopa_raw_basic_block_t &bb, int st_offset, int &st_id, bool RA_call) {
+void Visit(const koopa_raw_basic_block_t &bb, int st_offset, bool RA_call) {
   // 执行一些其他的必要操作
   // ...
   // 访问所有指令
-  std::cout << (bb->name + 1) << ":\n";
-  Visit(bb->insts, st_offset, st_id, RA_call);
+  new_block(bb->name + 1, bb_depth[bb]);
+  after_tail_call = false;
+  // 栈帧在 frame.setup 开头建立, 其余路径上不分配栈帧
+  frame_active = frame.framed.count(bb);
+  frame_base = frame_active ? frame.base : -1;
+  if(bb == frame.setup)
+    alloc_frame(st_offset, RA_call);
+  Visit(bb->insts, st_offset, RA_call);
 }
 
 // 访问指令
-void Visit(const koopa_raw_value_t &value, int st_offset, int &st_id, bool RA_call) {
+void Visit(const koopa_raw_value_t &value, int st_offset, bool RA_call) {
   // 根据指令类型判断后续需要如何访问
   const auto &kind = value->kind;
+  if(after_tail_call)
+    return;
   switch (kind.tag) {
     case KOOPA_RVT_RETURN:
       // 访问 return 指令
@@ -133,18 +212,17 @@ void Visit(const koopa_raw_value_t &value, int st_offset, int &st_id, bool RA_ca
       Visit(kind.data.integer);
       break;
     case KOOPA_RVT_BINARY:
-      Visit(kind.data.binary, st_id);
-      stack_offset[value] = st_id;
-      st_id += 4;
+      if(!table_conds.count(value))
+        Visit(kind.data.binary, value);
       break;
     case KOOPA_RVT_STORE:
-      Visit(kind.data.store, st_id, st_offset);
+      Visit(kind.data.store, st_offset);
       break;
     case KOOPA_RVT_LOAD:
-      stack_offset[value] = Visit(kind.data.load, st_id);
+      Visit(kind.data.load, value);
       break;
     case KOOPA_RVT_ALLOC:
-      Visit(value, st_id);
+      // 存储位置已由 layout_frame 分配
       break;
     case KOOPA_RVT_GLOBAL_ALLOC:
       std::cout << "\t.globl " << value->name + 1 << std::endl;
@@ -152,35 +230,29 @@ void Visit(const koopa_raw_value_t &value, int st_offset, int &st_id, bool RA_ca
       Visit(kind.data.global_alloc);
       break;
     case KOOPA_RVT_BRANCH:
-      Visit(kind.data.branch);
+      if(table_branches.count(value))
+        emit_jump_table(jump_tables.at(value));
+      else
+        Visit(kind.data.branch);
       break;
     case KOOPA_RVT_JUMP:
       Visit(kind.data.jump);
       break;
     case KOOPA_RVT_CALL:
-      Visit(kind.data.call, st_offset);
-      if(value->ty->tag != KOOPA_RTT_UNIT) {
-        stack_offset[value] = st_id;
-        if (st_id <= 2047 && st_id >= -2048) {
-          std::cout << "\tsw a0, " << st_id << "(sp)\n";
-        }
-        else {
-          std::cout << "\tli t6, " << st_id << std::endl;
-          std::cout << "\tadd t6, t6, sp\n";
-          std::cout << "\tsw a0, (t6)\n";
-        }
-        st_id += 4;
+      if(tail_calls.count(value)) {
+        Visit(kind.data.call, st_offset, RA_call, true);
+        after_tail_call = true;
+        break;
       }
+      Visit(kind.data.call, st_offset, RA_call, false);
+      if(value->ty->tag != KOOPA_RTT_UNIT)
+        write_back(value, REG_A0);
       break;
     case KOOPA_RVT_GET_ELEM_PTR:
-      Visit(kind.data.get_elem_ptr, st_id);
-      stack_offset[value] = st_id;
-      st_id += 4;
+      Visit(kind.data.get_elem_ptr, value);
       break;
     case KOOPA_RVT_GET_PTR:
-      Visit(kind.data.get_ptr, st_id);
-      stack_offset[value] = st_id;
-      st_id += 4;
+      Visit(kind.data.get_ptr, value);
       break;
     default:
       // 其他类型暂时遇不到
@@ -195,41 +267,54 @@ void Visit(const koopa_raw_value_t &value, int st_offset, int &st_id, bool RA_ca
 // 访问 return 指令
 void Visit(const koopa_raw_return_t &ret, int st_offset, bool RA_call) {
   if(!ret.value) 
-    std::cout << "\tli a0, 0\n";
-  else {
-    const auto &kind = ret.value->kind;
-    if (kind.tag == KOOPA_RVT_INTEGER)
-      std::cout << "\tli a0, " << kind.data.integer.value << std::endl;
-    else {
-      if (stack_offset[ret.value] <= 2047 && stack_offset[ret.value] >= -2048) {
-        std::cout << "\tlw a0, " << stack_offset[ret.value] << "(sp)\n";
-      }
-      else {
-        std::cout << "\tli t1, " << stack_offset[ret.value] << std::endl;
-        std::cout << "\tadd t1, t1, sp\n";
-        std::cout << "\tlw a0, (t1)\n";
-      }
-    }
-  }
-  if(st_offset != 0){
-    if(RA_call) {
-      if(st_offset - 4 <= 2047) {
-        std::cout << "\tlw ra, " << st_offset - 4 << "(sp)\n";
-      }
-      else {
-        std::cout << "\tli t6, " << st_offset - 4 << std::endl;
-        std::cout << "\tadd t6, t6, sp\n";
-        std::cout << "\tlw ra, (t6)\n";
-      }
-    }
+    emit_imm(MOP_LI, REG_A0, REG_NONE, 0);
+  else
+    move_to(REG_A0, ret.value);
+  free_frame(st_offset, RA_call);
+  emit(MOP_RET, REG_NONE, REG_NONE);
+}
+
+// 分配栈帧并保存 ra, s0 与用到的被调用者保存寄存器, 再将参数变量写入其存储位置
+void alloc_frame(int st_offset, bool RA_call) {
+  if(st_offset != 0) {
+    if (st_offset <= 2048)
+      emit_imm(MOP_ADDI, REG_SP, REG_SP, -st_offset);
+    else{
+      emit_imm(MOP_LI, REG_T0, REG_NONE, -st_offset);
+      emit(MOP_ADD, REG_SP, REG_SP, REG_T0);
+    }
+    frame_base = -1;
+    if(RA_call)
+      frame_access(MOP_SW, REG_RA, ra_offset, REG_T0);
+    for(auto &saved : frame.saved)
+      frame_access(MOP_SW, saved.first, saved.second, REG_T0);
+    if(frame.base != -1) {
+      frame_access(MOP_SW, REG_S0, st_offset - 4, REG_T0);
+      emit_imm(MOP_LI, REG_T0, REG_NONE, frame.base);
+      emit(MOP_ADD, REG_S0, REG_SP, REG_T0);
+      frame_base = frame.base;
+    }
+  }
+  for(auto &param : frame.params)
+    write_back(param.first, reg_t(REG_A0 + param.second));
+}
+
+// 恢复 ra, s0 与被调用者保存寄存器并释放栈帧
+void free_frame(int st_offset, bool RA_call) {
+  if(st_offset != 0 && frame_active){
+    if(RA_call)
+      frame_access(MOP_LW, REG_RA, ra_offset, REG_T0);
+    for(auto &saved : frame.saved)
+      frame_access(MOP_LW, saved.first, saved.second, REG_T0);
+    if(frame_base != -1)
+      frame_access(MOP_LW, REG_S0, st_offset - 4, REG_T0);
     if (st_offset <= 2047)
-      std::cout << "\taddi sp, sp, " << st_offset << std::endl;
+      emit_imm(MOP_ADDI, REG_SP, REG_SP, st_offset);
     else {
-      std::cout << "\tli t0, " << st_offset << std::endl;
-      std::cout << "\tadd sp, sp, t0\n";
+      emit_imm(MOP_LI, REG_T0, REG_NONE, st_offset);
+      emit(MOP_ADD, REG_SP, REG_SP, REG_T0);
     }
   }
-  std::cout << "\tret\n\n";
 }
 
 // 访问 integer
@@ -238,214 +323,117 @@ void Visit(const koopa_raw_integer_t &integer) {
 }
 
 // 访问 binary 运算指令
-void Visit(const koopa_raw_binary_t &binary, int &st_id) {
-  bool lhs_int = false;
-  bool rhs_int = false;
-
-  if(binary.lhs->kind.tag == KOOPA_RVT_INTEGER) { 
-    lhs_int = true;
-    if((koopa_raw_binary_op)binary.op != KOOPA_RBO_ADD)
-      std::cout << "\tli t2, " << binary.lhs->kind.data.integer.value << std::endl;
-  }
-  else{
-    if (stack_offset[binary.lhs] <= 2047 && stack_offset[binary.lhs] >= -2048) {
-      std::cout << "\tlw t2, " << stack_offset[binary.lhs] << "(sp)\n";
-    }
-    else {
-      std::cout << "\tli t4, " << stack_offset[binary.lhs] << std::endl; 
-      std::cout << "\tadd t4, sp, t4\n";
-      std::cout << "\tlw t2, (t4)\n";
-    }
-  }
-  if(binary.rhs->kind.tag == KOOPA_RVT_INTEGER) {
-    rhs_int = true;
-    if((koopa_raw_binary_op)binary.op != KOOPA_RBO_ADD)
-      std::cout << "\tli t3, " << binary.rhs->kind.data.integer.value << std::endl;
+void Visit(const koopa_raw_binary_t &binary, koopa_raw_value_t value) {
+  reg_t rd = write_reg(value, REG_T0);
+  if((koopa_raw_binary_op)binary.op == KOOPA_RBO_ADD && binary.lhs->kind.tag == KOOPA_RVT_INTEGER &&
+     binary.rhs->kind.tag == KOOPA_RVT_INTEGER && binary.lhs->kind.data.integer.value == 0) {
+    emit_imm(MOP_LI, rd, REG_NONE, binary.rhs->kind.data.integer.value);
+    write_back(value, rd);
+    return;
   }
-  else{
-    if (stack_offset[binary.rhs] <= 2047 && stack_offset[binary.rhs] >= -2048) {
-      std::cout << "\tlw t3, " << stack_offset[binary.rhs] << "(sp)\n";
-    }
-    else {
-      std::cout << "\tli t4, " << stack_offset[binary.rhs] << std::endl; 
-      std::cout << "\tadd t4, sp, t4\n";
-      std::cout << "\tlw t3, (t4)\n";
+  // 有 Zba 时乘以 3, 5, 9 改为移位相加
+  if((koopa_raw_binary_op)binary.op == KOOPA_RBO_MUL && opt_options.zba) {
+    for(int k = 0; k < 2; ++k) {
+      koopa_raw_value_t factor = k ? binary.lhs : binary.rhs, other = k ? binary.rhs : binary.lhs;
+      if(factor->kind.tag != KOOPA_RVT_INTEGER)
+        continue;
+      int shift = shadd_shift(factor->kind.data.integer.value - 1);
+      if(shift == 0)
+        continue;
+      reg_t src = read_value(other, REG_T0);
+      emit(shadd_op(shift), rd, src, src);
+      write_back(value, rd);
+      return;
     }
   }
+  reg_t lhs = read_value(binary.lhs, REG_T0);
+  reg_t rhs = read_value(binary.rhs, REG_T1);
 
   switch((koopa_raw_binary_op)binary.op) {
     case KOOPA_RBO_NOT_EQ:
-      std::cout << "\txor t4, t2, t3\n";
-      std::cout << "\tsnez t4, t4\n";
+      emit(MOP_XOR, rd, lhs, rhs);
+      emit(MOP_SNEZ, rd, rd);
       break;
     case KOOPA_RBO_EQ:
-      std::cout << "\txor t4, t2, t3\n";
-      std::cout << "\tseqz t4, t4\n";
+      emit(MOP_XOR, rd, lhs, rhs);
+      emit(MOP_SEQZ, rd, rd);
       break;
     case KOOPA_RBO_GT:
-      std::cout << "\tsgt t4, t2, t3\n";
+      emit(MOP_SGT, rd, lhs, rhs);
       break;
     case KOOPA_RBO_LT:
-      std::cout << "\tslt t4, t2, t3\n";
+      emit(MOP_SLT, rd, lhs, rhs);
       break;
     case KOOPA_RBO_GE:
-      std::cout << "\tslt t4, t2, t3\n";
-      std::cout << "\tseqz t4, t4\n";
+      emit(MOP_SLT, rd, lhs, rhs);
+      emit(MOP_SEQZ, rd, rd);
       break;
     case KOOPA_RBO_LE:
-      std::cout << "\tsgt t4, t2, t3\n";
-      std::cout << "\tseqz t4, t4\n";
+      emit(MOP_SGT, rd, lhs, rhs);
+      emit(MOP_SEQZ, rd, rd);
       break;
     case KOOPA_RBO_ADD:
-      if(lhs_int && rhs_int && binary.lhs->kind.data.integer.value == 0)
-        std::cout << "\tli t4, " << binary.rhs->kind.data.integer.value << std::endl;
-      else {
-        if(lhs_int)
-          std::cout << "\tli t2, " << binary.lhs->kind.data.integer.value << std::endl;
-        if(rhs_int)
-          std::cout << "\tli t3, " << binary.rhs->kind.data.integer.value << std::endl;
-        std::cout << "\tadd t4, t2, t3\n";
-      }
+      emit(MOP_ADD, rd, lhs, rhs);
       break;
     case KOOPA_RBO_SUB:
-      std::cout << "\tsub t4, t2, t3\n";
+      emit(MOP_SUB, rd, lhs, rhs);
       break;
     case KOOPA_RBO_MUL:
-      std::cout << "\tmul t4, t2, t3\n";
+      emit(MOP_MUL, rd, lhs, rhs);
       break;
     case KOOPA_RBO_DIV:
-      std::cout << "\tdiv t4, t2, t3\n";
+      emit(MOP_DIV, rd, lhs, rhs);
       break;
     case KOOPA_RBO_MOD:
-      std::cout << "\trem t4, t2, t3\n";
+      emit(MOP_REM, rd, lhs, rhs);
       break;
     case KOOPA_RBO_AND:
-      std::cout << "\tand t4, t2, t3\n";
+      emit(MOP_AND, rd, lhs, rhs);
       break;
     case KOOPA_RBO_OR:
-      std::cout << "\tor t4, t2, t3\n";
+      emit(MOP_OR, rd, lhs, rhs);
       break;
     default:
       assert(false);
   }
-  if (st_id <= 2047 && st_id >= -2048) {
-    std::cout << "\tsw t4, " << st_id << "(sp)\n";
-  }
-  else {
-    std::cout << "\tli t6, " << st_id << std::endl;
-    std::cout << "\tadd t6, sp, t6\n";
-    std::cout << "\tsw t4, (t6)\n";
-  }
+  write_back(value, rd);
 }
 
 // 访问 store 指令
-void Visit(const koopa_raw_store_t &store, int &st_id, int st_offset) {
-  if(store.value->kind.tag == KOOPA_RVT_INTEGER)
-    std::cout << "\tli t0, " << store.value->kind.data.integer.value << std::endl;
-  else if(store.value->kind.tag == KOOPA_RVT_FUNC_ARG_REF) {
-    if(store.value->kind.data.func_arg_ref.index < 8)
-      std::cout << "\tmv t0, a" << store.value->kind.data.func_arg_ref.index << std::endl;
-    else {
-      if ((store.value->kind.data.func_arg_ref.index - 8) * 4 + st_offset <= 2047 &&
-          (store.value->kind.data.func_arg_ref.index - 8) * 4 + st_offset >= -2048) {
-        std::cout << "\tlw t0, " << (store.value->kind.data.func_arg_ref.index - 8) * 4 + st_offset << "(sp)\n";
-      }
-      else {
-        std::cout << "\tli t6, " << (store.value->kind.data.func_arg_ref.index - 8) * 4 + st_offset << std::endl;
-        std::cout << "\tadd t6, t6, sp\n";
-        std::cout << "\tlw t0, (t6)\n";
-      }
-    }
-  }
-  else {
-    if (stack_offset[store.value] <= 2047 && stack_offset[store.value] >= -2048) {
-      std::cout << "\tlw t0, " << stack_offset[store.value] << "(sp)\n";
-    }
-    else {
-      std::cout << "\tli t6, " << stack_offset[store.value] << std::endl;
-      std::cout << "\tadd t6, sp, t6\n";
-      std::cout << "\tlw t0, (t6)\n";
-    }
+void Visit(const koopa_raw_store_t &store, int st_offset) {
+  if(store.dest->kind.tag == KOOPA_RVT_ALLOC) {
+    // 参数变量在建立栈帧时写入
+    if(param_index(frame, store.dest) != -1)
+      return;
+    if(value_reg.count(store.dest))
+      move_to(value_reg[store.dest], store.value);
+    else
+      frame_access(MOP_SW, read_value(store.value, REG_T0), stack_offset[store.dest], REG_T1);
+    return;
   }
+  reg_t val = read_value(store.value, REG_T0);
   if(store.dest->kind.tag == KOOPA_RVT_GLOBAL_ALLOC) {
-    std::cout << "\tla t6, " << store.dest->name + 1 << std::endl;
-    std::cout << "\tsw t0, (t6)\n";
-  }
-  else if(store.dest->kind.tag == KOOPA_RVT_GET_ELEM_PTR ||
-          store.dest->kind.tag == KOOPA_RVT_GET_PTR) {
-    if(stack_offset[store.dest] == 0)
-      std::cout << "\tlw t6, (sp)\n";
-    else {
-      if (stack_offset[store.dest] <= 2047 && stack_offset[store.dest] >= -2048) {
-        std::cout << "\tlw t5, " << stack_offset[store.dest] << "(sp)\n";
-      }
-      else {
-        std::cout << "\tli t6, " << stack_offset[store.dest] << std::endl;
-        std::cout << "\tadd t6, t6, sp\n";
-        std::cout << "\tlw t5, (t6)\n";
-      }
-      std::cout << "\tsw t0, (t5)\n";
-    }
-  }
-  else {
-    if(stack_offset.find(store.dest) == stack_offset.end()) {
-      stack_offset[store.dest] = st_id;
-      st_id += 4;
-    }
-    if (stack_offset[store.dest] <= 2047 && stack_offset[store.dest] >= -2048) {
-      std::cout << "\tsw t0, " << stack_offset[store.dest] << "(sp)\n";
-    }
-    else {
-      std::cout << "\tli t6, " << stack_offset[store.dest] << std::endl;
-      std::cout << "\tadd t6, sp, t6\n";
-      std::cout << "\tsw t0, (t6)\n";
-    }
+    emit_sym(MOP_LA, REG_T1, store.dest->name + 1);
+    emit_mem(MOP_SW, val, 0, REG_T1);
   }
+  else
+    // 地址为 getelemptr / getptr / 读取指针变量的结果
+    emit_mem(MOP_SW, val, 0, read_value(store.dest, REG_T1));
 }
 
 // 访问 load 指令
-int Visit(const koopa_raw_load_t &load, int &st_id) {
+void Visit(const koopa_raw_load_t &load, koopa_raw_value_t value) {
+  // 读取局部变量的结果在使用时才从变量的存储位置读出
+  if(load.src->kind.tag == KOOPA_RVT_ALLOC)
+    return;
+  reg_t rd = write_reg(value, REG_T0);
   if(load.src->kind.tag == KOOPA_RVT_GLOBAL_ALLOC) {
-    std::cout << "\tla t0, " << load.src->name + 1 << std::endl;
-    std::cout << "\tlw t1, 0(t0)\n";
-    if (st_id <= 2047 && st_id >= -2048) {
-      std::cout << "\tsw t1, " << st_id << "(sp)\n";
-    }
-    else {
-      std::cout << "\tli t6, " << st_id << std::endl;
-      std::cout << "\tadd t6, t6, sp\n";
-      std::cout << "\tsw t1, (t6)\n";
-    }
-    st_id += 4;
-    return st_id - 4;
-  }
-  else if(load.src->kind.tag == KOOPA_RVT_GET_ELEM_PTR ||
-          load.src->kind.tag == KOOPA_RVT_GET_PTR) {
-    if(stack_offset[load.src] == 0)
-      std::cout << "\tlw t1, (sp)\n";
-    else {
-      if (stack_offset[load.src] <= 2047 && stack_offset[load.src] >= -2048) {
-        std::cout << "\tlw t1, " << stack_offset[load.src] << "(sp)\n";
-      }
-      else {
-        std::cout << "\tli t6, " << stack_offset[load.src] << std::endl;
-        std::cout << "\tadd t6, t6, sp\n";
-        std::cout << "\tlw t1, (t6)\n";
-      }
-    }
-    std::cout << "\tlw t2, (t1)\n";
-    if (st_id <= 2047 && st_id >= -2048) {
-      std::cout << "\tsw t2, " << st_id << "(sp)\n";
-    }
-    else {
-      std::cout << "\tli t6, " << st_id << std::endl;
-      std::cout << "\tadd t6, t6, sp\n";
-      std::cout << "\tsw t2, (t6)\n";
-    }
-    st_id += 4;
-    return st_id - 4;
+    emit_sym(MOP_LA, REG_T0, load.src->name + 1);
+    emit_mem(MOP_LW, rd, 0, REG_T0);
   }
-  return stack_offset[load.src];
+  else
+    emit_mem(MOP_LW, rd, 0, read_value(load.src, REG_T0));
+  write_back(value, rd);
 }
 
 // 访问 global alloc 指令
@@ -462,304 +450,388 @@ void Visit(const koopa_raw_global_alloc_t &global_alloc) {
   }
 }
 
-// 访问 aggregate, 获取初始化数据
+// 访问 aggregate, 获取初始化数据, 连续的 0 合并为一条 .zero
 void Visit(const koopa_raw_aggregate_t &aggregate) {
-  for(size_t i = 0; i < aggregate.elems.len; ++i) {
-    koopa_raw_value_t ptr = reinterpret_cast<koopa_raw_value_t>(aggregate.elems.buffer[i]);
-    if(ptr->kind.tag == KOOPA_RVT_INTEGER)
-      std::cout << "\t.word " << ptr->kind.data.integer.value << std::endl;
+  std::vector<int> words;
+  for(size_t i = 0; i < aggregate.elems.len; ++i)
+    flatten_init(reinterpret_cast<koopa_raw_value_t>(aggregate.elems.buffer[i]), words);
+  size_t i = 0;
+  while(i < words.size()) {
+    size_t j = i;
+    while(j < words.size() && words[j] == 0)
+      j++;
+    if(j > i) {
+      std::cout << "\t.zero " << (j - i) * 4 << std::endl;
+      i = j;
+    }
     else
-      Visit(ptr->kind.data.aggregate);
+      std::cout << "\t.word " << words[i++] << std::endl;
   }
 }
 
-// 访问 branch 指令
-void Visit(const koopa_raw_branch_t &branch) {
-  if(branch.cond->kind.tag == KOOPA_RVT_INTEGER)
-    std::cout << "\tli t0, " << branch.cond->kind.data.integer.value << std::endl;
+// 将全局变量的初始值写入目标文件的节 sec, .bss 中只需要大小
+void obj_globals(const std::vector<const void *> &globals, msec_t sec) {
+  for(const void *ptr : globals) {
+    koopa_raw_value_t global = reinterpret_cast<koopa_raw_value_t>(ptr);
+    koopa_raw_value_t init = global->kind.data.global_alloc.init;
+    std::vector<int> words;
+    if(sec != SEC_BSS)
+      flatten_init(init, words);
+    obj_data(sec, global->name + 1, words, calc_size(init->ty));
+  }
+}
+
+// 将初始值按顺序展开为字
+void flatten_init(const koopa_raw_value_t &init, std::vector<int> &words) {
+  if(init->kind.tag == KOOPA_RVT_INTEGER)
+    words.push_back(init->kind.data.integer.value);
+  else if(init->kind.tag == KOOPA_RVT_ZERO_INIT)
+    words.insert(words.end(), calc_size(init->ty) / 4, 0);
   else {
-    if (stack_offset[branch.cond] <= 2047 && stack_offset[branch.cond] >= -2048) {
-      std::cout << "\tlw t0, " << stack_offset[branch.cond] << "(sp)\n";
-    }
-    else {
-      std::cout << "\tli t6, " << stack_offset[branch.cond] << std::endl;
-      std::cout << "\tadd t6, sp, t6\n";
-      std::cout << "\tlw t0, (t6)\n";
-    }
+    const koopa_raw_slice_t &elems = init->kind.data.aggregate.elems;
+    for(size_t i = 0; i < elems.len; ++i)
+      flatten_init(reinterpret_cast<koopa_raw_value_t>(elems.buffer[i]), words);
   }
-  std::cout << "\tbnez t0, " << "median_branch" << (branch.true_bb->name + 1) << std::endl;
-  std::cout << "\tbeqz t0, " << "median_branch" << (branch.false_bb->name + 1) << std::endl;
-  std::cout << "median_branch" << (branch.true_bb->name + 1) << ":" << std::endl;
-  std::cout << "\tj " << (branch.true_bb->name + 1) << std::endl;
-  std::cout << "median_branch" << (branch.false_bb->name + 1) << ":" << std::endl;
-  std::cout << "\tj " << (branch.false_bb->name + 1) << std::endl;
+}
+
+// 初始值是否全为 0
+bool is_zero_init(const koopa_raw_value_t &init) {
+  if(init->kind.tag == KOOPA_RVT_INTEGER)
+    return init->kind.data.integer.value == 0;
+  if(init->kind.tag == KOOPA_RVT_ZERO_INIT)
+    return true;
+  const koopa_raw_slice_t &elems = init->kind.data.aggregate.elems;
+  for(size_t i = 0; i < elems.len; ++i)
+    if(!is_zero_init(reinterpret_cast<koopa_raw_value_t>(elems.buffer[i])))
+      return false;
+  return true;
+}
+
+// 访问 branch 指令
+void Visit(const koopa_raw_branch_t &branch) {
+  reg_t cond = read_value(branch.cond, REG_T0);
+  // 同一基本块可能是多条 branch 的目标, 中转标号需要加上编号区分
+  unsigned int id = median_branch_id++;
+  std::string true_label = "median_branch" + std::to_string(id) + "_" + (branch.true_bb->name + 1);
+  std::string false_label = "median_branch" + std::to_string(id) + "_" + (branch.false_bb->name + 1);
+  emit_sym(MOP_BNEZ, cond, true_label);
+  emit_sym(MOP_BEQZ, cond, false_label);
+  int depth = mfunc.blocks.back().depth;
+  new_block(true_label, depth);
+  emit_sym(MOP_J, REG_NONE, branch.true_bb->name + 1);
+  new_block(false_label, depth);
+  emit_sym(MOP_J, REG_NONE, branch.false_bb->name + 1);
 }
 
 // 访问 jump 指令
 void Visit(const koopa_raw_jump_t &jump) {
-  std::cout << "\tj " << (jump.target->name + 1) << std::endl;
+  emit_sym(MOP_J, REG_NONE, jump.target->name + 1);
 }
 
-// 访问 call 指令
-void Visit(const koopa_raw_call_t &call, int st_offset) {
+// 按跳转表分派: 下标 value - low 不小于表长 (无符号比较) 时跳到 default_bb, 否则取出表项跳转
+// 临时寄存器不跨越条件跳转保留, 边界检查之后重新计算下标
+void emit_jump_table(const jump_table_t &table) {
+  auto index = [&]() {
+    reg_t value = read_value(table.value, REG_T0);
+    if(table.low == 0)
+      return value;
+    emit_imm(MOP_LI, REG_T1, REG_NONE, table.low);
+    emit(MOP_SUB, REG_T0, value, REG_T1);
+    return REG_T0;
+  };
+  emit_imm(MOP_SLTIU, REG_T1, index(), table.targets.size());
+  emit_sym(MOP_BEQZ, REG_T1, table.default_bb->name + 1);
+  reg_t reg = index();
+  mtable_t mtable;
+  mtable.sym = intern_sym(mfunc, ".Ljt" + std::to_string(mfunc.tables.size()) + "_" + mfunc.name);
+  for(koopa_raw_basic_block_t target : table.targets)
+    mtable.labels.push_back(intern_sym(mfunc, target->name + 1));
+  emit_sym(MOP_LA, REG_T1, mfunc.syms[mtable.sym]);
+  if(opt_options.zba)
+    emit(MOP_SH2ADD, REG_T0, reg, REG_T1);
+  else {
+    emit_imm(MOP_SLLI, REG_T0, reg, 2);
+    emit(MOP_ADD, REG_T0, REG_T0, REG_T1);
+  }
+  emit_mem(MOP_LW, REG_T0, 0, REG_T0);
+  emit_imm(MOP_JR, REG_NONE, REG_T0, mfunc.tables.size());
+  mfunc.tables.push_back(mtable);
+}
+
+// 访问 call 指令, 尾调用在释放栈帧后直接跳转到被调用函数
+// 栈上传递的参数先写入, 寄存器中的实参整体复制到 a0 - a7, 最后写入常量与栈上的实参
+void Visit(const koopa_raw_call_t &call, int st_offset, bool RA_call, bool tail) {
   int param_id = 0;
   int param_len = call.args.len;
-  for(int i = 0; i < param_len; ++i) {
+  for(int i = 8; i < param_len; ++i) {
     koopa_raw_value_t ptr = reinterpret_cast<koopa_raw_value_t>(call.args.buffer[i]);
-    if(ptr->kind.tag == KOOPA_RVT_INTEGER) {
-      if(i < 8) {
-        std::cout << "\tli a" << i << ", " << ptr->kind.data.integer.value << std::endl;
-      }
-      else {
-        std::cout << "\tli t0, " << ptr->kind.data.integer.value << std::endl;
-        if (param_id <= 2047 && param_id >= -2048) {
-          std::cout << "\tsw t0, " << param_id << "(sp)\n";
-        }
-        else {
-          std::cout << "\tli t6, " << param_id << std::endl;
-          std::cout << "\tadd t6, t6, sp\n";
-          std::cout << "\tsw t0, (t6)\n";
-        }
-        param_id += 4;
-      }
-    }
-    else {
-      if(stack_offset.find(ptr) == stack_offset.end()) {
-        std::cerr << "Error: Invalid parameter.\n";
-      }
-      else {
-        if(i < 8) {
-          if (stack_offset[ptr] <= 2047 && stack_offset[ptr] >= -2048) {
-            std::cout << "\tlw a" << i << ", " << stack_offset[ptr] << "(sp)\n";
-          }
-          else {
-            std::cout << "\tli t6, " << stack_offset[ptr] << std::endl;
-            std::cout << "\tadd t6, t6, sp\n";
-            std::cout << "\tlw a" << i << ", (t6)\n";
-          }
-        }
-        else {
-          if (stack_offset[ptr] <= 2047 && stack_offset[ptr] >= -2048) {
-            std::cout << "\tlw t0, " << stack_offset[ptr] << "(sp)\n";
-          }
-          else {
-            std::cout << "\tli t6, " << stack_offset[ptr] << std::endl;
-            std::cout << "\tadd t6, t6, sp\n";
-            std::cout << "\tlw t0, (t6)\n";
-          }
-          if (param_id <= 2047 && param_id >= -2048) {
-            std::cout << "\tsw t0, " << param_id << "(sp)\n";
-          }
-          else {
-            std::cout << "\tli t6, " << param_id << std::endl;
-            std::cout << "\tadd t6, t6, sp\n";
-            std::cout << "\tsw t0, (t6)\n";
-          }
-          param_id += 4;
-        }  
-      }
-    }
+    frame_access(MOP_SW, read_value(ptr, REG_T0), param_id, REG_T1);
+    param_id += 4;
   }
-  std::cout << "\tcall " << call.callee->name + 1 << std::endl;
+  std::vector<std::pair<reg_t, reg_t> > moves;
+  std::vector<int> rest;
+  for(int i = 0; i < param_len && i < 8; ++i) {
+    koopa_raw_value_t ptr = reinterpret_cast<koopa_raw_value_t>(call.args.buffer[i]);
+    reg_t reg = value_in_reg(ptr);
+    if(reg == REG_NONE)
+      rest.push_back(i);
+    else
+      moves.push_back({reg_t(REG_A0 + i), reg});
+  }
+  parallel_move(moves);
+  for(int i : rest)
+    move_to(reg_t(REG_A0 + i), reinterpret_cast<koopa_raw_value_t>(call.args.buffer[i]));
+  if(tail) {
+    free_frame(st_offset, RA_call);
+    emit_sym(MOP_TAIL, REG_NONE, call.callee->name + 1);
+  }
+  else
+    emit_sym(MOP_CALL, REG_NONE, call.callee->name + 1);
+  // 调用指令的 imm 记录通过寄存器传递的参数个数
+  mfunc.insts.back().imm = std::min(param_len, 8);
 }
 
 // 访问 get_elem_ptr 指令
-void Visit(const koopa_raw_get_elem_ptr_t &get_elem_ptr, int &st_id) {
+void Visit(const koopa_raw_get_elem_ptr_t &get_elem_ptr, koopa_raw_value_t value) {
   size_t off_size;
   if(get_elem_ptr.src->ty->data.pointer.base->tag == KOOPA_RTT_INT32)
     off_size = calc_size(get_elem_ptr.src->ty->data.pointer.base);
   else
     off_size = calc_size(get_elem_ptr.src->ty->data.pointer.base) / (get_elem_ptr.src->ty->data.pointer.base->data.array.len);
-  if(get_elem_ptr.src->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
-    std::cout << "\tla t6, " << get_elem_ptr.src->name + 1 << std::endl;
-  else if(get_elem_ptr.src->kind.tag == KOOPA_RVT_ALLOC) {
-    std::cout << "\tli t6, " << stack_offset[get_elem_ptr.src] << std::endl;
-    std::cout << "\tadd t6, t6, sp\n";
-  }
-  else {
-    if (stack_offset[get_elem_ptr.src] <= 2047 && stack_offset[get_elem_ptr.src] >= -2048) {
-      std::cout << "\tlw t6, " << stack_offset[get_elem_ptr.src] << "(sp)\n";
-    }
-    else {
-      std::cout << "\tli t5, " << stack_offset[get_elem_ptr.src] << std::endl;
-      std::cout << "\tadd t5, t5, sp\n";
-      std::cout << "\tlw t6, (t5)\n";
-    }
-  }
+  elem_addr(get_elem_ptr.src, get_elem_ptr.index, off_size, value);
+}
 
-  if(get_elem_ptr.index->kind.tag == KOOPA_RVT_INTEGER) {
-    if(get_elem_ptr.index->kind.data.integer.value == 0) {
-      if (st_id <= 2047 && st_id >= -2048) {
-        std::cout << "\tsw t6, " << st_id << "(sp)\n";
-      }
-      else {
-        std::cout << "\tli t1, " << st_id << std::endl;
-        std::cout << "\tadd t1, t1, sp\n";
-        std::cout << "\tsw t6, (t1)\n";
-      }
+// 访问 get_ptr 指令
+void Visit(const koopa_raw_get_ptr_t &get_ptr, koopa_raw_value_t value) {
+  size_t off_size = calc_size(get_ptr.src->ty->data.pointer.base);
+  elem_addr(get_ptr.src, get_ptr.index, off_size, value);
+}
+
+// 计算 src + index * off_size 并写入 value 的存储位置
+void elem_addr(koopa_raw_value_t src, koopa_raw_value_t index, size_t off_size, koopa_raw_value_t value) {
+  reg_t rd = write_reg(value, REG_T0);
+  if(index->kind.tag == KOOPA_RVT_INTEGER) {
+    // 常量下标直接计算偏移量, 局部数组的偏移并入栈帧偏移
+    long long offset = (long long)index->kind.data.integer.value * off_size;
+    if(src->kind.tag == KOOPA_RVT_ALLOC) {
+      frame_addr(rd, stack_offset[src] + (int)offset);
+      write_back(value, rd);
       return;
     }
+    reg_t base = rd;
+    if(src->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
+      emit_sym(MOP_LA, rd, src->name + 1);
     else
-      std::cout << "\tli t1, " << get_elem_ptr.index->kind.data.integer.value << std::endl;
-  }
-  else {
-    if (stack_offset[get_elem_ptr.index] <= 2047 && stack_offset[get_elem_ptr.index] >= -2048) {
-      std::cout << "\tlw t1, " << stack_offset[get_elem_ptr.index] << "(sp)\n";
+      base = read_value(src, REG_T0);
+    if(offset <= 2047 && offset >= -2048) {
+      if(offset != 0)
+        emit_imm(MOP_ADDI, rd, base, offset);
+      else if(base != rd)
+        emit(MOP_MV, rd, base);
     }
     else {
-      std::cout << "\tli t5, " << stack_offset[get_elem_ptr.index] << std::endl;
-      std::cout << "\tadd t5, t5, sp\n";
-      std::cout << "\tlw t1, (t5)\n";
+      emit_imm(MOP_LI, REG_T1, REG_NONE, (int)offset);
+      emit(MOP_ADD, rd, base, REG_T1);
     }
+    write_back(value, rd);
+    return;
   }
-  std::cout << "\tli t2, " << off_size << std::endl;
-  std::cout << "\tmul t1, t1, t2\n";
-  std::cout << "\tadd t6, t6, t1\n";
-  if (st_id <= 2047 && st_id >= -2048) {
-    std::cout << "\tsw t6, " << st_id << "(sp)\n";
-  }
-  else {
-    std::cout << "\tli t1, " << st_id << std::endl;
-    std::cout << "\tadd t1, t1, sp\n";
-    std::cout << "\tsw t6, (t1)\n";
-  }
+  // 有 Zba 时元素大小为 2, 4, 8 的下标用一条 sh1add / sh2add / sh3add 完成缩放与相加
+  int shift = opt_options.zba ? shadd_shift(off_size) : 0;
+  reg_t idx = shift ? read_value(index, REG_T1) : REG_T1;
+  if(!shift)
+    scale_index(read_value(index, REG_T1), off_size);
+  reg_t base = REG_T0;
+  if(src->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
+    emit_sym(MOP_LA, REG_T0, src->name + 1);
+  else if(src->kind.tag == KOOPA_RVT_ALLOC)
+    frame_addr(REG_T0, stack_offset[src]);
+  else
+    base = read_value(src, REG_T0);
+  if(shift)
+    emit(shadd_op(shift), rd, idx, base);
+  else
+    emit(MOP_ADD, rd, base, REG_T1);
+  write_back(value, rd);
 }
 
-// 访问 get_ptr 指令
-void Visit(const koopa_raw_get_ptr_t &get_ptr, int &st_id) {
-  size_t off_size = 0;
-  if(get_ptr.src->ty->data.pointer.base->tag == KOOPA_RTT_INT32)
-    off_size = calc_size(get_ptr.src->ty->data.pointer.base);
-  else
-    off_size = calc_size(get_ptr.src->ty->data.pointer.base);
+// factor 为 2, 4, 8 时返回 Zba 移位相加指令的移位量, 否则返回 0
+int shadd_shift(long long factor) {
+  return factor == 2 ? 1 : factor == 4 ? 2 : factor == 8 ? 3 : 0;
+}
 
-  if(get_ptr.src->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
-    std::cout << "\tla t6, " << get_ptr.src->name + 1 << std::endl;
-  else if(get_ptr.src->kind.tag == KOOPA_RVT_ALLOC) {
-    std::cout << "\tli t6, " << stack_offset[get_ptr.src] << std::endl;
-    std::cout << "\tadd t6, t6, sp\n";
-  }
-  else {
-    if (stack_offset[get_ptr.src] <= 2047 && stack_offset[get_ptr.src] >= -2048) {
-      std::cout << "\tlw t6, " << stack_offset[get_ptr.src] << "(sp)\n";
-    }
-    else {
-      std::cout << "\tli t5, " << stack_offset[get_ptr.src] << std::endl;
-      std::cout << "\tadd t5, t5, sp\n";
-      std::cout << "\tlw t6, (t5)\n";
-    }
-  }
+mop_t shadd_op(int shift) {
+  return shift == 1 ? MOP_SH1ADD : shift == 2 ? MOP_SH2ADD : MOP_SH3ADD;
+}
 
-  if(get_ptr.index->kind.tag == KOOPA_RVT_INTEGER) {
-    if(get_ptr.index->kind.data.integer.value == 0) {
-      if (st_id <= 2047 && st_id >= -2048) {
-        std::cout << "\tsw t6, " << st_id << "(sp)\n";
-      }
-      else {
-        std::cout << "\tli t1, " << st_id << std::endl;
-        std::cout << "\tadd t1, t1, sp\n";
-        std::cout << "\tsw t6, (t1)\n";
-      }
-      return;
-    }
-    else
-      std::cout << "\tli t1, " << get_ptr.index->kind.data.integer.value << std::endl;
-  }
-  else {
-    if (stack_offset[get_ptr.index] <= 2047 && stack_offset[get_ptr.index] >= -2048) {
-      std::cout << "\tlw t1, " << stack_offset[get_ptr.index] << "(sp)\n";
-    }
-    else {
-      std::cout << "\tli t5, " << stack_offset[get_ptr.index] << std::endl;
-      std::cout << "\tadd t5, t5, sp\n";
-      std::cout << "\tlw t1, (t5)\n";
-    }
-  }
-  std::cout << "\tli t2, " << off_size << std::endl;
-  std::cout << "\tmul t1, t1, t2\n";
-  std::cout << "\tadd t6, t6, t1\n";
-  if (st_id <= 2047 && st_id >= -2048) {
-    std::cout << "\tsw t6, " << st_id << "(sp)\n";
+// 将 index 中的下标乘以元素大小存入 t1, 元素大小为 2 的幂时用移位代替乘法
+void scale_index(reg_t index, size_t off_size) {
+  if(off_size != 0 && (off_size & (off_size - 1)) == 0) {
+    int shift = 0;
+    while((1u << shift) != off_size)
+      shift++;
+    if(shift != 0)
+      emit_imm(MOP_SLLI, REG_T1, index, shift);
+    else if(index != REG_T1)
+      emit(MOP_MV, REG_T1, index);
   }
   else {
-    std::cout << "\tli t1, " << st_id << std::endl;
-    std::cout << "\tadd t1, t1, sp\n";
-    std::cout << "\tsw t6, (t1)\n";
+    emit_imm(MOP_LI, REG_T2, REG_NONE, off_size);
+    emit(MOP_MUL, REG_T1, index, REG_T2);
   }
 }
 
-// 访问 alloc 指令
-void Visit(const koopa_raw_value_t &value, int &st_id) {
-  koopa_raw_type_kind_t *base;
-  int arr_size;
-  switch(value->ty->data.pointer.base->tag) {
-    case KOOPA_RTT_INT32:
-      stack_offset[value] = st_id;
-      st_id += 4;
+// 值已在寄存器中时返回该寄存器, 否则返回 REG_NONE
+// 未建立栈帧的基本块中, 参数变量仍在传入它的 a 寄存器中
+reg_t value_in_reg(koopa_raw_value_t value) {
+  koopa_raw_value_t var = value;
+  if(var->kind.tag == KOOPA_RVT_LOAD)
+    var = var->kind.data.load.src;
+  int index = frame_active ? -1 : param_index(frame, var);
+  if(index != -1)
+    return reg_t(REG_A0 + index);
+  auto it = value_reg.find(value);
+  return it == value_reg.end() ? REG_NONE : it->second;
+}
+
+// 读取值: 在寄存器中时直接返回该寄存器, 否则读入 scratch 并返回 scratch, 常量 0 返回 zero
+reg_t read_value(koopa_raw_value_t value, reg_t scratch) {
+  reg_t reg = value_in_reg(value);
+  if(reg != REG_NONE)
+    return reg;
+  switch(value->kind.tag) {
+    case KOOPA_RVT_INTEGER:
+      if(value->kind.data.integer.value == 0)
+        return REG_ZERO;
+      emit_imm(MOP_LI, scratch, REG_NONE, value->kind.data.integer.value);
       break;
-    case KOOPA_RTT_ARRAY:
-      base = (koopa_raw_type_kind_t *)(value->ty->data.pointer.base);
-      arr_size = 4;
-      while(base->tag != KOOPA_RTT_INT32) {
-        arr_size *= base->data.array.len;
-        base = (koopa_raw_type_kind_t *)(base->data.array.base);
-      }
-      stack_offset[value] = st_id;
-      st_id += arr_size;
+    case KOOPA_RVT_GLOBAL_ALLOC:
+      emit_sym(MOP_LA, scratch, value->name + 1);
       break;
-    case KOOPA_RTT_POINTER:
-      stack_offset[value] = st_id;
-      st_id += 4;
+    case KOOPA_RVT_ALLOC:
+      frame_addr(scratch, stack_offset[value]);
       break;
+    case KOOPA_RVT_FUNC_ARG_REF: {
+      int index = value->kind.data.func_arg_ref.index;
+      if(index < 8)
+        return reg_t(REG_A0 + index);
+      // 栈上传递的参数位于调用者的栈帧中
+      frame_access(MOP_LW, scratch, (frame_active ? frame.size : 0) + (index - 8) * 4, scratch);
+      break;
+    }
     default:
-      assert(false);
+      frame_access(MOP_LW, scratch, stack_offset[value], scratch);
   }
+  return scratch;
 }
 
-// 访问 raw slice, 获取存在返回值的指令个数
-unsigned int get_S_num(const koopa_raw_slice_t &slice) {
-  unsigned int S_num = 0;
-  for (size_t i = 0; i < slice.len; ++i) {
-    auto ptr = slice.buffer[i];
-    // 根据 slice 的 kind 决定将 ptr 视作何种元素
-    switch (slice.kind) {
-      case KOOPA_RSIK_BASIC_BLOCK:
-        // 访问基本块
-        S_num += get_S_num(reinterpret_cast<koopa_raw_basic_block_t>(ptr)->insts);
-        break;
-      case KOOPA_RSIK_VALUE:
-        // 访问指令
-        S_num += get_S_num(reinterpret_cast<koopa_raw_value_t>(ptr));
-        break;
-      default:
-        // 我们暂时不会遇到其他内容, 于是不对其做任何处理
-        assert(false);
-    }
+// 将值读入指定寄存器 reg
+void move_to(reg_t reg, koopa_raw_value_t value) {
+  reg_t src = read_value(value, reg);
+  if(src == REG_ZERO)
+    emit_imm(MOP_LI, reg, REG_NONE, 0);
+  else if(src != reg)
+    emit(MOP_MV, reg, src);
+}
+
+// 计算值时写入的寄存器: 分配到的寄存器, 在栈上时为 scratch
+reg_t write_reg(koopa_raw_value_t value, reg_t scratch) {
+  auto it = value_reg.find(value);
+  return it == value_reg.end() ? scratch : it->second;
+}
+
+// 将 reg 中计算出的值写入 value 的存储位置
+void write_back(koopa_raw_value_t value, reg_t reg) {
+  auto it = value_reg.find(value);
+  if(it == value_reg.end())
+    frame_access(MOP_SW, reg, stack_offset[value], reg == REG_T0 ? REG_T1 : REG_T0);
+  else if(it->second != reg)
+    emit(MOP_MV, it->second, reg);
+}
+
+// 同时完成一组寄存器间的复制 (目标, 来源), 目标仍是其他复制的来源时先处理其他复制, 成环时借助 t0 断开
+void parallel_move(std::vector<std::pair<reg_t, reg_t> > moves) {
+  moves.erase(std::remove_if(moves.begin(), moves.end(), [](const std::pair<reg_t, reg_t> &move) {
+    return move.first == move.second;
+  }), moves.end());
+  while(!moves.empty()) {
+    bool progress = false;
+    for(size_t i = 0; i < moves.size() && !progress; ++i) {
+      bool blocked = false;
+      for(size_t j = 0; j < moves.size(); ++j)
+        if(j != i && moves[j].second == moves[i].first)
+          blocked = true;
+      if(blocked)
+        continue;
+      emit(MOP_MV, moves[i].first, moves[i].second);
+      moves.erase(moves.begin() + i);
+      progress = true;
+    }
+    if(progress)
+      continue;
+    reg_t src = moves[0].second;
+    emit(MOP_MV, REG_T0, src);
+    for(auto &move : moves)
+      if(move.second == src)
+        move.second = REG_T0;
   }
-  return S_num;
 }
 
-// 访问指令，若该指令存在返回值，则返回 1, 否则返回 0
-unsigned int get_S_num(const koopa_raw_value_t &value) {
-  const auto &ty = value->ty;
-  koopa_raw_type_kind_t *base;
-  unsigned int arr_size;
-  if(ty->tag == KOOPA_RTT_UNIT)
-    return 0;
-  if(value->kind.tag == KOOPA_RVT_ALLOC) {
-    if(ty->data.pointer.base->tag == KOOPA_RTT_ARRAY) {
-        base = (koopa_raw_type_kind_t *)(ty->data.pointer.base);
-        arr_size = 4;
-        while(base->tag != KOOPA_RTT_INT32) {
-          arr_size *= base->data.array.len;
-          base = (koopa_raw_type_kind_t *)(base->data.array.base);
-        }
-        return arr_size / 4;
-    }
-    else
-      return 1;
+// 以 reg 读写 (op 为 lw / sw) 栈帧中 offset 处的字
+// 依次尝试以 sp, s0 为基址的 12 位偏移, 都超出范围时借助 tmp 计算地址
+void frame_access(mop_t op, reg_t reg, int offset, reg_t tmp) {
+  if(offset <= 2047 && offset >= -2048)
+    emit_mem(op, reg, offset, REG_SP);
+  else if(frame_base != -1 && offset - frame_base <= 2047 && offset - frame_base >= -2048)
+    emit_mem(op, reg, offset - frame_base, REG_S0);
+  else {
+    emit_imm(MOP_LI, tmp, REG_NONE, offset);
+    emit(MOP_ADD, tmp, tmp, REG_SP);
+    emit_mem(op, reg, 0, tmp);
+  }
+}
+
+// 将栈帧中 offset 处的地址存入 reg
+void frame_addr(reg_t reg, int offset) {
+  if(offset <= 2047 && offset >= -2048)
+    emit_imm(MOP_ADDI, reg, REG_SP, offset);
+  else if(frame_base != -1 && offset - frame_base <= 2047 && offset - frame_base >= -2048)
+    emit_imm(MOP_ADDI, reg, REG_S0, offset - frame_base);
+  else {
+    emit_imm(MOP_LI, reg, REG_NONE, offset);
+    emit(MOP_ADD, reg, reg, REG_SP);
   }
-  return 1;
+}
+
+// 生成寄存器运算指令, 单操作数的指令 (mv, seqz 等) 不使用 rs2
+void emit(mop_t op, reg_t rd, reg_t rs1, reg_t rs2) {
+  mfunc.insts.push_back({op, rd, rs1, rs2, 0, 0});
+}
+
+// 生成带立即数的指令, li 不使用 rs1
+void emit_imm(mop_t op, reg_t rd, reg_t rs1, int imm) {
+  mfunc.insts.push_back({op, rd, rs1, REG_NONE, imm, 0});
+}
+
+// 生成访存指令: lw 将 offset(base) 处的字读入 reg, sw 将 reg 写入该处
+void emit_mem(mop_t op, reg_t reg, int offset, reg_t base) {
+  if(op == MOP_LW)
+    mfunc.insts.push_back({op, reg, base, REG_NONE, offset, 0});
+  else
+    mfunc.insts.push_back({op, REG_NONE, base, reg, offset, 0});
+}
+
+// 生成使用标号或符号的指令: la 写入 reg, 条件跳转读取 reg, j, call, tail 不使用 reg
+void emit_sym(mop_t op, reg_t reg, const std::string &sym) {
+  if(op == MOP_LA)
+    mfunc.insts.push_back({op, reg, REG_NONE, REG_NONE, 0, intern_sym(mfunc, sym)});
+  else
+    mfunc.insts.push_back({op, REG_NONE, reg, REG_NONE, 0, intern_sym(mfunc, sym)});
+}
+
+// 以标号 label 开始新的基本块, depth 为其循环嵌套深度
+void new_block(const std::string &label, int depth) {
+  mfunc.blocks.push_back({intern_sym(mfunc, label), mfunc.insts.size(), depth});
 }
 
 // 访问 raw slice, 获取需要分配栈空间的参数数量以及是否要为 ra 分配空间
@@ -781,11 +853,12 @@ unsigned int get_RA_num(const koopa_raw_slice_t &slice, bool &RA_call) {
   return RA_num;
 }
 
-// 访问指令，若指令为 call 指令，则返回参数个数 - 8，并设 RA_call 为 true
+// 访问指令，若指令为 call 指令，则返回参数个数 - 8，不是尾调用时设 RA_call 为 true
 unsigned int get_RA_num(const koopa_raw_value_t &value, bool &RA_call) {
   if(value->kind.tag != KOOPA_RVT_CALL)
     return 0;
-  RA_call = true;
+  if(!tail_calls.count(value))
+    RA_call = true;
   unsigned int param_num = value->kind.data.call.args.len;
   if(param_num <= 8)
     return 0;
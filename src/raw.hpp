@@ -1,30 +1,84 @@
 #pragma once
 
 #include "koopa.h"
+#include "mir.hpp"
+#include "opt.hpp"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+/** 值在当前函数栈帧中的位置 */
+extern std::unordered_map<koopa_raw_value_t, int> stack_offset;
+/** 分配到寄存器的值所在的寄存器 */
+extern std::unordered_map<koopa_raw_value_t, reg_t> value_reg;
+
+/** 输出 ELF 目标文件而不是汇编文本 */
+extern bool obj_output;
+/** 当前函数的机器代码 */
+extern mfunc_t mfunc;
+
+/** 函数栈帧的布局 */
+struct frame_t {
+  /** 栈帧大小, 由 layout_frame 求出时未对齐 */
+  int size;
+  /** s0 相对 sp 的偏移, 为 -1 时不使用 s0 */
+  int base;
+  /** 建立栈帧的基本块, 不经过它的路径不分配栈帧 */
+  koopa_raw_basic_block_t setup;
+  /** 执行时栈帧已建立的基本块 */
+  std::unordered_set<koopa_raw_basic_block_t> framed;
+  /** 需要保存的被调用者保存寄存器及其在栈帧中的位置 */
+  std::vector<std::pair<reg_t, int> > saved;
+  /** 只在入口由寄存器参数写入一次的局部变量及参数下标, 在建立栈帧时才写入 */
+  std::vector<std::pair<koopa_raw_value_t, int> > params;
+};
 
 koopa_raw_program_t generate_raw(const char *str, koopa_raw_program_builder_t raw_builder);
 koopa_raw_program_builder_t new_builder();
 void delete_builder(koopa_raw_program_builder_t raw_builder);
 void Visit(const koopa_raw_program_t &program);
-void Visit(const koopa_raw_slice_t &slice, int st_offset, int &st_id, bool RA_call);
-void Visit(const koopa_raw_function_t &func, int &st_id);
-void Visit(const koopa_raw_basic_block_t &bb, int st_offset, int &st_id, bool RA_call);
-void Visit(const koopa_raw_value_t &value, int st_offset, int &st_id, bool RA_call);
+void Visit(const koopa_raw_slice_t &slice, int st_offset, bool RA_call);
+void Visit(const koopa_raw_function_t &func);
+void Visit(const koopa_raw_basic_block_t &bb, int st_offset, bool RA_call);
+void Visit(const koopa_raw_value_t &value, int st_offset, bool RA_call);
 void Visit(const koopa_raw_return_t &ret, int st_offset, bool RA_call);
+void alloc_frame(int st_offset, bool RA_call);
+void free_frame(int st_offset, bool RA_call);
 void Visit(const koopa_raw_integer_t &integer);
-void Visit(const koopa_raw_binary_t &binary, int &st_id);
-void Visit(const koopa_raw_store_t &store, int &st_id, int st_offset);
+void Visit(const koopa_raw_binary_t &binary, koopa_raw_value_t value);
+void Visit(const koopa_raw_store_t &store, int st_offset);
 void Visit(const koopa_raw_global_alloc_t &global_alloc);
 void Visit(const koopa_raw_branch_t &branch);
 void Visit(const koopa_raw_jump_t &jump);
-int Visit(const koopa_raw_load_t &load, int &st_id);
-void Visit(const koopa_raw_call_t &call, int st_offset);
+void emit_jump_table(const jump_table_t &table);
+void Visit(const koopa_raw_load_t &load, koopa_raw_value_t value);
+void Visit(const koopa_raw_call_t &call, int st_offset, bool RA_call, bool tail);
 void Visit(const koopa_raw_aggregate_t &aggregate);
-void Visit(const koopa_raw_get_elem_ptr_t &get_elem_ptr, int &st_id);
-void Visit(const koopa_raw_get_ptr_t &get_ptr, int &st_id);
-void Visit(const koopa_raw_value_t &value, int &st_id);
-unsigned int get_S_num(const koopa_raw_slice_t &slice);
-unsigned int get_S_num(const koopa_raw_value_t &value);
+void obj_globals(const std::vector<const void *> &globals, msec_t sec);
+void flatten_init(const koopa_raw_value_t &init, std::vector<int> &words);
+bool is_zero_init(const koopa_raw_value_t &init);
+void Visit(const koopa_raw_get_elem_ptr_t &get_elem_ptr, koopa_raw_value_t value);
+void Visit(const koopa_raw_get_ptr_t &get_ptr, koopa_raw_value_t value);
+void elem_addr(koopa_raw_value_t src, koopa_raw_value_t index, size_t off_size, koopa_raw_value_t value);
+void scale_index(reg_t index, size_t off_size);
+int shadd_shift(long long factor);
+mop_t shadd_op(int shift);
+reg_t value_in_reg(koopa_raw_value_t value);
+reg_t read_value(koopa_raw_value_t value, reg_t scratch);
+void move_to(reg_t reg, koopa_raw_value_t value);
+reg_t write_reg(koopa_raw_value_t value, reg_t scratch);
+void write_back(koopa_raw_value_t value, reg_t reg);
+void parallel_move(std::vector<std::pair<reg_t, reg_t> > moves);
+void frame_access(mop_t op, reg_t reg, int offset, reg_t tmp);
+void frame_addr(reg_t reg, int offset);
+void emit(mop_t op, reg_t rd, reg_t rs1, reg_t rs2 = REG_NONE);
+void emit_imm(mop_t op, reg_t rd, reg_t rs1, int imm);
+void emit_mem(mop_t op, reg_t reg, int offset, reg_t base);
+void emit_sym(mop_t op, reg_t reg, const std::string &sym);
+void new_block(const std::string &label, int depth);
 unsigned int get_RA_num(const koopa_raw_slice_t &slice, bool &RA_call);
 unsigned int get_RA_num(const koopa_raw_value_t &value, bool &RA_call);
-size_t calc_size(const koopa_raw_type_t &ty);
\ No newline at end of file
+size_t calc_size(const koopa_raw_type_t &ty);
+frame_t layout_frame(koopa_raw_function_t func, int reserved);
+int param_index(const frame_t &frame, koopa_raw_value_t var);
@@ -0,0 +1,514 @@
+#include "koopa.h"
+#include "opt.hpp"
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+// 判断 value 是否为常量, 前端将常量生成为 add 0, C 的形式
+bool get_const(koopa_raw_value_t value, int &result) {
+  if(value->kind.tag == KOOPA_RVT_INTEGER) {
+    result = value->kind.data.integer.value;
+    return true;
+  }
+  if(value->kind.tag != KOOPA_RVT_BINARY)
+    return false;
+  const koopa_raw_binary_t &binary = value->kind.data.binary;
+  if(binary.lhs->kind.tag != KOOPA_RVT_INTEGER || binary.rhs->kind.tag != KOOPA_RVT_INTEGER)
+    return false;
+  if(binary.op == KOOPA_RBO_ADD)
+    result = binary.lhs->kind.data.integer.value + binary.rhs->kind.data.integer.value;
+  else if(binary.op == KOOPA_RBO_SUB)
+    result = binary.lhs->kind.data.integer.value - binary.rhs->kind.data.integer.value;
+  else
+    return false;
+  return true;
+}
+
+// 交换比较运算的两个操作数后对应的运算
+static bool swap_compare(koopa_raw_binary_op_t op, koopa_raw_binary_op_t &result) {
+  switch(op) {
+    case KOOPA_RBO_LT: result = KOOPA_RBO_GT; return true;
+    case KOOPA_RBO_GT: result = KOOPA_RBO_LT; return true;
+    case KOOPA_RBO_LE: result = KOOPA_RBO_GE; return true;
+    case KOOPA_RBO_GE: result = KOOPA_RBO_LE; return true;
+    default: return false;
+  }
+}
+
+// 计算常量比较的结果
+bool eval_compare(koopa_raw_binary_op_t op, long long lhs, long long rhs) {
+  switch(op) {
+    case KOOPA_RBO_LT: return lhs < rhs;
+    case KOOPA_RBO_GT: return lhs > rhs;
+    case KOOPA_RBO_LE: return lhs <= rhs;
+    case KOOPA_RBO_GE: return lhs >= rhs;
+    default: assert(false);
+  }
+  return false;
+}
+
+// 识别计数循环, 只处理最内层循环
+bool analyze_counted_loop(const cfg_t &cfg, const loop_t &loop, counted_loop_t &info) {
+  std::vector<int> in_loop(cfg.bbs.size(), 0);
+  for(int b : loop.blocks)
+    in_loop[b] = 1;
+  for(const loop_t &other : cfg.loops)
+    if(other.header != loop.header && in_loop[other.header])
+      return false;
+
+  // 循环头只计算条件, 条件为真进入循环体, 否则退出
+  info.header = cfg.bbs[loop.header];
+  std::vector<koopa_raw_value_t> header_insts = get_insts(info.header);
+  koopa_raw_value_t term = header_insts.back();
+  if(term->kind.tag != KOOPA_RVT_BRANCH)
+    return false;
+  info.entry = term->kind.data.branch.true_bb;
+  info.exit = term->kind.data.branch.false_bb;
+  if(!in_loop[cfg.index.at(info.entry)] || in_loop[cfg.index.at(info.exit)] || info.entry == info.header)
+    return false;
+  std::unordered_set<koopa_raw_value_t> header_values;
+  for(size_t i = 0; i + 1 < header_insts.size(); ++i) {
+    koopa_raw_value_tag_t tag = header_insts[i]->kind.tag;
+    if(tag != KOOPA_RVT_BINARY && tag != KOOPA_RVT_LOAD &&
+       tag != KOOPA_RVT_GET_ELEM_PTR && tag != KOOPA_RVT_GET_PTR)
+      return false;
+    header_values.insert(header_insts[i]);
+  }
+
+  info.has_call = false;
+  info.values.clear();
+  info.stored.clear();
+  info.size = 0;
+  for(int b : loop.blocks) {
+    for(koopa_raw_value_t inst : get_insts(cfg.bbs[b])) {
+      info.values.insert(inst);
+      info.size++;
+      if(inst->kind.tag == KOOPA_RVT_CALL)
+        info.has_call = true;
+      if(inst->kind.tag == KOOPA_RVT_STORE)
+        info.stored.insert(inst->kind.data.store.dest);
+    }
+  }
+
+  // 条件形如 load @i op bound, 其中 @i 在循环中被写入
+  info.cond = term->kind.data.branch.cond;
+  if(!header_values.count(info.cond) || info.cond->kind.tag != KOOPA_RVT_BINARY)
+    return false;
+  const koopa_raw_binary_t &cmp = info.cond->kind.data.binary;
+  info.op = cmp.op;
+  info.load = cmp.lhs;
+  info.bound = cmp.rhs;
+  if(info.load->kind.tag != KOOPA_RVT_LOAD || !info.stored.count(info.load->kind.data.load.src)) {
+    std::swap(info.load, info.bound);
+    if(!swap_compare(cmp.op, info.op))
+      return false;
+  }
+  if(info.op != KOOPA_RBO_LT && info.op != KOOPA_RBO_GT && info.op != KOOPA_RBO_LE && info.op != KOOPA_RBO_GE)
+    return false;
+  if(info.load->kind.tag != KOOPA_RVT_LOAD || !header_values.count(info.load))
+    return false;
+  info.var = info.load->kind.data.load.src;
+  if(info.var->kind.tag != KOOPA_RVT_ALLOC || info.var->ty->data.pointer.base->tag != KOOPA_RTT_INT32)
+    return false;
+
+  // 循环变量只在循环中被写入一次, 且每次迭代恰好执行一次
+  koopa_raw_value_t var_store = nullptr;
+  int store_bb = -1;
+  for(int b : loop.blocks) {
+    for(koopa_raw_value_t inst : get_insts(cfg.bbs[b])) {
+      if(inst->kind.tag != KOOPA_RVT_STORE || inst->kind.data.store.dest != info.var)
+        continue;
+      if(var_store != nullptr)
+        return false;
+      var_store = inst;
+      store_bb = b;
+    }
+  }
+  if(var_store == nullptr || store_bb == loop.header)
+    return false;
+  for(int latch : loop.latches)
+    if(!dominates(cfg, store_bb, latch))
+      return false;
+
+  // 写入的值为 load @i +/- step, 且 load 与 store 在同一基本块中
+  koopa_raw_value_t next = var_store->kind.data.store.value;
+  if(next->kind.tag != KOOPA_RVT_BINARY)
+    return false;
+  const koopa_raw_binary_t &inc = next->kind.data.binary;
+  koopa_raw_value_t inc_load = nullptr;
+  int step;
+  if(inc.op == KOOPA_RBO_ADD && get_const(inc.rhs, step))
+    inc_load = inc.lhs;
+  else if(inc.op == KOOPA_RBO_ADD && get_const(inc.lhs, step))
+    inc_load = inc.rhs;
+  else if(inc.op == KOOPA_RBO_SUB && get_const(inc.rhs, step)) {
+    inc_load = inc.lhs;
+    step = -step;
+  }
+  if(inc_load == nullptr || inc_load->kind.tag != KOOPA_RVT_LOAD || inc_load->kind.data.load.src != info.var)
+    return false;
+  std::vector<koopa_raw_value_t> store_insts = get_insts(cfg.bbs[store_bb]);
+  auto load_pos = std::find(store_insts.begin(), store_insts.end(), inc_load);
+  if(load_pos == store_insts.end() || load_pos > std::find(store_insts.begin(), store_insts.end(), var_store))
+    return false;
+  info.var_store = var_store;
+  info.store_bb = cfg.bbs[store_bb];
+  info.step = step;
+  if(step == 0)
+    return false;
+  if((step > 0) != (info.op == KOOPA_RBO_LT || info.op == KOOPA_RBO_LE))
+    return false;
+
+  // 上界在循环中不变
+  int bound_const;
+  if(!get_const(info.bound, bound_const)) {
+    if(info.bound->kind.tag != KOOPA_RVT_LOAD)
+      return false;
+    koopa_raw_value_t src = info.bound->kind.data.load.src;
+    if(src->kind.tag == KOOPA_RVT_GLOBAL_ALLOC) {
+      if(info.has_call)
+        return false;
+    }
+    else if(src->kind.tag != KOOPA_RVT_ALLOC)
+      return false;
+    if(info.stored.count(src))
+      return false;
+  }
+
+  // 循环体不使用循环头中的值, 循环外不使用循环中的值
+  for(size_t i = 0; i < cfg.bbs.size(); ++i) {
+    if(i == (size_t)loop.header)
+      continue;
+    for(koopa_raw_value_t inst : get_insts(cfg.bbs[i]))
+      for(koopa_raw_value_t *operand : get_operands(inst))
+        if(in_loop[i] ? header_values.count(*operand) != 0 : info.values.count(*operand) != 0)
+          return false;
+  }
+
+  info.body.clear();
+  for(int b : loop.blocks)
+    if(b != loop.header)
+      info.body.push_back(cfg.bbs[b]);
+  info.preheaders.clear();
+  for(int p : cfg.preds[loop.header])
+    if(!in_loop[p])
+      info.preheaders.push_back(cfg.bbs[p]);
+  info.size -= header_insts.size();
+  return !info.preheaders.empty();
+}
+
+
+// 判断 value 在循环中是否不变
+bool is_invariant(const counted_loop_t &info, koopa_raw_value_t value) {
+  switch(value->kind.tag) {
+    case KOOPA_RVT_INTEGER:
+    case KOOPA_RVT_ALLOC:
+    case KOOPA_RVT_GLOBAL_ALLOC:
+    case KOOPA_RVT_FUNC_ARG_REF:
+      return true;
+    case KOOPA_RVT_LOAD: {
+      // load 的结果在使用时才从内存读取, 循环外的 load 同样需要检查
+      koopa_raw_value_t src = value->kind.data.load.src;
+      if(info.stored.count(src))
+        return false;
+      if(src->kind.tag == KOOPA_RVT_ALLOC)
+        return true;
+      return src->kind.tag == KOOPA_RVT_GLOBAL_ALLOC && !info.has_call;
+    }
+    case KOOPA_RVT_BINARY:
+      return !info.values.count(value) ||
+             (is_invariant(info, value->kind.data.binary.lhs) && is_invariant(info, value->kind.data.binary.rhs));
+    case KOOPA_RVT_GET_ELEM_PTR:
+      return !info.values.count(value) ||
+             (is_invariant(info, value->kind.data.get_elem_ptr.src) &&
+              is_invariant(info, value->kind.data.get_elem_ptr.index));
+    case KOOPA_RVT_GET_PTR:
+      return !info.values.count(value) ||
+             (is_invariant(info, value->kind.data.get_ptr.src) &&
+              is_invariant(info, value->kind.data.get_ptr.index));
+    default:
+      return false;
+  }
+}
+
+// 求 value 关于循环变量的线性系数, value 不是循环变量的线性函数时返回 false
+bool linear_coef(const counted_loop_t &info, koopa_raw_value_t value, long long &coef) {
+  if(value->kind.tag == KOOPA_RVT_LOAD && value->kind.data.load.src == info.var) {
+    coef = 1;
+    return true;
+  }
+  if(is_invariant(info, value)) {
+    coef = 0;
+    return true;
+  }
+  if(value->kind.tag != KOOPA_RVT_BINARY || !info.values.count(value))
+    return false;
+  const koopa_raw_binary_t &binary = value->kind.data.binary;
+  long long lhs, rhs;
+  int k;
+  switch(binary.op) {
+    case KOOPA_RBO_ADD:
+    case KOOPA_RBO_SUB:
+      if(!linear_coef(info, binary.lhs, lhs) || !linear_coef(info, binary.rhs, rhs))
+        return false;
+      coef = binary.op == KOOPA_RBO_ADD ? lhs + rhs : lhs - rhs;
+      return true;
+    case KOOPA_RBO_MUL:
+      if(get_const(binary.rhs, k) && linear_coef(info, binary.lhs, lhs))
+        coef = lhs * k;
+      else if(get_const(binary.lhs, k) && linear_coef(info, binary.rhs, rhs))
+        coef = rhs * k;
+      else
+        return false;
+      return true;
+    default:
+      return false;
+  }
+}
+
+// 表达式的结构, 结构相同的地址在同一时刻的值相同
+static std::string expr_key(const counted_loop_t &info, koopa_raw_value_t value) {
+  const auto &kind = value->kind;
+  switch(kind.tag) {
+    case KOOPA_RVT_INTEGER:
+      return std::to_string(kind.data.integer.value);
+    case KOOPA_RVT_LOAD:
+      return "load(" + expr_key(info, kind.data.load.src) + ")";
+    case KOOPA_RVT_BINARY:
+      if(!info.values.count(value))
+        break;
+      return "op" + std::to_string(kind.data.binary.op) + "(" + expr_key(info, kind.data.binary.lhs) + "," +
+             expr_key(info, kind.data.binary.rhs) + ")";
+    case KOOPA_RVT_GET_ELEM_PTR:
+      if(!info.values.count(value))
+        break;
+      return "gep(" + expr_key(info, kind.data.get_elem_ptr.src) + "," + expr_key(info, kind.data.get_elem_ptr.index) + ")";
+    case KOOPA_RVT_GET_PTR:
+      if(!info.values.count(value))
+        break;
+      return "gp(" + expr_key(info, kind.data.get_ptr.src) + "," + expr_key(info, kind.data.get_ptr.index) + ")";
+    default:
+      break;
+  }
+  return "v" + std::to_string(reinterpret_cast<uintptr_t>(value));
+}
+
+// 将循环中计算 value 的表达式复制到循环外, 加入 insts, replace 中的值被直接替换
+koopa_raw_value_t clone_expr(const counted_loop_t &info, koopa_raw_value_t value,
+                             std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> &replace,
+                             std::vector<koopa_raw_value_t> &insts) {
+  if(replace.count(value))
+    return replace[value];
+  if(!info.values.count(value))
+    return value;
+  koopa_raw_value_data_t *new_inst = new koopa_raw_value_data_t(*value);
+  new_inst->name = nullptr;
+  new_inst->used_by = make_slice(std::vector<const void *>(), KOOPA_RSIK_VALUE);
+  for(koopa_raw_value_t *operand : get_operands(new_inst))
+    *operand = clone_expr(info, *operand, replace, insts);
+  insts.push_back(new_inst);
+  replace[value] = new_inst;
+  return new_inst;
+}
+
+// 在基本块的终结指令前插入指令
+static void insert_before_terminator(koopa_raw_basic_block_t bb, const std::vector<koopa_raw_value_t> &new_insts) {
+  std::vector<koopa_raw_value_t> insts = get_insts(bb);
+  insts.insert(insts.end() - 1, new_insts.begin(), new_insts.end());
+  set_insts(bb, insts);
+}
+
+// 地址为循环变量线性函数的 getelemptr/getptr 改为每次迭代递增的指针变量
+static bool strength_reduce(koopa_raw_function_t func, counted_loop_t info) {
+  std::vector<koopa_raw_basic_block_t> blocks = info.body;
+  blocks.push_back(info.header);
+  // 结构相同的地址共用一个指针变量
+  std::unordered_map<std::string, koopa_raw_value_t> ptr_vars;
+  std::vector<std::pair<koopa_raw_value_t, long long> > increments;
+  std::vector<koopa_raw_value_t> new_allocs;
+  bool changed = false;
+  for(koopa_raw_basic_block_t bb : blocks) {
+    std::vector<koopa_raw_value_t> insts = get_insts(bb);
+    for(koopa_raw_value_t &inst : insts) {
+      koopa_raw_value_t src, index;
+      if(inst->kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
+        src = inst->kind.data.get_elem_ptr.src;
+        index = inst->kind.data.get_elem_ptr.index;
+      }
+      else if(inst->kind.tag == KOOPA_RVT_GET_PTR) {
+        src = inst->kind.data.get_ptr.src;
+        index = inst->kind.data.get_ptr.index;
+      }
+      else
+        continue;
+      long long coef;
+      if(!is_invariant(info, src) || !linear_coef(info, index, coef) || coef == 0)
+        continue;
+      std::string key = expr_key(info, inst);
+      if(!ptr_vars.count(key)) {
+        // 在循环前用循环变量的当前值初始化指针变量
+        koopa_raw_value_data_t *ptr_var = new_value(pointer_type(inst->ty), KOOPA_RVT_ALLOC);
+        for(koopa_raw_basic_block_t pre : info.preheaders) {
+          std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> replace;
+          std::vector<koopa_raw_value_t> init;
+          koopa_raw_value_t init_ptr = clone_expr(info, inst, replace, init);
+          init.push_back(new_store(init_ptr, ptr_var));
+          insert_before_terminator(pre, init);
+        }
+        // 指针变量在循环中被更新, 以它为基址的地址不再是循环不变量
+        info.stored.insert(ptr_var);
+        ptr_vars[key] = ptr_var;
+        new_allocs.push_back(ptr_var);
+        increments.push_back(std::make_pair(ptr_var, coef * info.step));
+      }
+      koopa_raw_value_t load = new_load(ptr_vars[key]);
+      replace_uses(blocks, inst, load);
+      inst = load;
+      changed = true;
+    }
+    set_insts(bb, insts);
+  }
+  if(!changed)
+    return false;
+
+  // 循环变量更新后, 指针变量随之增加
+  std::vector<koopa_raw_value_t> insts = get_insts(info.store_bb);
+  auto pos = std::find(insts.begin(), insts.end(), info.var_store) + 1;
+  std::vector<koopa_raw_value_t> update;
+  for(auto &inc : increments) {
+    koopa_raw_value_t load = new_load(inc.first);
+    koopa_raw_value_data_t *next = new_value(load->ty, KOOPA_RVT_GET_PTR);
+    next->kind.data.get_ptr.src = load;
+    next->kind.data.get_ptr.index = new_integer(inc.second);
+    update.push_back(load);
+    update.push_back(next);
+    update.push_back(new_store(next, inc.first));
+  }
+  insts.insert(pos, update.begin(), update.end());
+  set_insts(info.store_bb, insts);
+
+  koopa_raw_basic_block_t entry = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[0]);
+  std::vector<koopa_raw_value_t> entry_insts = get_insts(entry);
+  new_allocs.insert(new_allocs.end(), entry_insts.begin(), entry_insts.end());
+  set_insts(entry, new_allocs);
+  return true;
+}
+
+// 形如 while(i < n) { s = s + a * i + c; i = i + 1; } 的累加循环, 直接计算循环结束时 s 与 i 的值
+static bool closed_form(koopa_raw_function_t func, const counted_loop_t &info) {
+  if(info.body.size() != 1 || info.has_call)
+    return false;
+  std::vector<koopa_raw_value_t> insts = get_insts(info.body[0]);
+  koopa_raw_value_t acc_store = nullptr;
+  std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> replace;
+  for(koopa_raw_value_t inst : insts) {
+    if(inst->kind.tag == KOOPA_RVT_STORE && inst != info.var_store) {
+      if(acc_store != nullptr)
+        return false;
+      acc_store = inst;
+    }
+    // 删除循环会同时删除可能的除零错误
+    if(inst->kind.tag == KOOPA_RVT_BINARY &&
+       (inst->kind.data.binary.op == KOOPA_RBO_DIV || inst->kind.data.binary.op == KOOPA_RBO_MOD))
+      return false;
+    if(inst->kind.tag == KOOPA_RVT_LOAD && inst->kind.data.load.src == info.var)
+      replace[inst] = new_integer(0);
+  }
+  if(acc_store == nullptr)
+    return false;
+  koopa_raw_value_t acc = acc_store->kind.data.store.dest;
+  if(acc->kind.tag != KOOPA_RVT_ALLOC || acc->ty->data.pointer.base->tag != KOOPA_RTT_INT32)
+    return false;
+  if(std::find(insts.begin(), insts.end(), acc_store) > std::find(insts.begin(), insts.end(), info.var_store))
+    return false;
+
+  // 写入的值 V 关于 s 的系数为 1, 关于 i 的系数为 a, 每次迭代 s 增加 V(s = 0) = a * i + c
+  koopa_raw_value_t value = acc_store->kind.data.store.value;
+  counted_loop_t acc_info = info;
+  acc_info.var = acc;
+  acc_info.stored.erase(info.var);
+  long long a, acc_coef;
+  if(!linear_coef(acc_info, value, acc_coef) || acc_coef != 1)
+    return false;
+  acc_info = info;
+  acc_info.stored.erase(acc);
+  if(!linear_coef(acc_info, value, a) || a != (int)a)
+    return false;
+  for(koopa_raw_value_t inst : insts)
+    if(inst->kind.tag == KOOPA_RVT_LOAD && inst->kind.data.load.src == acc)
+      replace[inst] = new_integer(0);
+
+  // 迭代次数 cnt = max(d, 0) / |step| 向上取整
+  std::vector<koopa_raw_value_t> cf_insts;
+  auto emit = [&](koopa_raw_binary_op_t op, koopa_raw_value_t lhs, koopa_raw_value_t rhs) {
+    koopa_raw_value_t inst = new_binary(op, lhs, rhs);
+    cf_insts.push_back(inst);
+    return inst;
+  };
+  koopa_raw_value_t i0 = new_load(info.var);
+  cf_insts.push_back(i0);
+  std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> bound_map;
+  koopa_raw_value_t bound = clone_expr(info, info.bound, bound_map, cf_insts);
+  int step = info.step, abs_step = step > 0 ? step : -step;
+  koopa_raw_value_t d = step > 0 ? emit(KOOPA_RBO_SUB, bound, i0) : emit(KOOPA_RBO_SUB, i0, bound);
+  if(info.op == KOOPA_RBO_LE || info.op == KOOPA_RBO_GE)
+    d = emit(KOOPA_RBO_ADD, d, new_integer(1));
+  koopa_raw_value_t cnt = emit(KOOPA_RBO_MUL, d, emit(KOOPA_RBO_GT, d, new_integer(0)));
+  if(abs_step != 1)
+    cnt = emit(KOOPA_RBO_DIV, emit(KOOPA_RBO_ADD, cnt, new_integer(abs_step - 1)), new_integer(abs_step));
+
+  // sum(i) = cnt * i0 + step * cnt * (cnt - 1) / 2, 先除以 2 以保证回绕后结果正确
+  koopa_raw_value_t odd = emit(KOOPA_RBO_AND, cnt, new_integer(1));
+  koopa_raw_value_t half = emit(KOOPA_RBO_DIV, emit(KOOPA_RBO_SUB, cnt, odd), new_integer(2));
+  koopa_raw_value_t tri = emit(KOOPA_RBO_MUL, half, emit(KOOPA_RBO_ADD, emit(KOOPA_RBO_SUB, cnt, new_integer(1)), odd));
+  koopa_raw_value_t sum_i = emit(KOOPA_RBO_ADD, emit(KOOPA_RBO_MUL, cnt, i0), emit(KOOPA_RBO_MUL, tri, new_integer(step)));
+  koopa_raw_value_t c = clone_expr(info, value, replace, cf_insts);
+  koopa_raw_value_t total = emit(KOOPA_RBO_ADD, emit(KOOPA_RBO_MUL, sum_i, new_integer(a)), emit(KOOPA_RBO_MUL, c, cnt));
+  koopa_raw_value_t acc_old = new_load(acc);
+  cf_insts.push_back(acc_old);
+  koopa_raw_value_t acc_new = emit(KOOPA_RBO_ADD, acc_old, total);
+  koopa_raw_value_t i_new = emit(KOOPA_RBO_ADD, i0, emit(KOOPA_RBO_MUL, cnt, new_integer(step)));
+  cf_insts.push_back(new_store(acc_new, acc));
+  cf_insts.push_back(new_store(i_new, info.var));
+  cf_insts.push_back(new_jump(info.exit));
+  koopa_raw_basic_block_data_t *cf = new_basic_block(new_label("cf", info.header));
+  set_insts(cf, cf_insts);
+
+  retarget(info.preheaders, info.header, cf);
+  std::vector<koopa_raw_basic_block_t> bbs = get_bbs(func);
+  auto pos = std::find(bbs.begin(), bbs.end(), info.header);
+  *pos = cf;
+  bbs.erase(std::find(bbs.begin(), bbs.end(), info.body[0]));
+  set_bbs(func, bbs);
+  return true;
+}
+
+// 对计数循环进行归纳变量强度削弱, 并将可求闭式的累加循环替换为直接计算
+void reduce_induction_variables(koopa_raw_program_t &program) {
+  for(size_t i = 0; i < program.funcs.len; ++i) {
+    koopa_raw_function_t func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    if(func->bbs.len == 0)
+      continue;
+    std::unordered_set<koopa_raw_basic_block_t> done;
+    bool changed = true;
+    while(changed) {
+      changed = false;
+      cfg_t cfg = build_cfg(func);
+      for(const loop_t &loop : cfg.loops) {
+        if(done.count(cfg.bbs[loop.header]))
+          continue;
+        done.insert(cfg.bbs[loop.header]);
+        counted_loop_t info;
+        if(!analyze_counted_loop(cfg, loop, info))
+          continue;
+        if(closed_form(func, info) || strength_reduce(func, info)) {
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+}
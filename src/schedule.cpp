@@ -0,0 +1,135 @@
+#include "mir.hpp"
+#include "opt.hpp"
+#include <cassert>
+#include <algorithm>
+
+/** 调度图中的依赖边: 后继指令至少在本指令发射 lat 个周期后才能发射 */
+struct dep_t {
+  int succ;
+  int lat;
+};
+
+// 指令的结果在多少个周期后可用, 由 -load-latency 等选项给出
+static int latency(const minst_t &inst) {
+  switch(inst.op) {
+    case MOP_LW:
+      return opt_options.load_latency;
+    case MOP_MUL:
+      return opt_options.mul_latency;
+    case MOP_DIV:
+    case MOP_REM:
+      return opt_options.div_latency;
+    default:
+      return 1;
+  }
+}
+
+// 调度的边界: 跳转, 调用与返回都留在原位置
+static bool is_barrier(mop_t op) {
+  return is_branch(op) || is_exit(op) || op == MOP_CALL;
+}
+
+// 对 insts 中 [begin, end) 的指令做表调度, 按顺序单发射流水线模型优先发射关键路径上的指令
+static void schedule_region(std::vector<minst_t> &insts, size_t begin, size_t end) {
+  int n = end - begin;
+  if(n < 3)
+    return;
+  std::vector<std::vector<dep_t> > succs(n);
+  std::vector<int> pred_num(n, 0);
+  auto add_dep = [&](int from, int to, int lat) {
+    succs[from].push_back({to, lat});
+    pred_num[to]++;
+  };
+  // 寄存器的最后一次写入与此后的读取, 用于建立写后读, 读后写与写后写依赖
+  std::vector<int> last_def(32, -1);
+  std::vector<std::vector<int> > readers(32);
+  // 之前的访存指令及其基址寄存器当时的定义, 同一定义下不同偏移的字不重叠
+  std::vector<std::pair<int, int> > mems;
+  for(int j = 0; j < n; ++j) {
+    const minst_t &inst = insts[begin + j];
+    for(reg_t r : {inst.rs1, inst.rs2}) {
+      if(r == REG_NONE || r == REG_ZERO)
+        continue;
+      if(last_def[r] != -1)
+        add_dep(last_def[r], j, latency(insts[begin + last_def[r]]));
+      readers[r].push_back(j);
+    }
+    if(inst.op == MOP_LW || inst.op == MOP_SW) {
+      for(auto &mem : mems) {
+        const minst_t &other = insts[begin + mem.first];
+        if(inst.op == MOP_LW && other.op == MOP_LW)
+          continue;
+        if(other.rs1 == inst.rs1 && mem.second == last_def[inst.rs1] && other.imm != inst.imm)
+          continue;
+        add_dep(mem.first, j, other.op == MOP_SW && inst.op == MOP_LW ? 1 : 0);
+      }
+      mems.push_back({j, last_def[inst.rs1]});
+    }
+    reg_t rd = inst.rd;
+    if(rd != REG_NONE && rd != REG_ZERO) {
+      for(int reader : readers[rd])
+        if(reader != j)
+          add_dep(reader, j, 0);
+      if(last_def[rd] != -1)
+        add_dep(last_def[rd], j, 1);
+      last_def[rd] = j;
+      readers[rd].clear();
+    }
+  }
+
+  // 优先级为到区域末尾的最长延迟路径
+  std::vector<int> height(n, 0);
+  for(int i = n - 1; i >= 0; --i) {
+    height[i] = latency(insts[begin + i]);
+    for(const dep_t &dep : succs[i])
+      height[i] = std::max(height[i], dep.lat + height[dep.succ]);
+  }
+  std::vector<int> earliest(n, 0), ready;
+  for(int i = 0; i < n; ++i)
+    if(pred_num[i] == 0)
+      ready.push_back(i);
+  std::vector<minst_t> result;
+  int cycle = 0;
+  while(!ready.empty()) {
+    // 当前周期可发射的指令中取优先级最高的, 都不能发射时取最早可发射的
+    auto better = [&](int a, int b) {
+      bool a_now = earliest[a] <= cycle, b_now = earliest[b] <= cycle;
+      if(a_now != b_now)
+        return a_now;
+      if(!a_now && earliest[a] != earliest[b])
+        return earliest[a] < earliest[b];
+      if(height[a] != height[b])
+        return height[a] > height[b];
+      return a < b;
+    };
+    size_t best = 0;
+    for(size_t k = 1; k < ready.size(); ++k)
+      if(better(ready[k], ready[best]))
+        best = k;
+    int i = ready[best];
+    ready.erase(ready.begin() + best);
+    cycle = std::max(cycle, earliest[i]);
+    result.push_back(insts[begin + i]);
+    for(const dep_t &dep : succs[i]) {
+      earliest[dep.succ] = std::max(earliest[dep.succ], cycle + dep.lat);
+      if(--pred_num[dep.succ] == 0)
+        ready.push_back(dep.succ);
+    }
+    cycle++;
+  }
+  assert((int)result.size() == n);
+  std::copy(result.begin(), result.end(), insts.begin() + begin);
+}
+
+// 在每个基本块中, 对跳转与调用之间的指令分别做表调度, 使读取与长延迟运算远离使用者
+void schedule(mfunc_t &func) {
+  for(size_t b = 0; b < func.blocks.size(); ++b) {
+    size_t begin = func.blocks[b].begin, end = mblock_end(func, b);
+    for(size_t i = begin; i <= end; ++i) {
+      if(i < end && !is_barrier(func.insts[i].op))
+        continue;
+      schedule_region(func.insts, begin, i);
+      begin = i + 1;
+    }
+  }
+}
@@ -0,0 +1,254 @@
+#include "koopa.h"
+#include "opt.hpp"
+#include <cassert>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+std::unordered_map<koopa_raw_value_t, jump_table_t> jump_tables;
+
+/** 转换比较链至少需要的分支数: 跳转表与比较树 */
+static const size_t min_table_cases = 4;
+static const size_t min_tree_cases = 6;
+/** 跳转表的表项数上限, 以及表项数与分支数之比的上限 */
+static const int max_table_size = 1024;
+static const int max_table_ratio = 3;
+/** 比较树中不再二分, 直接逐个比较的分支数 */
+static const size_t tree_leaf_cases = 3;
+
+/** 等值比较链的一个分支: 被比较的值等于 value 时跳到 target */
+struct case_t {
+  int value;
+  koopa_raw_basic_block_t target;
+};
+
+/** 同一变量的等值比较链: head 末尾的比较及其后只含比较的基本块 links, 都不成立时跳到 default_bb */
+struct chain_t {
+  koopa_raw_basic_block_t head;
+  std::vector<koopa_raw_basic_block_t> links;
+  koopa_raw_value_t value;
+  std::vector<case_t> cases;
+  koopa_raw_basic_block_t default_bb;
+};
+
+// 与 value 相同的值: value 本身, 或读取同一变量的 load (比较链中没有写入)
+static bool same_value(koopa_raw_value_t a, koopa_raw_value_t value) {
+  if(a == value)
+    return true;
+  return a->kind.tag == KOOPA_RVT_LOAD && value->kind.tag == KOOPA_RVT_LOAD &&
+         a->kind.data.load.src == value->kind.data.load.src;
+}
+
+// 解析基本块末尾的 br (x == c) 或 br (x != c), 得到被比较的值, 常量与相等时的目标
+static bool parse_compare(koopa_raw_basic_block_t bb, koopa_raw_value_t &value, int &constant,
+                          koopa_raw_basic_block_t &equal, koopa_raw_basic_block_t &other) {
+  koopa_raw_value_t term = get_terminator(bb);
+  if(term == nullptr || term->kind.tag != KOOPA_RVT_BRANCH)
+    return false;
+  koopa_raw_value_t cond = term->kind.data.branch.cond;
+  if(cond->kind.tag != KOOPA_RVT_BINARY)
+    return false;
+  const koopa_raw_binary_t &binary = cond->kind.data.binary;
+  if(binary.op != KOOPA_RBO_EQ && binary.op != KOOPA_RBO_NOT_EQ)
+    return false;
+  if(get_const(binary.rhs, constant))
+    value = binary.lhs;
+  else if(get_const(binary.lhs, constant))
+    value = binary.rhs;
+  else
+    return false;
+  equal = term->kind.data.branch.true_bb;
+  other = term->kind.data.branch.false_bb;
+  if(binary.op == KOOPA_RBO_NOT_EQ)
+    std::swap(equal, other);
+  return true;
+}
+
+// 基本块 bb 是否只计算常量, 读取 value 所读的变量, 并比较 value 与常量
+static bool is_link(koopa_raw_basic_block_t bb, koopa_raw_value_t value) {
+  std::vector<koopa_raw_value_t> insts = get_insts(bb);
+  koopa_raw_value_t cond = get_terminator(bb)->kind.data.branch.cond;
+  int constant;
+  for(size_t i = 0; i + 1 < insts.size(); ++i) {
+    koopa_raw_value_t inst = insts[i];
+    if(inst != cond && !get_const(inst, constant) && !(inst->kind.tag == KOOPA_RVT_LOAD && same_value(inst, value)))
+      return false;
+  }
+  return true;
+}
+
+// 从 head 开始收集比较链, 后续的链节只有前一个链节一个前驱
+static bool collect_chain(const cfg_t &cfg, koopa_raw_basic_block_t head, chain_t &chain) {
+  koopa_raw_basic_block_t next;
+  int constant;
+  koopa_raw_basic_block_t equal;
+  if(!parse_compare(head, chain.value, constant, equal, next))
+    return false;
+  chain.head = head;
+  chain.links.clear();
+  chain.cases.assign(1, {constant, equal});
+  // 比较的值是 load 时须在 head 中读取, 读取之后到比较之前不能有写入或调用
+  std::vector<koopa_raw_value_t> insts = get_insts(head);
+  auto it = std::find(insts.begin(), insts.end(), chain.value);
+  if(it == insts.end() && chain.value->kind.tag == KOOPA_RVT_LOAD)
+    return false;
+  if(it != insts.end())
+    for(++it; it != insts.end(); ++it)
+      if((*it)->kind.tag == KOOPA_RVT_STORE || (*it)->kind.tag == KOOPA_RVT_CALL)
+        return false;
+  std::unordered_set<koopa_raw_basic_block_t> seen = {head};
+  while(true) {
+    koopa_raw_value_t value;
+    koopa_raw_basic_block_t other;
+    if(seen.count(next) || cfg.preds[cfg.index.at(next)].size() != 1 ||
+       !parse_compare(next, value, constant, equal, other) || !same_value(value, chain.value) ||
+       !is_link(next, chain.value))
+      break;
+    seen.insert(next);
+    chain.links.push_back(next);
+    chain.cases.push_back({constant, equal});
+    next = other;
+  }
+  chain.default_bb = next;
+  return true;
+}
+
+// 链节中定义的值除 load 外只在链中使用, 链节中的 load 改为使用 head 中比较的值
+static bool detach_links(const std::vector<koopa_raw_basic_block_t> &bbs, const chain_t &chain) {
+  std::unordered_set<koopa_raw_value_t> defined;
+  std::unordered_set<koopa_raw_basic_block_t> links(chain.links.begin(), chain.links.end());
+  for(koopa_raw_basic_block_t link : chain.links)
+    for(koopa_raw_value_t inst : get_insts(link))
+      if(inst->kind.tag != KOOPA_RVT_LOAD)
+        defined.insert(inst);
+  for(koopa_raw_basic_block_t bb : bbs) {
+    if(links.count(bb))
+      continue;
+    for(koopa_raw_value_t inst : get_insts(bb))
+      for(koopa_raw_value_t *operand : get_operands(inst))
+        if(defined.count(*operand))
+          return false;
+  }
+  for(koopa_raw_basic_block_t link : chain.links)
+    for(koopa_raw_value_t inst : get_insts(link))
+      if(inst->kind.tag == KOOPA_RVT_LOAD)
+        replace_uses(bbs, inst, chain.value);
+  return true;
+}
+
+// 为按值排序的 cases[lo, hi) 生成比较树, 返回其入口: 较少时逐个比较, 否则与中间的值比较后二分
+static koopa_raw_basic_block_t build_tree(const chain_t &chain, const std::vector<case_t> &cases, size_t lo,
+                                          size_t hi, std::vector<koopa_raw_basic_block_t> &new_bbs) {
+  if(hi - lo > tree_leaf_cases) {
+    size_t mid = (lo + hi) / 2;
+    koopa_raw_basic_block_t left = build_tree(chain, cases, lo, mid, new_bbs);
+    koopa_raw_basic_block_t right = build_tree(chain, cases, mid, hi, new_bbs);
+    koopa_raw_basic_block_data_t *bb = new_basic_block(new_label("sw", chain.head));
+    koopa_raw_value_t cond = new_binary(KOOPA_RBO_LT, chain.value, new_integer(cases[mid].value));
+    set_insts(bb, {cond, new_branch(cond, left, right)});
+    new_bbs.push_back(bb);
+    return bb;
+  }
+  koopa_raw_basic_block_t next = chain.default_bb;
+  for(size_t i = hi; i-- > lo;) {
+    koopa_raw_basic_block_data_t *bb = new_basic_block(new_label("sw", chain.head));
+    koopa_raw_value_t cond = new_binary(KOOPA_RBO_EQ, chain.value, new_integer(cases[i].value));
+    set_insts(bb, {cond, new_branch(cond, cases[i].target, next)});
+    new_bbs.push_back(bb);
+    next = bb;
+  }
+  return next;
+}
+
+// 将 switch 式的等值比较链改为跳转表或比较树
+// 分支值稠密时记录跳转表, 由后端在 head 末尾按值取出目标跳转, 比较链保留在 IR 中表示各分支的控制流;
+// 稀疏时将比较链替换为平衡的比较树
+static bool lower_chain(koopa_raw_function_t func, const cfg_t &cfg, koopa_raw_basic_block_t head,
+                        std::unordered_set<koopa_raw_basic_block_t> &done) {
+  chain_t chain;
+  if(!collect_chain(cfg, head, chain) || chain.cases.size() < min_table_cases)
+    return false;
+  // 相同的值只保留第一个分支
+  std::vector<case_t> cases;
+  std::unordered_set<int> values;
+  for(const case_t &c : chain.cases)
+    if(values.insert(c.value).second)
+      cases.push_back(c);
+  std::sort(cases.begin(), cases.end(), [](const case_t &a, const case_t &b) { return a.value < b.value; });
+  long long range = (long long)cases.back().value - cases.front().value + 1;
+  bool dense = range <= max_table_size && range <= max_table_ratio * (long long)cases.size();
+  if(!dense && cases.size() < min_tree_cases)
+    return false;
+  std::vector<koopa_raw_basic_block_t> bbs = get_bbs(func);
+  if(!detach_links(bbs, chain))
+    return false;
+
+  // head 末尾的比较只被 br 使用时, 使用跳转表或比较树后不必计算
+  koopa_raw_value_t cond = get_terminator(head)->kind.data.branch.cond;
+  bool cond_used = false;
+  for(koopa_raw_basic_block_t bb : bbs)
+    for(koopa_raw_value_t inst : get_insts(bb))
+      for(koopa_raw_value_t *operand : get_operands(inst))
+        cond_used |= *operand == cond && inst != get_terminator(head);
+
+  if(dense) {
+    jump_table_t table;
+    table.value = chain.value;
+    table.low = cases.front().value;
+    table.targets.assign(range, chain.default_bb);
+    table.default_bb = chain.default_bb;
+    for(const case_t &c : cases)
+      table.targets[c.value - table.low] = c.target;
+    table.cond = cond_used ? nullptr : cond;
+    jump_tables[get_terminator(head)] = table;
+    // 保留的链节不再作为新的比较链的开头
+    done.insert(chain.links.begin(), chain.links.end());
+    return true;
+  }
+
+  std::vector<koopa_raw_basic_block_t> new_bbs;
+  koopa_raw_basic_block_t root = build_tree(chain, cases, 0, cases.size(), new_bbs);
+  std::vector<koopa_raw_value_t> insts = get_insts(head);
+  insts.pop_back();
+  if(!cond_used && !insts.empty() && insts.back() == cond)
+    insts.pop_back();
+  insts.push_back(new_jump(root));
+  set_insts(head, insts);
+
+  std::unordered_set<koopa_raw_basic_block_t> links(chain.links.begin(), chain.links.end());
+  std::vector<koopa_raw_basic_block_t> result;
+  for(koopa_raw_basic_block_t bb : bbs) {
+    if(links.count(bb))
+      continue;
+    result.push_back(bb);
+    if(bb == head)
+      result.insert(result.end(), new_bbs.rbegin(), new_bbs.rend());
+  }
+  set_bbs(func, result);
+  return true;
+}
+
+// 识别所有函数中同一变量与多个常量依次比较的 if-else 链, 改为跳转表或比较树
+void lower_switches(koopa_raw_program_t &program) {
+  for(size_t i = 0; i < program.funcs.len; ++i) {
+    koopa_raw_function_t func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    if(func->bbs.len == 0)
+      continue;
+    std::unordered_set<koopa_raw_basic_block_t> done;
+    bool changed = true;
+    while(changed) {
+      changed = false;
+      cfg_t cfg = build_cfg(func);
+      for(int b : cfg.rpo) {
+        koopa_raw_basic_block_t bb = cfg.bbs[b];
+        if(done.count(bb))
+          continue;
+        done.insert(bb);
+        if(lower_chain(func, cfg, bb, done)) {
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+}
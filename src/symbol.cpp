@@ -2,6 +2,10 @@
 
 symbol_table_list_elem_t *curr_symbol_table = nullptr;
 std::unordered_map<std::string, symbol_t> global_symbol_table;
+bool runtime_routines = false;
+
+/** 运行时函数每次迭代处理的字数 */
+static const int runtime_unroll = 8;
 
 void create_symbol_table() {
     if(curr_symbol_table == nullptr) {
@@ -39,6 +43,57 @@ symbol_table_list_elem_t *search_symbol_table(std::string ident) {
     return nullptr;
 }
 
+// 生成运行时函数 __sysy_memset(dst, value, count) 或 __sysy_memcpy(dst, src, count), count 为字数
+// 先每次迭代处理 runtime_unroll 个字, 再逐字处理余下的字; memcpy 先读出一次迭代的所有字再写入, 要求两段内存不重叠
+static std::string runtime_routine(const std::string &name, bool copy) {
+  std::string fun = "@__sysy_" + name, label = "%__sysy_" + name;
+  std::string str;
+  str += "fun " + fun + "(" + fun + "_dst: *i32, " + fun + (copy ? "_src: *i32, " : "_value: i32, ") + fun + "_count: i32) {\n";
+  str += label + "_entry:\n";
+  str += "\t" + fun + "_d = alloc *i32\n\tstore " + fun + "_dst, " + fun + "_d\n";
+  if(copy)
+    str += "\t" + fun + "_s = alloc *i32\n\tstore " + fun + "_src, " + fun + "_s\n";
+  else
+    str += "\t" + fun + "_v = alloc i32\n\tstore " + fun + "_value, " + fun + "_v\n";
+  str += "\t" + fun + "_n = alloc i32\n\tstore " + fun + "_count, " + fun + "_n\n";
+  str += "\tjump " + label + "_cond" + std::to_string(runtime_unroll) + "\n";
+  for(int words : {runtime_unroll, 1}) {
+    std::string w = std::to_string(words), v = "%w" + w + "_";
+    std::string next = words == 1 ? label + "_end" : label + "_cond1";
+    str += label + "_cond" + w + ":\n";
+    str += "\t" + v + "n = load " + fun + "_n\n";
+    str += "\t" + v + "c = ge " + v + "n, " + w + "\n";
+    str += "\tbr " + v + "c, " + label + "_body" + w + ", " + next + "\n";
+    str += label + "_body" + w + ":\n";
+    str += "\t" + v + "d = load " + fun + "_d\n";
+    str += "\t" + v + (copy ? "s = load " + fun + "_s\n" : "v = load " + fun + "_v\n");
+    for(int k = 0; k < words && copy; ++k) {
+      std::string src = v + "s";
+      if(k > 0) {
+        src = v + "s" + std::to_string(k);
+        str += "\t" + src + " = getptr " + v + "s, " + std::to_string(k) + "\n";
+      }
+      str += "\t" + v + "x" + std::to_string(k) + " = load " + src + "\n";
+    }
+    for(int k = 0; k < words; ++k) {
+      std::string dst = v + "d";
+      if(k > 0) {
+        dst = v + "d" + std::to_string(k);
+        str += "\t" + dst + " = getptr " + v + "d, " + std::to_string(k) + "\n";
+      }
+      str += "\tstore " + (copy ? v + "x" + std::to_string(k) : v + "v") + ", " + dst + "\n";
+    }
+    str += "\t" + v + "dn = getptr " + v + "d, " + w + "\n\tstore " + v + "dn, " + fun + "_d\n";
+    if(copy)
+      str += "\t" + v + "sn = getptr " + v + "s, " + w + "\n\tstore " + v + "sn, " + fun + "_s\n";
+    str += "\t" + v + "m = load " + fun + "_n\n";
+    str += "\t" + v + "mn = sub " + v + "m, " + w + "\n\tstore " + v + "mn, " + fun + "_n\n";
+    str += "\tjump " + label + "_cond" + w + "\n";
+  }
+  str += label + "_end:\n\tret\n}\n";
+  return str;
+}
+
 std::string koopa_lib() {
   std::string str;
   str += "decl @getint(): i32\n";
@@ -57,5 +112,9 @@ std::string koopa_lib() {
   global_symbol_table[std::string("putarray")] = symbol_t{1, symbol_tag::Symbol_Func};
   global_symbol_table[std::string("starttime")] = symbol_t{1, symbol_tag::Symbol_Func};
   global_symbol_table[std::string("stoptime")] = symbol_t{1, symbol_tag::Symbol_Func};
+  if(runtime_routines) {
+    str += runtime_routine("memset", false);
+    str += runtime_routine("memcpy", true);
+  }
   return str;
 }
\ No newline at end of file
@@ -49,4 +49,7 @@ struct symbol_table_list_elem_t {
 void create_symbol_table();
 void delete_symbol_table();
 symbol_table_list_elem_t *search_symbol_table(std::string ident);
-std::string koopa_lib();
\ No newline at end of file
+std::string koopa_lib();
+
+/** koopa_lib() 是否附带优化时使用的运行时函数 (按字展开的 memset / memcpy) */
+extern bool runtime_routines;
\ No newline at end of file
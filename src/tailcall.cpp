@@ -0,0 +1,169 @@
+#include "koopa.h"
+#include "opt.hpp"
+#include <cassert>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+std::unordered_set<koopa_raw_value_t> tail_calls;
+
+// 判断 insts[id] 处的调用是否为尾调用: 其后紧跟返回该调用结果 (或无返回值) 的 ret,
+// 或跳转到只含这样一条 ret 的基本块
+static bool is_tail_call(const std::vector<koopa_raw_value_t> &insts, size_t id) {
+  koopa_raw_value_t call = insts[id];
+  if(call->kind.tag != KOOPA_RVT_CALL || id + 1 >= insts.size())
+    return false;
+  koopa_raw_value_t next = insts[id + 1];
+  if(next->kind.tag == KOOPA_RVT_JUMP) {
+    koopa_raw_basic_block_t target = next->kind.data.jump.target;
+    if(target->insts.len != 1)
+      return false;
+    next = get_terminator(target);
+  }
+  if(next->kind.tag != KOOPA_RVT_RETURN)
+    return false;
+  return next->kind.data.ret.value == nullptr || next->kind.data.ret.value == call;
+}
+
+// 参数 param 是否只被入口块中一条写入局部变量的 store 使用, 是则返回该 store
+static koopa_raw_value_t param_store(const std::vector<koopa_raw_basic_block_t> &bbs, koopa_raw_value_t param) {
+  koopa_raw_value_t store = nullptr;
+  for(size_t i = 0; i < bbs.size(); ++i) {
+    for(koopa_raw_value_t inst : get_insts(bbs[i])) {
+      for(koopa_raw_value_t *operand : get_operands(inst)) {
+        if(*operand != param)
+          continue;
+        if(store != nullptr || i != 0 || inst->kind.tag != KOOPA_RVT_STORE ||
+           inst->kind.data.store.value != param || inst->kind.data.store.dest->kind.tag != KOOPA_RVT_ALLOC)
+          return nullptr;
+        store = inst;
+      }
+    }
+  }
+  return store;
+}
+
+// 将函数中的自尾递归改写为跳回函数开头的循环
+static void eliminate_tail_recursion(koopa_raw_function_t func) {
+  std::vector<koopa_raw_basic_block_t> bbs = get_bbs(func);
+  std::vector<std::pair<size_t, koopa_raw_value_t> > sites;
+  for(size_t i = 0; i < bbs.size(); ++i) {
+    std::vector<koopa_raw_value_t> insts = get_insts(bbs[i]);
+    for(size_t j = 0; j < insts.size(); ++j)
+      if(is_tail_call(insts, j) && insts[j]->kind.data.call.callee == func)
+        sites.push_back(std::make_pair(i, insts[j]));
+  }
+  if(sites.empty())
+    return;
+
+  // 新的入口块负责把参数写入局部变量, 原入口块成为循环头
+  koopa_raw_basic_block_t header = bbs[0];
+  koopa_raw_basic_block_data_t *entry = new_basic_block(new_label("tre", header));
+  std::vector<koopa_raw_value_t> entry_insts, header_loads;
+  std::unordered_set<koopa_raw_value_t> moved;
+  std::vector<koopa_raw_value_t> slots;
+  for(size_t i = 0; i < func->params.len; ++i) {
+    koopa_raw_value_t param = reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i]);
+    koopa_raw_value_t store = param_store(bbs, param);
+    if(store != nullptr) {
+      // 参数仅用于初始化局部变量, 直接复用该变量
+      koopa_raw_value_t slot = store->kind.data.store.dest;
+      entry_insts.push_back(slot);
+      entry_insts.push_back(store);
+      moved.insert(slot);
+      moved.insert(store);
+      slots.push_back(slot);
+      continue;
+    }
+    koopa_raw_value_data_t *slot = new_value(pointer_type(param->ty), KOOPA_RVT_ALLOC);
+    koopa_raw_value_data_t *store_param = new_value(simple_type(KOOPA_RTT_UNIT), KOOPA_RVT_STORE);
+    store_param->kind.data.store.value = param;
+    store_param->kind.data.store.dest = slot;
+    koopa_raw_value_data_t *load = new_value(param->ty, KOOPA_RVT_LOAD);
+    load->kind.data.load.src = slot;
+    replace_uses(bbs, param, load);
+    entry_insts.push_back(slot);
+    entry_insts.push_back(store_param);
+    header_loads.push_back(load);
+    slots.push_back(slot);
+  }
+  entry_insts.push_back(new_jump(header));
+  set_insts(entry, entry_insts);
+
+  std::vector<koopa_raw_value_t> header_insts = header_loads;
+  for(koopa_raw_value_t inst : get_insts(header))
+    if(!moved.count(inst))
+      header_insts.push_back(inst);
+  set_insts(header, header_insts);
+
+  // 尾调用改为写入参数变量并跳回循环头
+  for(auto site : sites) {
+    std::vector<koopa_raw_value_t> insts = get_insts(bbs[site.first]);
+    koopa_raw_value_t call = site.second;
+    size_t id = std::find(insts.begin(), insts.end(), call) - insts.begin();
+    std::vector<koopa_raw_value_t> new_insts(insts.begin(), insts.begin() + id);
+    std::vector<koopa_raw_value_t> values, loads;
+    const koopa_raw_slice_t &args = call->kind.data.call.args;
+    for(size_t i = 0; i < args.len; ++i)
+      values.push_back(reinterpret_cast<koopa_raw_value_t>(args.buffer[i]));
+    // load 的结果直接引用被读变量的栈位置, 若该变量会先被写入, 需先暂存实参
+    for(size_t i = 0; i < values.size(); ++i) {
+      loads.push_back(nullptr);
+      if(values[i]->kind.tag != KOOPA_RVT_LOAD)
+        continue;
+      bool clobbered = false;
+      for(size_t j = 0; j < i; ++j)
+        clobbered |= values[i]->kind.data.load.src == slots[j];
+      if(!clobbered)
+        continue;
+      koopa_raw_value_data_t *tmp = new_value(pointer_type(values[i]->ty), KOOPA_RVT_ALLOC);
+      koopa_raw_value_data_t *store = new_value(simple_type(KOOPA_RTT_UNIT), KOOPA_RVT_STORE);
+      store->kind.data.store.value = values[i];
+      store->kind.data.store.dest = tmp;
+      koopa_raw_value_data_t *load = new_value(values[i]->ty, KOOPA_RVT_LOAD);
+      load->kind.data.load.src = tmp;
+      entry_insts.insert(entry_insts.begin(), tmp);
+      new_insts.push_back(store);
+      loads[i] = load;
+    }
+    for(size_t i = 0; i < values.size(); ++i) {
+      if(loads[i] != nullptr) {
+        new_insts.push_back(loads[i]);
+        values[i] = loads[i];
+      }
+      koopa_raw_value_data_t *store = new_value(simple_type(KOOPA_RTT_UNIT), KOOPA_RVT_STORE);
+      store->kind.data.store.value = values[i];
+      store->kind.data.store.dest = slots[i];
+      new_insts.push_back(store);
+    }
+    new_insts.push_back(new_jump(header));
+    set_insts(bbs[site.first], new_insts);
+  }
+  set_insts(entry, entry_insts);
+
+  bbs.insert(bbs.begin(), entry);
+  set_bbs(func, bbs);
+}
+
+// 消除所有函数中的自尾递归
+void eliminate_tail_recursion(koopa_raw_program_t &program) {
+  for(size_t i = 0; i < program.funcs.len; ++i) {
+    koopa_raw_function_t func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    if(func->bbs.len != 0)
+      eliminate_tail_recursion(func);
+  }
+}
+
+// 标记其余尾调用, 参数都能通过寄存器传递时, 由后端释放栈帧后直接跳转到被调用函数
+void mark_tail_calls(koopa_raw_program_t &program) {
+  tail_calls.clear();
+  for(size_t i = 0; i < program.funcs.len; ++i) {
+    koopa_raw_function_t func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    for(koopa_raw_basic_block_t bb : get_bbs(func)) {
+      std::vector<koopa_raw_value_t> insts = get_insts(bb);
+      for(size_t j = 0; j < insts.size(); ++j)
+        if(is_tail_call(insts, j) && insts[j]->kind.data.call.args.len <= 8)
+          tail_calls.insert(insts[j]);
+    }
+  }
+}
@@ -0,0 +1,151 @@
+#include "koopa.h"
+#include "opt.hpp"
+#include <cassert>
+#include <climits>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+// 复制 count 份循环体并依次连接, 最后一份的回边跳转到 last, 返回第一份的入口
+static koopa_raw_basic_block_t chain_copies(const counted_loop_t &info, int count, koopa_raw_basic_block_t last,
+                                            std::vector<koopa_raw_basic_block_t> &new_bbs) {
+  koopa_raw_basic_block_t next = last;
+  std::vector<std::vector<koopa_raw_basic_block_t> > copies(count);
+  for(int i = count - 1; i >= 0; --i) {
+    std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> value_map;
+    std::unordered_map<koopa_raw_basic_block_t, koopa_raw_basic_block_t> bb_map;
+    copies[i] = clone_blocks(info.body, value_map, bb_map, "unr");
+    retarget(copies[i], info.header, next);
+    next = bb_map[info.entry];
+  }
+  for(auto &copy : copies)
+    new_bbs.insert(new_bbs.end(), copy.begin(), copy.end());
+  return next;
+}
+
+// 计算常量初值与上界下的迭代次数, 超过 limit 或无法确定时返回 -1
+int trip_count(const counted_loop_t &info, int limit) {
+  int bound, init;
+  if(info.preheaders.size() != 1 || !get_const(info.bound, bound))
+    return -1;
+  // 初值为前驱块中最后一次写入循环变量的常量
+  std::vector<koopa_raw_value_t> insts = get_insts(info.preheaders[0]);
+  koopa_raw_value_t init_store = nullptr;
+  for(koopa_raw_value_t inst : insts)
+    if(inst->kind.tag == KOOPA_RVT_STORE && inst->kind.data.store.dest == info.var)
+      init_store = inst;
+  if(init_store == nullptr || !get_const(init_store->kind.data.store.value, init))
+    return -1;
+  long long i = init;
+  int count = 0;
+  while(eval_compare(info.op, i, bound)) {
+    if(++count > limit)
+      return -1;
+    i += info.step;
+  }
+  return count;
+}
+
+// 对计数循环进行完全展开或部分展开, 返回是否修改了函数
+static bool unroll_loop(koopa_raw_function_t func, const counted_loop_t &info,
+                        std::unordered_set<koopa_raw_basic_block_t> &done) {
+  std::vector<koopa_raw_basic_block_t> bbs = get_bbs(func);
+  size_t size = std::max(info.size, (size_t)1);
+  int max_copies = opt_options.unroll_size_limit / size;
+  std::vector<koopa_raw_basic_block_t> new_bbs;
+
+  // 迭代次数较少时完全展开, 删除原循环
+  int count = trip_count(info, max_copies);
+  if(count > 0) {
+    koopa_raw_basic_block_t first = chain_copies(info, count, info.exit, new_bbs);
+    retarget(info.preheaders, info.header, first);
+    std::unordered_set<koopa_raw_basic_block_t> old(info.body.begin(), info.body.end());
+    old.insert(info.header);
+    auto pos = std::find(bbs.begin(), bbs.end(), info.header) - bbs.begin();
+    bbs.erase(std::remove_if(bbs.begin(), bbs.end(),
+                             [&](koopa_raw_basic_block_t bb) { return old.count(bb) != 0; }), bbs.end());
+    bbs.insert(bbs.begin() + pos, new_bbs.begin(), new_bbs.end());
+    set_bbs(func, bbs);
+    return true;
+  }
+
+  // 否则按 factor 部分展开: 新循环头检查剩余迭代数不少于 factor, 原循环处理余下的迭代
+  int factor = std::min(opt_options.unroll_factor, max_copies);
+  if(factor < 2)
+    return false;
+  std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> value_map;
+  std::unordered_map<koopa_raw_basic_block_t, koopa_raw_basic_block_t> bb_map;
+  koopa_raw_basic_block_t new_header = clone_blocks({info.header}, value_map, bb_map, "unr")[0];
+  done.insert(new_header);
+  koopa_raw_basic_block_t first = chain_copies(info, factor, new_header, new_bbs);
+
+  // var op bound - (factor - 1) * step 成立时, 之后 factor 次迭代的条件均成立
+  koopa_raw_value_t bound = value_map.count(info.bound) ? value_map[info.bound] : info.bound;
+  std::vector<koopa_raw_value_t> insts = get_insts(new_header);
+  insts.pop_back();
+  koopa_raw_value_t old_cond = value_map[info.cond];
+  bool cond_used = false;
+  for(koopa_raw_value_t inst : insts)
+    for(koopa_raw_value_t *operand : get_operands(inst))
+      cond_used |= *operand == old_cond;
+  if(!cond_used)
+    insts.erase(std::find(insts.begin(), insts.end(), old_cond));
+  long long delta = (long long)(factor - 1) * info.step;
+  int bound_const;
+  koopa_raw_value_t limit;
+  if(get_const(bound, bound_const) && bound_const - delta >= INT_MIN && bound_const - delta <= INT_MAX)
+    limit = new_integer(bound_const - delta);
+  else {
+    koopa_raw_value_data_t *sub = new_value(simple_type(KOOPA_RTT_INT32), KOOPA_RVT_BINARY);
+    sub->kind.data.binary.op = KOOPA_RBO_SUB;
+    sub->kind.data.binary.lhs = bound;
+    sub->kind.data.binary.rhs = new_integer(delta);
+    insts.push_back(sub);
+    limit = sub;
+  }
+  koopa_raw_value_data_t *cond = new_value(simple_type(KOOPA_RTT_INT32), KOOPA_RVT_BINARY);
+  cond->kind.data.binary.op = info.op;
+  cond->kind.data.binary.lhs = value_map[info.load];
+  cond->kind.data.binary.rhs = limit;
+  insts.push_back(cond);
+  koopa_raw_value_data_t *br = new_value(simple_type(KOOPA_RTT_UNIT), KOOPA_RVT_BRANCH);
+  br->kind.data.branch.cond = cond;
+  br->kind.data.branch.true_bb = first;
+  br->kind.data.branch.false_bb = info.header;
+  br->kind.data.branch.true_args = make_slice(std::vector<const void *>(), KOOPA_RSIK_VALUE);
+  br->kind.data.branch.false_args = make_slice(std::vector<const void *>(), KOOPA_RSIK_VALUE);
+  insts.push_back(br);
+  set_insts(new_header, insts);
+
+  retarget(info.preheaders, info.header, new_header);
+  new_bbs.insert(new_bbs.begin(), new_header);
+  auto pos = std::find(bbs.begin(), bbs.end(), info.header) - bbs.begin();
+  bbs.insert(bbs.begin() + pos, new_bbs.begin(), new_bbs.end());
+  set_bbs(func, bbs);
+  return true;
+}
+
+// 展开所有可识别的计数循环
+void unroll_loops(koopa_raw_program_t &program) {
+  for(size_t i = 0; i < program.funcs.len; ++i) {
+    koopa_raw_function_t func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    if(func->bbs.len == 0)
+      continue;
+    std::unordered_set<koopa_raw_basic_block_t> done;
+    bool changed = true;
+    while(changed) {
+      changed = false;
+      cfg_t cfg = build_cfg(func);
+      for(const loop_t &loop : cfg.loops) {
+        if(done.count(cfg.bbs[loop.header]))
+          continue;
+        done.insert(cfg.bbs[loop.header]);
+        counted_loop_t info;
+        if(analyze_counted_loop(cfg, loop, info) && unroll_loop(func, info, done)) {
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+}